@@ -107,6 +107,30 @@ public:
       */
     virtual bool writeSectors(void* buffer, qint64 offset, qint64 numSectors) = 0;
 
+    /**
+      * Bypass the page cache for readSectors() and writeSectors() on an opened device.
+      * Backends that cannot do direct I/O keep the default implementation.
+      * @param b true to bypass the page cache, false to go through it
+      * @return true if the setting could be applied
+      */
+    virtual bool setDirectIO(bool b) {
+        Q_UNUSED(b)
+        return false;
+    }
+
+    /**
+      * Zero sectors on an exclusively opened device without transferring any data, if the
+      * device can do that. Backends that cannot keep the default implementation.
+      * @param offset offset sector where to start zeroing
+      * @param numSectors number of sectors to zero
+      * @return true on success
+      */
+    virtual bool zeroSectors(qint64 offset, qint64 numSectors) {
+        Q_UNUSED(offset)
+        Q_UNUSED(numSectors)
+        return false;
+    }
+
 protected:
     void setExclusive(bool b) {
         m_Exclusive = b;
@@ -0,0 +1,230 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/backupimage.h"
+
+#include "util/crc32.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QString>
+
+#include <zstd.h>
+
+static const char headerMagic[] = "KPMCORE-IMAGE\x1a\x00"; // 16 bytes including the terminating 0
+static const char footerMagic[] = "KPMINDEX";
+
+/** @return true if the given file starts with the header of a BackupImage */
+bool BackupImage::isImage(const QString& fileName)
+{
+    QFile file(fileName);
+
+    return file.open(QIODevice::ReadOnly) && file.read(16) == QByteArray(headerMagic, 16);
+}
+
+/** @return the compression new images are written with; every build of KPMcore can read it */
+BackupImage::Compression BackupImage::defaultCompression()
+{
+    return Zstd;
+}
+
+/** @return the number of chunks in an image with the given header */
+qint64 BackupImage::chunkCount(const Header& header)
+{
+    const qint64 bytes = header.sectors * header.sectorSize;
+
+    return (bytes + header.chunkSize - 1) / header.chunkSize;
+}
+
+/** Compresses a chunk.
+    @param data the chunk to compress
+    @param size number of bytes in the chunk
+    @param compression the Compression to use
+    @return the compressed data or an empty QByteArray if compressing failed or did not save space
+*/
+QByteArray BackupImage::compress(const char* data, qint64 size, Compression compression)
+{
+    QByteArray rval;
+
+    if (compression == Zstd) {
+        rval.resize(ZSTD_compressBound(size));
+
+        // backup storage, not the CPU, is what is slow, so trade some CPU time for a smaller image
+        const size_t n = ZSTD_compress(rval.data(), rval.size(), data, size, 6);
+
+        rval.resize(ZSTD_isError(n) ? 0 : n);
+    }
+
+    if (rval.size() >= size)
+        rval.clear();
+
+    return rval;
+}
+
+/** Decompresses a chunk.
+    @param data the compressed chunk
+    @param out buffer to decompress to
+    @param size the number of bytes the chunk has uncompressed
+    @param compression the Compression the chunk uses
+    @return true on success
+*/
+bool BackupImage::decompress(const QByteArray& data, char* out, qint64 size, Compression compression)
+{
+    if (compression == Zstd) {
+        const size_t n = ZSTD_decompress(out, size, data.constData(), data.size());
+        return !ZSTD_isError(n) && static_cast<qint64>(n) == size;
+    }
+
+    return false;
+}
+
+/** Writes the header to the start of an image.
+    @param file the image file
+    @param header the header to write
+    @return true on success
+*/
+bool BackupImage::writeHeader(QFile& file, const Header& header)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    stream.writeRawData(headerMagic, 16);
+    stream << header.version << header.sectorSize << header.chunkSize << header.compression << header.sectors;
+    stream << header.fileSystemType << header.sectorsUsed << header.label << header.uuid;
+    stream << checksumCrc32(data.constData(), data.size());
+
+    if (data.size() > headerSize)
+        return false;
+
+    data.append(QByteArray(headerSize - data.size(), '\0'));
+
+    return file.seek(0) && file.write(data) == headerSize;
+}
+
+/** Reads the header from the start of an image.
+    @param file the image file
+    @param header the header to fill in
+    @return true if the file has a header of a version we can read
+*/
+bool BackupImage::readHeader(QFile& file, Header& header)
+{
+    if (!file.seek(0))
+        return false;
+
+    const QByteArray data = file.read(headerSize);
+    if (data.size() != headerSize || !data.startsWith(QByteArray(headerMagic, 16)))
+        return false;
+
+    QDataStream stream(data);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream.skipRawData(16);
+    stream >> header.version;
+
+    if (stream.status() != QDataStream::Ok || header.version != version)
+        return false;
+
+    stream >> header.sectorSize >> header.chunkSize >> header.compression >> header.sectors;
+    stream >> header.fileSystemType >> header.sectorsUsed >> header.label >> header.uuid;
+
+    const qint64 checksummed = stream.device()->pos();
+    quint32 checksum;
+    stream >> checksum;
+
+    if (checksum != checksumCrc32(data.constData(), checksummed))
+        return false;
+
+    return stream.status() == QDataStream::Ok && header.compression <= Zstd && header.sectorSize > 0 && header.chunkSize > 0 &&
+           header.chunkSize % header.sectorSize == 0 && header.sectors >= 0;
+}
+
+/** Appends the index and the footer to an image.
+    @param file the image file, positioned after the last chunk
+    @param index the index entries for all chunks
+    @return true on success
+*/
+bool BackupImage::writeIndex(QFile& file, const QList<IndexEntry>& index)
+{
+    const qint64 indexOffset = file.pos();
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+
+    for (const IndexEntry& e : index)
+        stream << e.offset << e.size << e.type << e.crc;
+
+    const quint32 checksum = checksumCrc32(data.constData(), data.size());
+
+    stream.writeRawData(footerMagic, 8);
+    stream << indexOffset << static_cast<qint64>(index.size()) << checksum << static_cast<quint32>(0);
+
+    return file.write(data) == data.size();
+}
+
+/** Reads the index of an image from the footer at its end.
+    @param file the image file
+    @param header the image's header
+    @param index the index to fill in
+    @return true if there is a complete index for all chunks the header says there are
+*/
+bool BackupImage::readIndex(QFile& file, const Header& header, QList<IndexEntry>& index)
+{
+    const qint64 fileSize = file.size();
+
+    if (fileSize < headerSize + footerSize || !file.seek(fileSize - footerSize))
+        return false;
+
+    QByteArray footer = file.read(footerSize);
+    if (footer.size() != footerSize || !footer.startsWith(footerMagic))
+        return false;
+
+    qint64 indexOffset;
+    qint64 count;
+    quint32 checksum;
+    QDataStream footerStream(footer.mid(8));
+    footerStream.setByteOrder(QDataStream::LittleEndian);
+    footerStream >> indexOffset >> count >> checksum;
+
+    if (count != chunkCount(header) || indexOffset < headerSize || indexOffset + count * indexEntrySize != fileSize - footerSize || !file.seek(indexOffset))
+        return false;
+
+    const QByteArray data = file.read(count * indexEntrySize);
+
+    if (data.size() != count * indexEntrySize || checksum != checksumCrc32(data.constData(), data.size()))
+        return false;
+
+    QDataStream stream(data);
+    stream.setByteOrder(QDataStream::LittleEndian);
+
+    index.clear();
+    index.reserve(count);
+
+    for (qint64 i = 0; i < count; i++) {
+        IndexEntry e;
+        stream >> e.offset >> e.size >> e.type >> e.crc;
+
+        if (e.type != Unused && (e.offset < headerSize || e.offset + e.size > indexOffset))
+            return false;
+
+        index.append(e);
+    }
+
+    return stream.status() == QDataStream::Ok;
+}
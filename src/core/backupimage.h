@@ -0,0 +1,102 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(BACKUPIMAGE__H)
+
+#define BACKUPIMAGE__H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QtGlobal>
+
+class QFile;
+
+/** The compressed image format written by backups.
+
+    An image starts with a header of headerSize bytes, followed by the chunks of the backed up
+    sectors, each compressed on its own, and ends with an index of where each chunk is and a footer
+    pointing to the index. Since every chunk can be found and decompressed without the others,
+    restoring can decompress many chunks at once.
+
+    A chunk whose sectors the FileSystem did not use is not stored at all.
+
+    The header also describes the FileSystem that was backed up, so it can be restored without
+    probing the target afterwards. Header and index both carry a CRC-32, so broken or truncated
+    images are rejected before anything is written to a disk. Each index entry also has the CRC-32
+    of its chunk, so a damaged chunk is found while restoring.
+
+    @see CopyTargetImage, CopySourceImage
+*/
+class BackupImage
+{
+public:
+    /** Compression used for the chunks of an image */
+    enum Compression {
+        None = 0,
+        Zstd = 1
+    };
+
+    /** How a chunk is stored */
+    enum ChunkType {
+        Stored = 0,         /**< uncompressed */
+        Compressed = 1,     /**< compressed with the image's Compression */
+        Unused = 2          /**< not stored, the FileSystem did not use any of its sectors */
+    };
+
+    /** The header at the start of an image */
+    struct Header {
+        quint32 version;
+        quint32 sectorSize;     /**< logical sector size of the device backed up */
+        quint32 chunkSize;      /**< number of bytes in each chunk before compression */
+        quint32 compression;    /**< the Compression used */
+        qint64 sectors;         /**< number of sectors in the image */
+        qint32 fileSystemType;  /**< the FileSystem::Type backed up, FileSystem::Unknown if not known */
+        qint64 sectorsUsed;     /**< sectors in use on the FileSystem or -1 if unknown */
+        QString label;          /**< the FileSystem's label */
+        QString uuid;           /**< the FileSystem's UUID */
+    };
+
+    /** Where a chunk is in the image */
+    struct IndexEntry {
+        qint64 offset;          /**< byte offset of the chunk's data */
+        quint32 size;           /**< number of bytes stored for the chunk */
+        quint32 type;           /**< the ChunkType */
+        quint32 crc;            /**< CRC-32 of the chunk before compression */
+    };
+
+public:
+    static const qint64 headerSize = 4096;
+    static const qint64 footerSize = 32;
+    static const qint64 indexEntrySize = 20;
+    static const quint32 version = 2;
+    static const quint32 defaultChunkSize = 1024 * 1024;
+
+    static bool isImage(const QString& fileName);
+    static Compression defaultCompression();
+    static qint64 chunkCount(const Header& header);
+
+    static QByteArray compress(const char* data, qint64 size, Compression compression);
+    static bool decompress(const QByteArray& data, char* out, qint64 size, Compression compression);
+
+    static bool writeHeader(QFile& file, const Header& header);
+    static bool readHeader(QFile& file, Header& header);
+    static bool writeIndex(QFile& file, const QList<IndexEntry>& index);
+    static bool readIndex(QFile& file, const Header& header, QList<IndexEntry>& index);
+};
+
+#endif
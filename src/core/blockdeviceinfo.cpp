@@ -0,0 +1,183 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/blockdeviceinfo.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+
+static const QString s_SysBlock = QStringLiteral("/sys/class/block/");
+
+static QMutex s_PolicyMutex;
+
+/** @return the first line of a sysfs attribute, trimmed, or an empty string if it cannot be read */
+static QString attribute(const QString& name, const QString& path)
+{
+    QFile f(s_SysBlock + name + QLatin1Char('/') + path);
+
+    if (!f.open(QIODevice::ReadOnly))
+        return QString();
+
+    return QString::fromLocal8Bit(f.readLine()).trimmed();
+}
+
+Q_GLOBAL_STATIC_WITH_ARGS(BlockDeviceInfo::Policy, s_Policy, (BlockDeviceInfo::defaultPolicy()))
+
+BlockDeviceInfo::BlockDeviceInfo() :
+    name(),
+    deviceNode(),
+    major(-1),
+    minor(-1),
+    removable(false),
+    readOnly(false),
+    rotational(false),
+    size(-1),
+    logicalBlockSize(-1),
+    physicalBlockSize(-1),
+    optimalIOSize(0),
+    model(),
+    serial()
+{
+}
+
+/** Reads what sysfs has about a whole block device.
+    @param deviceNode the device node, e.g. "/dev/sda", or a link to it
+    @param info set to what sysfs has
+    @return true if the device is a whole block device known to sysfs
+*/
+bool BlockDeviceInfo::read(const QString& deviceNode, BlockDeviceInfo& info)
+{
+    // resolves links like /dev/disk/by-id/...; fall back to the name if the node does not exist
+    const QString canonical = QFileInfo(deviceNode).canonicalFilePath();
+    const QString name = QFileInfo(canonical.isEmpty() ? deviceNode : canonical).fileName();
+
+    // partitions have a "partition" attribute, whole devices do not
+    if (name.isEmpty() || !QFileInfo::exists(s_SysBlock + name + QStringLiteral("/dev")) || QFileInfo::exists(s_SysBlock + name + QStringLiteral("/partition")))
+        return false;
+
+    const QString dev = attribute(name, QStringLiteral("dev"));
+
+    info.name = name;
+    info.deviceNode = QStringLiteral("/dev/") + name;
+    info.major = dev.section(QLatin1Char(':'), 0, 0).toInt();
+    info.minor = dev.section(QLatin1Char(':'), 1, 1).toInt();
+    info.removable = attribute(name, QStringLiteral("removable")) == QStringLiteral("1");
+    info.readOnly = attribute(name, QStringLiteral("ro")) == QStringLiteral("1");
+    info.rotational = attribute(name, QStringLiteral("queue/rotational")) == QStringLiteral("1");
+    info.size = attribute(name, QStringLiteral("size")).toLongLong() * 512; // always in 512 byte units
+    info.logicalBlockSize = attribute(name, QStringLiteral("queue/logical_block_size")).toInt();
+    info.physicalBlockSize = attribute(name, QStringLiteral("queue/physical_block_size")).toInt();
+    info.optimalIOSize = attribute(name, QStringLiteral("queue/optimal_io_size")).toLongLong();
+    info.model = attribute(name, QStringLiteral("device/model"));
+    info.serial = attribute(name, QStringLiteral("device/serial"));
+
+    if (info.logicalBlockSize <= 0)
+        info.logicalBlockSize = 512;
+    if (info.physicalBlockSize <= 0)
+        info.physicalBlockSize = -1;
+
+    return true;
+}
+
+/** Walks /sys/class/block once and returns the whole block devices the given Policy allows.
+
+    Devices are sorted by name, so "sda" comes before "sdb" and the order does not depend on the
+    order the kernel registered them in.
+
+    @param policy which devices to return
+    @return the devices
+*/
+QList<BlockDeviceInfo> BlockDeviceInfo::enumerate(const Policy& policy)
+{
+    QList<BlockDeviceInfo> rval;
+
+    const QStringList names = QDir(s_SysBlock).entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::System, QDir::Name);
+
+    for (const QString& name : names) {
+        BlockDeviceInfo info;
+
+        if (!read(QStringLiteral("/dev/") + name, info))
+            continue;
+
+        // loop devices are there even when nothing is attached to them
+        const bool isLoop = info.major == 7;
+
+        if (isLoop && (!policy.includeLoop || !QFileInfo::exists(s_SysBlock + name + QStringLiteral("/loop/backing_file"))))
+            continue;
+
+        if (!isLoop && !policy.majors.contains(info.major))
+            continue;
+
+        if (info.removable && !policy.includeRemovable)
+            continue;
+
+        if (info.readOnly && policy.excludeReadOnly)
+            continue;
+
+        rval.append(info);
+    }
+
+    return rval;
+}
+
+/** @return the block devices the current Policy allows */
+QList<BlockDeviceInfo> BlockDeviceInfo::enumerate()
+{
+    return enumerate(policy());
+}
+
+/** @return the Policy enumerate() uses by default */
+BlockDeviceInfo::Policy BlockDeviceInfo::policy()
+{
+    QMutexLocker locker(&s_PolicyMutex);
+    return *s_Policy;
+}
+
+/** @param p the Policy enumerate() is to use by default */
+void BlockDeviceInfo::setPolicy(const Policy& p)
+{
+    QMutexLocker locker(&s_PolicyMutex);
+    *s_Policy = p;
+}
+
+/** @return the Policy enumerate() uses unless told otherwise
+
+    The major numbers are those of linux.git/tree/Documentation/devices.txt for MFM, RLL and IDE
+    hard disks, SCSI disks, I2O hard disks, MMC, virtio and the block extended major NVMe uses.
+    Removable devices are included, since USB sticks and card readers are disks too.
+*/
+BlockDeviceInfo::Policy BlockDeviceInfo::defaultPolicy()
+{
+    Policy p;
+
+    p.majors = {
+        3, 22, 33, 34, 56, 57, 88, 89, 90, 91, 128, 129, 130, 131, 132, 133, 134, 135, // MFM, RLL and IDE hard disk/CD-ROM interface
+        8, 65, 66, 67, 68, 69, 70, 71, // SCSI disk devices
+        80, 81, 82, 83, 84, 85, 86, 87, // I2O hard disk
+        179, // MMC block devices
+        253, // Virtio KVM devices (e.g. /dev/vda)
+        259 // Block Extended Major (include NVMe)
+    };
+    p.includeLoop = false;
+    p.includeRemovable = true;
+    p.excludeReadOnly = false;
+
+    return p;
+}
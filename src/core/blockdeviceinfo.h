@@ -0,0 +1,70 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(BLOCKDEVICEINFO__H)
+
+#define BLOCKDEVICEINFO__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QList>
+#include <QString>
+#include <QtGlobal>
+
+/** What sysfs says about a whole block device.
+
+    enumerate() walks /sys/class/block once and reads everything scanning needs to know about each
+    disk from its attributes, without opening the device or running lsblk. Which disks are
+    returned is decided by a Policy: by default, disks with one of the major numbers of hard disks,
+    SSDs, NVMe, MMC and virtio devices.
+*/
+struct LIBKPMCORE_EXPORT BlockDeviceInfo
+{
+    /** Decides which block devices enumerate() returns */
+    struct Policy {
+        QList<qint32> majors;       /**< the major numbers of the devices to return */
+        bool includeLoop;           /**< true to also return loop devices that have a backing file */
+        bool includeRemovable;      /**< true to also return removable devices */
+        bool excludeReadOnly;       /**< true to skip read only devices */
+    };
+
+    QString name;               /**< the kernel name, e.g. "sda" */
+    QString deviceNode;         /**< the device node, e.g. "/dev/sda" */
+    qint32 major;               /**< major number */
+    qint32 minor;               /**< minor number */
+    bool removable;             /**< true if the medium is removable */
+    bool readOnly;              /**< true if the device is read only */
+    bool rotational;            /**< true if the device is a spinning disk */
+    qint64 size;                /**< size in bytes */
+    qint32 logicalBlockSize;    /**< logical sector size in bytes */
+    qint32 physicalBlockSize;   /**< physical sector size in bytes */
+    qint64 optimalIOSize;       /**< the preferred request size in bytes, 0 if the device has none */
+    QString model;              /**< the model as the device reports it, may be empty */
+    QString serial;             /**< the serial number as the device reports it, may be empty */
+
+    BlockDeviceInfo();
+
+    static bool read(const QString& deviceNode, BlockDeviceInfo& info);
+    static QList<BlockDeviceInfo> enumerate(const Policy& policy);
+    static QList<BlockDeviceInfo> enumerate();
+
+    static Policy policy();
+    static void setPolicy(const Policy& p);
+    static Policy defaultPolicy();
+};
+
+#endif
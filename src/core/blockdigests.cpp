@@ -0,0 +1,212 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/blockdigests.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+static const char manifestMagic[] = "# KPMcore block digests";
+
+/** Creates an empty set of digests.
+    @param sectorSize the size of a sector in bytes
+*/
+BlockDigests::BlockDigests(qint32 sectorSize) :
+    m_SectorSize(sectorSize)
+{
+}
+
+/** Sorts the entries by their offset, as verifying needs them. */
+void BlockDigests::sort()
+{
+    std::sort(m_Entries.begin(), m_Entries.end(), [](const Entry& a, const Entry& b) { return a.offset < b.offset; });
+}
+
+/** Saves the digests as a manifest.
+    @param fileName the file to save to
+    @return true on success
+*/
+bool BlockDigests::save(const QString& fileName) const
+{
+    QSaveFile file(fileName);
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+        return false;
+
+    QTextStream out(&file);
+    out << manifestMagic << " xxh64 " << sectorSize() << "\n";
+
+    for (const Entry& e : entries())
+        out << e.offset << " " << e.numSectors << " " << QString::number(e.digest, 16).rightJustified(16, QLatin1Char('0')) << "\n";
+
+    out.flush();
+
+    return out.status() == QTextStream::Ok && file.commit();
+}
+
+/** Loads the digests from a manifest.
+    @param fileName the file to load from
+    @return true if the file is a complete manifest with digests we can compute
+*/
+bool BlockDigests::load(const QString& fileName)
+{
+    QFile file(fileName);
+
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    QTextStream in(&file);
+    const QStringList head = in.readLine().split(QLatin1Char(' '), QString::SkipEmptyParts);
+
+    // "#", "KPMcore", "block", "digests", algorithm, sector size
+    if (head.size() != 6 || head.mid(0, 4).join(QLatin1Char(' ')) != QLatin1String(manifestMagic) || head[4] != QStringLiteral("xxh64"))
+        return false;
+
+    m_SectorSize = head[5].toInt();
+    m_Entries.clear();
+
+    while (!in.atEnd()) {
+        const QStringList fields = in.readLine().split(QLatin1Char(' '), QString::SkipEmptyParts);
+
+        if (fields.isEmpty())
+            continue;
+
+        bool ok[3];
+        const Entry e = { fields.value(0).toLongLong(&ok[0]), fields.value(1).toLongLong(&ok[1]), fields.value(2).toULongLong(&ok[2], 16) };
+
+        if (fields.size() != 3 || !ok[0] || !ok[1] || !ok[2])
+            return false;
+
+        m_Entries.append(e);
+    }
+
+    return m_SectorSize > 0;
+}
+
+/** @return the name of the manifest kept next to the given backup file */
+QString BlockDigests::manifestName(const QString& fileName)
+{
+    return fileName + QStringLiteral(".digests");
+}
+
+static const quint64 prime1 = 11400714785074694791ULL;
+static const quint64 prime2 = 14029467366897019727ULL;
+static const quint64 prime3 = 1609587929392839161ULL;
+static const quint64 prime4 = 9650029242287828579ULL;
+static const quint64 prime5 = 2870177450012600261ULL;
+
+static inline quint64 rotl(quint64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline quint64 read64(const uchar* p)
+{
+    quint64 v;
+    memcpy(&v, p, sizeof(v));
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    v = qbswap(v);
+#endif
+    return v;
+}
+
+static inline quint32 read32(const uchar* p)
+{
+    quint32 v;
+    memcpy(&v, p, sizeof(v));
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    v = qbswap(v);
+#endif
+    return v;
+}
+
+static inline quint64 round64(quint64 acc, quint64 input)
+{
+    acc += input * prime2;
+    acc = rotl(acc, 31);
+    return acc * prime1;
+}
+
+static inline quint64 mergeRound(quint64 acc, quint64 val)
+{
+    acc ^= round64(0, val);
+    return acc * prime1 + prime4;
+}
+
+/** Computes the XXH64 digest (seed 0) of a block of data.
+    @param data the data
+    @param size number of bytes of data
+    @return the digest
+*/
+quint64 BlockDigests::digest(const void* data, qint64 size)
+{
+    const uchar* p = static_cast<const uchar*>(data);
+    const uchar* const end = p + size;
+    quint64 h;
+
+    if (size >= 32) {
+        quint64 v1 = prime1 + prime2;
+        quint64 v2 = prime2;
+        quint64 v3 = 0;
+        quint64 v4 = 0 - prime1;
+
+        for (; p + 32 <= end; p += 32) {
+            v1 = round64(v1, read64(p));
+            v2 = round64(v2, read64(p + 8));
+            v3 = round64(v3, read64(p + 16));
+            v4 = round64(v4, read64(p + 24));
+        }
+
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = mergeRound(h, v1);
+        h = mergeRound(h, v2);
+        h = mergeRound(h, v3);
+        h = mergeRound(h, v4);
+    } else
+        h = prime5;
+
+    h += static_cast<quint64>(size);
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= round64(0, read64(p));
+        h = rotl(h, 27) * prime1 + prime4;
+    }
+
+    if (p + 4 <= end) {
+        h ^= static_cast<quint64>(read32(p)) * prime1;
+        h = rotl(h, 23) * prime2 + prime3;
+        p += 4;
+    }
+
+    for (; p < end; p++) {
+        h ^= *p * prime5;
+        h = rotl(h, 11) * prime1;
+    }
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+
+    return h;
+}
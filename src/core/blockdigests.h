@@ -0,0 +1,74 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(BLOCKDIGESTS__H)
+
+#define BLOCKDIGESTS__H
+
+#include <QList>
+#include <QString>
+#include <QtGlobal>
+
+/** Digests of the blocks copied by Job::copyBlocks().
+
+    Each entry holds a 64 bit xxHash (XXH64) of a run of sectors, relative to the first sector of
+    the CopySource. Job::verifyBlocks() reads the runs back from wherever they were copied to and
+    compares the digests.
+
+    The digests can be saved as a manifest next to a backup, so a later restore can be checked
+    against the data that was originally backed up.
+*/
+class BlockDigests
+{
+public:
+    /** The digest of one run of sectors */
+    struct Entry {
+        qint64 offset;      /**< first sector, relative to the first sector of the CopySource */
+        qint64 numSectors;  /**< number of sectors */
+        quint64 digest;     /**< XXH64 of the sectors */
+    };
+
+public:
+    explicit BlockDigests(qint32 sectorSize = 512);
+
+public:
+    void append(const Entry& e) {
+        m_Entries.append(e);
+    }
+    const QList<Entry>& entries() const {
+        return m_Entries;    /**< @return the entries in the order they were appended */
+    }
+    qint32 sectorSize() const {
+        return m_SectorSize;    /**< @return the sector size the digests were computed with */
+    }
+    bool isEmpty() const {
+        return m_Entries.isEmpty();
+    }
+
+    void sort();
+    bool save(const QString& fileName) const;
+    bool load(const QString& fileName);
+
+    static quint64 digest(const void* data, qint64 size);
+    static QString manifestName(const QString& fileName);
+
+private:
+    qint32 m_SectorSize;
+    QList<Entry> m_Entries;
+};
+
+#endif
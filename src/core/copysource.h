@@ -19,6 +19,8 @@
 
 #define COPYSOURCE__H
 
+#include "fs/usedblocksmap.h"
+
 #include <QtGlobal>
 
 class CopyTarget;
@@ -49,7 +51,26 @@ public:
     virtual qint64 firstSector() const = 0;
     virtual qint64 lastSector() const = 0;
 
+    virtual bool setDirectIO(bool b) {
+        Q_UNUSED(b)
+        return false;    /**< @return true if reading bypasses the page cache now; not supported by default */
+    }
+    virtual qint64 optimalIOSize() const {
+        return 0;    /**< @return the preferred size in bytes for a single transfer or 0 if unknown */
+    }
+    virtual qint32 alignment() const {
+        return sectorSize();    /**< @return the alignment in bytes buffers passed to readSectors() should have */
+    }
+
+    const UsedBlocksMap& usedBlocks() const {
+        return m_UsedBlocks;    /**< @return the sectors worth copying; if invalid, all of them are */
+    }
+    void setUsedBlocks(const UsedBlocksMap& usedBlocks) {
+        m_UsedBlocks = usedBlocks;    /**< @param usedBlocks the sectors worth copying, relative to firstSector() */
+    }
+
 private:
+    UsedBlocksMap m_UsedBlocks;
 };
 
 #endif
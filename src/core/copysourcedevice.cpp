@@ -25,6 +25,7 @@
 #include "core/copytarget.h"
 #include "core/copytargetdevice.h"
 #include "core/device.h"
+#include "core/diskdevice.h"
 
 /** Constructs a CopySource on the given Device
     @param d Device from which to copy
@@ -111,3 +112,31 @@ bool CopySourceDevice::overlaps(const CopyTarget& target) const
 
     return false;
 }
+
+/** Bypasses the page cache when reading from the Device.
+    @param b true to bypass the page cache
+    @return true if the backend supports direct I/O and it could be turned on or off
+*/
+bool CopySourceDevice::setDirectIO(bool b)
+{
+    return m_BackendDevice && m_BackendDevice->setDirectIO(b);
+}
+
+/** @return the Device's physical sector size if known, otherwise its logical sector size */
+qint32 CopySourceDevice::alignment() const
+{
+    const DiskDevice* diskDevice = dynamic_cast<const DiskDevice*>(&device());
+
+    if (diskDevice && diskDevice->physicalSectorSize() > sectorSize())
+        return diskDevice->physicalSectorSize();
+
+    return sectorSize();
+}
+
+/** @return the Device's optimal I/O size or 0 if unknown */
+qint64 CopySourceDevice::optimalIOSize() const
+{
+    const DiskDevice* diskDevice = dynamic_cast<const DiskDevice*>(&device());
+
+    return diskDevice ? diskDevice->optimalIOSize() : 0;
+}
@@ -45,6 +45,9 @@ public:
 public:
     bool open() override;
     qint32 sectorSize() const override;
+    bool setDirectIO(bool b) override;
+    qint32 alignment() const override;
+    qint64 optimalIOSize() const override;
     bool readSectors(void* buffer, qint64 readOffset, qint64 numSectors) override;
     qint64 length() const override;
     bool overlaps(const CopyTarget& target) const override;
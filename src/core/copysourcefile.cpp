@@ -18,9 +18,13 @@
 
 #include "core/copysourcefile.h"
 
+#include "util/blockdeviceio.h"
+
 #include <QFile>
 #include <QFileInfo>
 
+#include <sys/stat.h>
+
 /** Constructs a CopySourceFile from the given @p filename.
     @param filename filename of the file to copy from
     @param sectorsize the sector size to assume for the file, usually the target Device's sector size
@@ -28,7 +32,9 @@
 CopySourceFile::CopySourceFile(const QString& filename, qint32 sectorsize) :
     CopySource(),
     m_File(filename),
-    m_SectorSize(sectorsize)
+    m_SectorSize(sectorsize),
+    m_Alignment(sectorsize),
+    m_DirectIO(false)
 {
 }
 
@@ -37,7 +43,28 @@ CopySourceFile::CopySourceFile(const QString& filename, qint32 sectorsize) :
 */
 bool CopySourceFile::open()
 {
-    return file().open(QIODevice::ReadOnly);
+    // unbuffered, so reads go straight into the caller's (aligned) buffer
+    return file().open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+/** Bypasses the page cache when reading from the file.
+    @param b true to bypass the page cache
+    @return true if the file system supports direct I/O and it could be turned on or off
+*/
+bool CopySourceFile::setDirectIO(bool b)
+{
+    if (!file().isOpen() || !BlockDeviceIO::setDirectIOFlag(file().handle(), b))
+        return false;
+
+    // direct I/O on a file must be aligned to the block size of the file system it is on
+    struct stat st;
+    if (b && fstat(file().handle(), &st) == 0 && st.st_blksize > sectorSize())
+        m_Alignment = st.st_blksize;
+    else
+        m_Alignment = sectorSize();
+
+    m_DirectIO = b;
+    return true;
 }
 
 /** Returns the length of the file in sectors.
@@ -56,8 +83,17 @@ qint64 CopySourceFile::length() const
 */
 bool CopySourceFile::readSectors(void* buffer, qint64 readOffset, qint64 numSectors)
 {
-    if (!file().seek(readOffset * sectorSize()))
-        return false;
+    // with direct I/O, the tail of an image is usually not aligned; read that through the page cache
+    const bool unaligned = m_DirectIO && ((readOffset * sectorSize()) % alignment() != 0 || (numSectors * sectorSize()) % alignment() != 0);
+
+    if (unaligned)
+        BlockDeviceIO::setDirectIOFlag(file().handle(), false);
+
+    bool rval = file().seek(readOffset * sectorSize()) &&
+                file().read(static_cast<char*>(buffer), numSectors * sectorSize()) == numSectors * sectorSize();
+
+    if (unaligned)
+        BlockDeviceIO::setDirectIOFlag(file().handle(), true);
 
-    return file().read(static_cast<char*>(buffer), numSectors * sectorSize()) == numSectors * sectorSize();
+    return rval;
 }
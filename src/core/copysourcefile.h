@@ -43,9 +43,14 @@ public:
     bool readSectors(void* buffer, qint64 readOffset, qint64 numSectors) override;
     qint64 length() const override;
 
+    bool setDirectIO(bool b) override;
+
     qint32 sectorSize() const override {
         return m_SectorSize;    /**< @return the file's sector size */
     }
+    qint32 alignment() const override {
+        return m_Alignment;    /**< @return the alignment direct I/O on the file needs */
+    }
     bool overlaps(const CopyTarget&) const override {
         return false;    /**< @return false for file */
     }
@@ -67,6 +72,8 @@ protected:
 protected:
     QFile m_File;
     qint32 m_SectorSize;
+    qint32 m_Alignment;
+    bool m_DirectIO;
 };
 
 #endif
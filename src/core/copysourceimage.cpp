@@ -0,0 +1,181 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/copysourceimage.h"
+
+#include "util/crc32.h"
+
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QThread>
+
+#include <cstring>
+
+/** Decompresses one chunk on the thread pool of a CopySourceImage. */
+class DecompressChunkTask : public QRunnable
+{
+public:
+    DecompressChunkTask(const QByteArray& data, char* out, qint64 size, BackupImage::Compression compression, quint32 crc, QAtomicInt& failures) :
+        m_Data(data),
+        m_Out(out),
+        m_Size(size),
+        m_Compression(compression),
+        m_Crc(crc),
+        m_Failures(failures)
+    {
+    }
+
+    void run() override {
+        if (!BackupImage::decompress(m_Data, m_Out, m_Size, m_Compression) || checksumCrc32(m_Out, m_Size) != m_Crc)
+            m_Failures.ref();
+    }
+
+private:
+    const QByteArray m_Data;
+    char* m_Out;
+    const qint64 m_Size;
+    const BackupImage::Compression m_Compression;
+    const quint32 m_Crc;
+    QAtomicInt& m_Failures;
+};
+
+/** Constructs a CopySourceImage from the given @p filename.
+    @param filename filename of the image to copy from
+    @param sectorsize the sector size of the target Device; the image must have been made with the same
+*/
+CopySourceImage::CopySourceImage(const QString& filename, qint32 sectorsize) :
+    CopySource(),
+    m_File(filename),
+    m_SectorSize(sectorsize),
+    m_CachedChunk(-1)
+{
+    m_Header.version = 0;
+    m_Header.sectorSize = sectorsize;
+    m_Header.chunkSize = 0;
+    m_Header.compression = BackupImage::None;
+    m_Header.sectors = 0;
+    m_Header.fileSystemType = 0;
+    m_Header.sectorsUsed = -1;
+
+    m_Pool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+/** Opens the image and reads its header and index.
+    @return true if this is a complete image with the right sector size
+*/
+bool CopySourceImage::open()
+{
+    if (!file().open(QIODevice::ReadOnly) || !BackupImage::readHeader(file(), m_Header) ||
+            static_cast<qint32>(m_Header.sectorSize) != sectorSize() || !BackupImage::readIndex(file(), m_Header, m_Index))
+        return false;
+
+    UsedBlocksMap usedBlocks(sectorSize());
+
+    for (qint32 i = 0; i < m_Index.size(); i++)
+        if (m_Index[i].type != BackupImage::Unused)
+            usedBlocks.addUsedBytes(static_cast<qint64>(i) * m_Header.chunkSize, m_Header.chunkSize);
+
+    usedBlocks.finish(length());
+    setUsedBlocks(usedBlocks);
+
+    return true;
+}
+
+/** Reads the given number of sectors from the image into the given buffer.
+
+    Chunks completely inside the range are decompressed in parallel straight into the buffer. Chunks
+    only partly inside it are decompressed into a cache, since the next read usually needs the rest.
+
+    @param buffer buffer to store the sectors read in
+    @param readOffset offset where to begin reading
+    @param numSectors number of sectors to read
+    @return true on success
+*/
+bool CopySourceImage::readSectors(void* buffer, qint64 readOffset, qint64 numSectors)
+{
+    if (readOffset < 0 || readOffset + numSectors > length())
+        return false;
+
+    const qint64 chunkSize = m_Header.chunkSize;
+    const qint64 imageSize = length() * sectorSize();
+    const qint64 start = readOffset * sectorSize();
+    const qint64 end = start + numSectors * sectorSize();
+    const BackupImage::Compression compression = static_cast<BackupImage::Compression>(m_Header.compression);
+
+    char* out = static_cast<char*>(buffer);
+    QAtomicInt failures(0);
+
+    // tasks still running write to the buffer and to failures, so never return before they are done
+    const auto fail = [this]() {
+        m_Pool.waitForDone();
+        return false;
+    };
+
+    for (qint64 chunk = start / chunkSize; chunk * chunkSize < end; chunk++) {
+        const BackupImage::IndexEntry& e = m_Index[chunk];
+        const qint64 chunkStart = chunk * chunkSize;
+        const qint64 chunkBytes = qMin(chunkSize, imageSize - chunkStart);
+        const qint64 from = qMax(start, chunkStart);
+        const qint64 to = qMin(end, chunkStart + chunkBytes);
+        char* dest = out + (from - start);
+
+        if (e.type == BackupImage::Unused) {
+            memset(dest, 0, to - from);
+            continue;
+        }
+
+        const bool whole = from == chunkStart && to == chunkStart + chunkBytes;
+
+        if (!whole && chunk == m_CachedChunk) {
+            memcpy(dest, m_Cache.constData() + (from - chunkStart), to - from);
+            continue;
+        }
+
+        if (!file().seek(e.offset))
+            return fail();
+
+        const QByteArray data = file().read(e.size);
+        if (data.size() != static_cast<qint64>(e.size))
+            return fail();
+
+        if (e.type == BackupImage::Stored) {
+            if (data.size() != chunkBytes || checksumCrc32(data.constData(), data.size()) != e.crc)
+                return fail();
+
+            memcpy(dest, data.constData() + (from - chunkStart), to - from);
+            continue;
+        }
+
+        if (whole) {
+            m_Pool.start(new DecompressChunkTask(data, dest, chunkBytes, compression, e.crc, failures));
+            continue;
+        }
+
+        m_Cache.resize(chunkBytes);
+        m_CachedChunk = -1;
+
+        if (!BackupImage::decompress(data, m_Cache.data(), chunkBytes, compression) || checksumCrc32(m_Cache.constData(), chunkBytes) != e.crc)
+            return fail();
+
+        m_CachedChunk = chunk;
+        memcpy(dest, m_Cache.constData() + (from - chunkStart), to - from);
+    }
+
+    m_Pool.waitForDone();
+
+    return failures.load() == 0;
+}
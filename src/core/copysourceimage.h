@@ -0,0 +1,85 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(COPYSOURCEIMAGE__H)
+
+#define COPYSOURCEIMAGE__H
+
+#include "core/backupimage.h"
+#include "core/copysource.h"
+
+#include <QFile>
+#include <QList>
+#include <QThreadPool>
+#include <QtGlobal>
+
+class QString;
+class CopyTarget;
+
+/** A compressed BackupImage to copy from.
+
+    Uses the image's index to find the chunks for each read and decompresses them on a thread
+    pool. Chunks the backed up FileSystem did not use are left out of usedBlocks(), so restoring
+    does not write them.
+
+    @see CopyTargetImage, CopySourceFile
+*/
+class CopySourceImage : public CopySource
+{
+public:
+    CopySourceImage(const QString& filename, qint32 sectorsize);
+
+public:
+    bool open() override;
+    bool readSectors(void* buffer, qint64 readOffset, qint64 numSectors) override;
+
+    qint64 length() const override {
+        return m_Header.sectors;    /**< @return the number of sectors in the image */
+    }
+    qint32 sectorSize() const override {
+        return m_SectorSize;    /**< @return the sector size the image was made with */
+    }
+    bool overlaps(const CopyTarget&) const override {
+        return false;    /**< @return false for an image */
+    }
+    qint64 firstSector() const override {
+        return 0;    /**< @return 0 for an image */
+    }
+    qint64 lastSector() const override {
+        return length() - 1;    /**< @return the last sector in the image */
+    }
+
+    const BackupImage::Header& header() const {
+        return m_Header;    /**< @return the image's header, valid after open() */
+    }
+
+protected:
+    QFile& file() {
+        return m_File;
+    }
+
+protected:
+    QFile m_File;
+    qint32 m_SectorSize;
+    BackupImage::Header m_Header;
+    QList<BackupImage::IndexEntry> m_Index;
+    qint64 m_CachedChunk;
+    QByteArray m_Cache;
+    QThreadPool m_Pool;
+};
+
+#endif
@@ -18,24 +18,145 @@
 
 #include "core/copysourceshred.h"
 
+#include <QFile>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QtEndian>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/random.h>
+
+/** Number of bytes of random data each thread generates at a time */
+static const qint64 chunkSize = 1024 * 1024;
+
+static inline void quarterRound(quint32* x, int a, int b, int c, int d)
+{
+    x[a] += x[b]; x[d] ^= x[a]; x[d] = (x[d] << 16) | (x[d] >> 16);
+    x[c] += x[d]; x[b] ^= x[c]; x[b] = (x[b] << 12) | (x[b] >> 20);
+    x[a] += x[b]; x[d] ^= x[a]; x[d] = (x[d] << 8) | (x[d] >> 24);
+    x[c] += x[d]; x[b] ^= x[c]; x[b] = (x[b] << 7) | (x[b] >> 25);
+}
+
+/** Fills a buffer with the ChaCha20 keystream.
+
+    This is the original ChaCha20 with a 64 bit block counter, so the keystream is long enough
+    for any device. The counter of the first block is the byte offset divided by 64.
+
+    @param key the 256 bit key followed by the 64 bit nonce
+    @param offset the byte offset of the buffer in the keystream; a multiple of 64
+    @param buffer the buffer to fill
+    @param size the size of the buffer; a multiple of 64
+*/
+static void chacha20(const quint32* key, qint64 offset, uchar* buffer, qint64 size)
+{
+    quint32 state[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+        key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+        0, 0, key[8], key[9]
+    };
+
+    for (quint64 block = offset / 64; size > 0; block++, buffer += 64, size -= 64) {
+        state[12] = static_cast<quint32>(block);
+        state[13] = static_cast<quint32>(block >> 32);
+
+        quint32 x[16];
+        memcpy(x, state, sizeof(x));
+
+        for (int round = 0; round < 10; round++) {
+            quarterRound(x, 0, 4, 8, 12);
+            quarterRound(x, 1, 5, 9, 13);
+            quarterRound(x, 2, 6, 10, 14);
+            quarterRound(x, 3, 7, 11, 15);
+            quarterRound(x, 0, 5, 10, 15);
+            quarterRound(x, 1, 6, 11, 12);
+            quarterRound(x, 2, 7, 8, 13);
+            quarterRound(x, 3, 4, 9, 14);
+        }
+
+        for (int i = 0; i < 16; i++)
+            qToLittleEndian<quint32>(x[i] + state[i], buffer + i * 4);
+    }
+}
+
+/** Generates one chunk of random data on a thread pool. */
+class ShredTask : public QRunnable
+{
+public:
+    ShredTask(const quint32* key, qint64 offset, uchar* buffer, qint64 size, QSemaphore& done) :
+        m_Key(key),
+        m_Offset(offset),
+        m_Buffer(buffer),
+        m_Size(size),
+        m_Done(done)
+    {
+    }
+
+    void run() override {
+        chacha20(m_Key, m_Offset, m_Buffer, m_Size);
+        m_Done.release();
+    }
+
+private:
+    const quint32* m_Key;
+    const qint64 m_Offset;
+    uchar* m_Buffer;
+    const qint64 m_Size;
+    QSemaphore& m_Done;
+};
+
 /** Constructs a CopySourceShred with the given @p size
     @param s the size the copy source will (pretend to) have
     @param sectorsize the sectorsize the copy source will (pretend to) have
+    @param randomShred true to overwrite with random data, false to overwrite with zeros
 */
 CopySourceShred::CopySourceShred(qint64 s, qint32 sectorsize, bool randomShred) :
     CopySource(),
     m_Size(s),
     m_SectorSize(sectorsize),
-    m_SourceFile(randomShred ? QStringLiteral("/dev/urandom") : QStringLiteral("/dev/zero"))
+    m_RandomShred(randomShred),
+    m_Key(),
+    m_Pool()
 {
+    m_Pool.setMaxThreadCount(qBound(1, QThread::idealThreadCount(), 8));
 }
 
 /** Opens the shred source.
+
+    For random data this picks the key and nonce for the keystream.
+
     @return true on success
 */
 bool CopySourceShred::open()
 {
-    return sourceFile().open(QIODevice::ReadOnly);
+    if (!randomShred())
+        return true;
+
+    char* seed = reinterpret_cast<char*>(m_Key);
+    qint64 seeded = 0;
+
+    while (seeded < static_cast<qint64>(sizeof(m_Key))) {
+        const ssize_t n = getrandom(seed + seeded, sizeof(m_Key) - seeded, 0);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            break;
+
+        seeded += n;
+    }
+
+    // kernels before 3.17 have no getrandom()
+    if (seeded < static_cast<qint64>(sizeof(m_Key))) {
+        QFile urandom(QStringLiteral("/dev/urandom"));
+
+        if (!urandom.open(QIODevice::ReadOnly) || urandom.read(seed, sizeof(m_Key)) != static_cast<qint64>(sizeof(m_Key)))
+            return false;
+    }
+
+    return true;
 }
 
 /** Returns the length of the source in sectors.
@@ -46,15 +167,37 @@ qint64 CopySourceShred::length() const
     return size() / sectorSize();
 }
 
-/** Reads the given number of sectors from the source into the given buffer.
+/** Fills the given buffer with the given number of sectors of random data or zeros.
     @param buffer buffer to store the sectors read in
-    @param readOffset offset where to begin reading (unused)
+    @param readOffset offset where to begin reading; picks the part of the keystream for random data
     @param numSectors number of sectors to read
     @return true on success
 */
 bool CopySourceShred::readSectors(void* buffer, qint64 readOffset, qint64 numSectors)
 {
-    Q_UNUSED(readOffset);
+    const qint64 size = numSectors * sectorSize();
+
+    if (!randomShred()) {
+        memset(buffer, 0, size);
+        return true;
+    }
+
+    // sectors are at least 512 bytes, so both are multiples of the 64 byte ChaCha20 block
+    const qint64 offset = readOffset * sectorSize();
+    uchar* data = static_cast<uchar*>(buffer);
+
+    if (size <= chunkSize) {
+        chacha20(m_Key, offset, data, size);
+        return true;
+    }
+
+    QSemaphore done(0);
+    qint32 chunks = 0;
+
+    for (qint64 pos = 0; pos < size; pos += chunkSize, chunks++)
+        m_Pool.start(new ShredTask(m_Key, offset + pos, data + pos, qMin(chunkSize, size - pos), done));
+
+    done.acquire(chunks);
 
-    return sourceFile().read(static_cast<char*>(buffer), numSectors * sectorSize()) == numSectors * sectorSize();
+    return true;
 }
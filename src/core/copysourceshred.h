@@ -21,7 +21,7 @@
 
 #include "core/copysource.h"
 
-#include <QFile>
+#include <QThreadPool>
 
 class CopyTarget;
 
@@ -29,6 +29,11 @@ class CopyTarget;
 
     Represents a source of data (random or zeros) to copy from. Used to securely overwrite data on disk.
 
+    Random data is not read from /dev/urandom but generated in-process with ChaCha20, keyed once
+    from getrandom() when the source is opened. The keystream is addressed by the byte offset, so
+    a buffer is split into chunks that are generated on several threads at the same time. Zeros
+    need no source at all; the buffer is simply cleared.
+
     @author Volker Lanz <vl@fidra.de>
 */
 class CopySourceShred : public CopySource
@@ -54,21 +59,21 @@ public:
         return length();    /**< @return equal to length for shred source. @see length() */
     }
 
-protected:
-    QFile& sourceFile() {
-        return m_SourceFile;
-    }
-    const QFile& sourceFile() const {
-        return m_SourceFile;
+    bool randomShred() const {
+        return m_RandomShred;    /**< @return true if the source is random data, false if zeros */
     }
-    qint32 size() const {
+
+protected:
+    qint64 size() const {
         return m_Size;
     }
 
 private:
     qint64 m_Size;
     qint32 m_SectorSize;
-    QFile m_SourceFile;
+    bool m_RandomShred;
+    quint32 m_Key[10];
+    QThreadPool m_Pool;
 };
 
 #endif
@@ -45,6 +45,28 @@ public:
     virtual qint64 firstSector() const = 0;
     virtual qint64 lastSector() const = 0;
 
+    virtual bool setDirectIO(bool b) {
+        Q_UNUSED(b)
+        return false;    /**< @return true if writing bypasses the page cache now; not supported by default */
+    }
+    virtual qint64 optimalIOSize() const {
+        return 0;    /**< @return the preferred size in bytes for a single transfer or 0 if unknown */
+    }
+    virtual qint32 alignment() const {
+        return sectorSize();    /**< @return the alignment in bytes buffers passed to writeSectors() should have */
+    }
+
+    /** Skips sectors that do not need to be written because the source does not use them.
+        @param writeOffset where to skip sectors
+        @param numSectors the number of sectors to skip
+        @return true on success
+    */
+    virtual bool skipSectors(qint64 writeOffset, qint64 numSectors) {
+        Q_UNUSED(writeOffset)
+        setSectorsWritten(sectorsWritten() + numSectors);
+        return true;
+    }
+
     qint64 sectorsWritten() const {
         return m_SectorsWritten;
     }
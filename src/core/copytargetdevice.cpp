@@ -22,6 +22,7 @@
 #include "backend/corebackenddevice.h"
 
 #include "core/device.h"
+#include "core/diskdevice.h"
 
 
 /** Constructs a device to copy to.
@@ -78,3 +79,47 @@ bool CopyTargetDevice::writeSectors(void* buffer, qint64 writeOffset, qint64 num
 
     return rval;
 }
+
+/** Zeroes sectors on the Device without writing a buffer of zeros.
+    @param writeOffset the first sector to zero
+    @param numSectors the number of sectors to zero
+    @return true if the backend and the Device support it and zeroing succeeded
+*/
+bool CopyTargetDevice::zeroSectors(qint64 writeOffset, qint64 numSectors)
+{
+    Q_ASSERT(writeOffset >= 0);
+    bool rval = m_BackendDevice && m_BackendDevice->zeroSectors(writeOffset, numSectors);
+
+    if (rval)
+        setSectorsWritten(sectorsWritten() + numSectors);
+
+    return rval;
+}
+
+/** Bypasses the page cache when writing to the Device.
+    @param b true to bypass the page cache
+    @return true if the backend supports direct I/O and it could be turned on or off
+*/
+bool CopyTargetDevice::setDirectIO(bool b)
+{
+    return m_BackendDevice && m_BackendDevice->setDirectIO(b);
+}
+
+/** @return the Device's physical sector size if known, otherwise its logical sector size */
+qint32 CopyTargetDevice::alignment() const
+{
+    const DiskDevice* diskDevice = dynamic_cast<const DiskDevice*>(&device());
+
+    if (diskDevice && diskDevice->physicalSectorSize() > sectorSize())
+        return diskDevice->physicalSectorSize();
+
+    return sectorSize();
+}
+
+/** @return the Device's optimal I/O size or 0 if unknown */
+qint64 CopyTargetDevice::optimalIOSize() const
+{
+    const DiskDevice* diskDevice = dynamic_cast<const DiskDevice*>(&device());
+
+    return diskDevice ? diskDevice->optimalIOSize() : 0;
+}
@@ -47,7 +47,11 @@ public:
 public:
     bool open() override;
     qint32 sectorSize() const override;
+    bool setDirectIO(bool b) override;
+    qint32 alignment() const override;
+    qint64 optimalIOSize() const override;
     bool writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors) override;
+    bool zeroSectors(qint64 writeOffset, qint64 numSectors);
     qint64 firstSector() const override {
         return m_FirstSector;    /**< @return the first sector to write to */
     }
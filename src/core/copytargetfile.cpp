@@ -17,6 +17,11 @@
 
 #include "core/copytargetfile.h"
 
+#include "util/blockdeviceio.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
 /** Constructs a file to write to.
     @param filename name of the file to write to
     @param sectorsize the "sector size" of the file to write to, usually the sector size of the CopySourceDevice
@@ -24,7 +29,9 @@
 CopyTargetFile::CopyTargetFile(const QString& filename, qint32 sectorsize) :
     CopyTarget(),
     m_File(filename),
-    m_SectorSize(sectorsize)
+    m_SectorSize(sectorsize),
+    m_Alignment(sectorsize),
+    m_DirectIO(false)
 {
 }
 
@@ -33,7 +40,28 @@ CopyTargetFile::CopyTargetFile(const QString& filename, qint32 sectorsize) :
 */
 bool CopyTargetFile::open()
 {
-    return file().open(QIODevice::WriteOnly | QIODevice::Truncate);
+    // unbuffered, so writes go straight from the caller's (aligned) buffer
+    return file().open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered);
+}
+
+/** Bypasses the page cache when writing to the file.
+    @param b true to bypass the page cache
+    @return true if the file system supports direct I/O and it could be turned on or off
+*/
+bool CopyTargetFile::setDirectIO(bool b)
+{
+    if (!file().isOpen() || !BlockDeviceIO::setDirectIOFlag(file().handle(), b))
+        return false;
+
+    // direct I/O on a file must be aligned to the block size of the file system it is on
+    struct stat st;
+    if (b && fstat(file().handle(), &st) == 0 && st.st_blksize > sectorSize())
+        m_Alignment = st.st_blksize;
+    else
+        m_Alignment = sectorSize();
+
+    m_DirectIO = b;
+    return true;
 }
 
 /** Writes the given number of sectors from the given buffer to the file.
@@ -44,13 +72,44 @@ bool CopyTargetFile::open()
 */
 bool CopyTargetFile::writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors)
 {
-    if (!file().seek(writeOffset * sectorSize()))
-        return false;
+    // with direct I/O, the tail of an image is usually not aligned; write that through the page cache
+    const bool unaligned = m_DirectIO && ((writeOffset * sectorSize()) % alignment() != 0 || (numSectors * sectorSize()) % alignment() != 0);
+
+    if (unaligned)
+        BlockDeviceIO::setDirectIOFlag(file().handle(), false);
+
+    bool rval = file().seek(writeOffset * sectorSize()) &&
+                file().write(static_cast<char*>(buffer), numSectors * sectorSize()) == numSectors * sectorSize();
 
-    bool rval = file().write(static_cast<char*>(buffer), numSectors * sectorSize()) == numSectors * sectorSize();
+    if (unaligned) {
+        // flush it, so the tail does not linger in the page cache we are trying not to fill
+        if (rval)
+            rval = fdatasync(file().handle()) == 0;
+
+        BlockDeviceIO::setDirectIOFlag(file().handle(), true);
+    }
 
     if (rval)
         setSectorsWritten(sectorsWritten() + numSectors);
 
     return rval;
 }
+
+/** Leaves a hole in the file instead of writing sectors.
+
+    The file was truncated when opened, so skipped sectors read back as zeros and take up no space
+    on file systems supporting sparse files. Only the file size needs to cover them.
+
+    @param writeOffset where in the file to skip sectors
+    @param numSectors the number of sectors to skip
+    @return true on success
+*/
+bool CopyTargetFile::skipSectors(qint64 writeOffset, qint64 numSectors)
+{
+    const qint64 end = (writeOffset + numSectors) * sectorSize();
+
+    if (file().size() < end && !file().resize(end))
+        return false;
+
+    return CopyTarget::skipSectors(writeOffset, numSectors);
+}
@@ -41,10 +41,16 @@ public:
 public:
     bool open() override;
     bool writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors) override;
+    bool skipSectors(qint64 writeOffset, qint64 numSectors) override;
+
+    bool setDirectIO(bool b) override;
 
     qint32 sectorSize() const override {
         return m_SectorSize;    /**< @return the file's sector size */
     }
+    qint32 alignment() const override {
+        return m_Alignment;    /**< @return the alignment direct I/O on the file needs */
+    }
     qint64 firstSector() const override {
         return 0;    /**< @return always 0 for a file */
     }
@@ -63,6 +69,8 @@ protected:
 protected:
     QFile m_File;
     qint32 m_SectorSize;
+    qint32 m_Alignment;
+    bool m_DirectIO;
 };
 
 #endif
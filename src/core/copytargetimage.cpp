@@ -0,0 +1,257 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/copytargetimage.h"
+
+#include "fs/filesystem.h"
+
+#include "util/crc32.h"
+
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+
+#include <cstring>
+
+#include <unistd.h>
+
+/** Compresses one chunk on the thread pool of a CopyTargetImage. */
+class CompressChunkTask : public QRunnable
+{
+public:
+    CompressChunkTask(const QByteArray& chunk, bool used, BackupImage::Compression compression) :
+        m_Chunk(chunk),
+        m_Used(used),
+        m_Compression(compression),
+        m_Crc(0)
+    {
+        setAutoDelete(false);
+    }
+
+    void run() override {
+        if (m_Used) {
+            m_Compressed = BackupImage::compress(m_Chunk.constData(), m_Chunk.size(), m_Compression);
+            m_Crc = checksumCrc32(m_Chunk.constData(), m_Chunk.size());
+        }
+
+        m_Done.release();
+    }
+
+    void wait() {
+        m_Done.acquire();
+    }
+
+    const QByteArray& chunk() const {
+        return m_Chunk;
+    }
+    const QByteArray& compressed() const {
+        return m_Compressed;    /**< @return the compressed chunk or an empty QByteArray if it is stored as it is */
+    }
+    bool used() const {
+        return m_Used;
+    }
+    quint32 crc() const {
+        return m_Crc;    /**< @return the CRC-32 of the uncompressed chunk */
+    }
+
+private:
+    const QByteArray m_Chunk;
+    const bool m_Used;
+    const BackupImage::Compression m_Compression;
+    QByteArray m_Compressed;
+    quint32 m_Crc;
+    QSemaphore m_Done;
+};
+
+/** Constructs an image to write to.
+    @param filename name of the image file to write to
+    @param sectorsize the sector size of the CopySourceDevice
+*/
+CopyTargetImage::CopyTargetImage(const QString& filename, qint32 sectorsize) :
+    CopyTarget(),
+    m_File(filename),
+    m_SectorSize(sectorsize),
+    m_ChunkFill(0),
+    m_ChunkUsed(false),
+    m_Failed(false)
+{
+    m_Header.version = BackupImage::version;
+    m_Header.sectorSize = sectorsize;
+    m_Header.chunkSize = qMax(BackupImage::defaultChunkSize / sectorsize, 1U) * sectorsize;
+    m_Header.compression = BackupImage::defaultCompression();
+    m_Header.sectors = 0;
+    m_Header.fileSystemType = FileSystem::Unknown;
+    m_Header.sectorsUsed = -1;
+
+    m_Pool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+/** Records the FileSystem being backed up in the image's header.
+    @param fs the FileSystem
+*/
+void CopyTargetImage::setFileSystem(const FileSystem& fs)
+{
+    m_Header.fileSystemType = fs.type();
+    m_Header.sectorsUsed = fs.sectorsUsed();
+    m_Header.label = fs.label();
+    m_Header.uuid = fs.uuid();
+}
+
+CopyTargetImage::~CopyTargetImage()
+{
+    m_Pool.waitForDone();
+    qDeleteAll(m_Pending);
+}
+
+/** Creates the image file and reserves room for the header.
+    @return true on success
+*/
+bool CopyTargetImage::open()
+{
+    if (!file().open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    m_Chunk = QByteArray(m_Header.chunkSize, '\0');
+
+    return BackupImage::writeHeader(file(), m_Header);
+}
+
+/** Collects sectors to be compressed and written to the image.
+    @param buffer the data to write
+    @param writeOffset where in the image the sectors go; must not be before what was written so far
+    @param numSectors the number of sectors to write
+    @return true on success
+*/
+bool CopyTargetImage::writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors)
+{
+    return append(static_cast<const char*>(buffer), writeOffset, numSectors);
+}
+
+/** Skips sectors the source does not use. Chunks with no used sectors at all are not stored.
+    @param writeOffset where in the image to skip sectors
+    @param numSectors the number of sectors to skip
+    @return true on success
+*/
+bool CopyTargetImage::skipSectors(qint64 writeOffset, qint64 numSectors)
+{
+    return append(nullptr, writeOffset, numSectors);
+}
+
+/** Appends sectors to the current chunk, handing full chunks to the thread pool.
+    @param data the sectors or nullptr for unused sectors
+    @param writeOffset where in the image the sectors go
+    @param numSectors the number of sectors
+    @return true on success
+*/
+bool CopyTargetImage::append(const char* data, qint64 writeOffset, qint64 numSectors)
+{
+    // images are written as a stream, so gaps are fine but going back is not
+    if (m_Failed || writeOffset < m_Header.sectors)
+        return false;
+
+    if (writeOffset > m_Header.sectors && !append(nullptr, m_Header.sectors, writeOffset - m_Header.sectors))
+        return false;
+
+    qint64 bytes = numSectors * sectorSize();
+
+    while (bytes > 0) {
+        const qint64 n = qMin(bytes, m_Chunk.size() - m_ChunkFill);
+
+        if (data) {
+            memcpy(m_Chunk.data() + m_ChunkFill, data, n);
+            data += n;
+            m_ChunkUsed = true;
+        } else
+            memset(m_Chunk.data() + m_ChunkFill, 0, n);
+
+        m_ChunkFill += n;
+        bytes -= n;
+
+        if (m_ChunkFill == m_Chunk.size() && !finishChunk())
+            return false;
+    }
+
+    m_Header.sectors += numSectors;
+    setSectorsWritten(sectorsWritten() + numSectors);
+
+    return true;
+}
+
+/** Hands the current chunk to the thread pool and writes out those already compressed.
+    @return true on success
+*/
+bool CopyTargetImage::finishChunk()
+{
+    CompressChunkTask* task = new CompressChunkTask(m_Chunk.left(m_ChunkFill), m_ChunkUsed, static_cast<BackupImage::Compression>(m_Header.compression));
+
+    m_Pending.append(task);
+    m_Pool.start(task);
+
+    m_ChunkFill = 0;
+    m_ChunkUsed = false;
+
+    // keep every thread busy, but do not pile up compressed chunks in memory
+    return writeChunks(2 * m_Pool.maxThreadCount());
+}
+
+/** Writes compressed chunks to the image in order.
+    @param maxPending the number of chunks that may be left pending
+    @return true on success
+*/
+bool CopyTargetImage::writeChunks(qint32 maxPending)
+{
+    while (m_Pending.size() > maxPending) {
+        CompressChunkTask* task = m_Pending.takeFirst();
+        task->wait();
+
+        BackupImage::IndexEntry e = { 0, 0, BackupImage::Unused, 0 };
+
+        if (task->used()) {
+            const QByteArray& data = task->compressed().isEmpty() ? task->chunk() : task->compressed();
+
+            e.offset = file().pos();
+            e.size = data.size();
+            e.type = task->compressed().isEmpty() ? BackupImage::Stored : BackupImage::Compressed;
+            e.crc = task->crc();
+
+            if (file().write(data) != data.size())
+                m_Failed = true;
+        }
+
+        m_Index.append(e);
+        delete task;
+
+        if (m_Failed)
+            return false;
+    }
+
+    return true;
+}
+
+/** Writes the last chunk, the index and the final header.
+    @return true on success
+*/
+bool CopyTargetImage::close()
+{
+    if (m_ChunkFill > 0 && !finishChunk())
+        return false;
+
+    if (!writeChunks(0) || !BackupImage::writeIndex(file(), m_Index) || !BackupImage::writeHeader(file(), m_Header))
+        return false;
+
+    return file().flush() && fdatasync(file().handle()) == 0;
+}
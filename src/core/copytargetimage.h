@@ -0,0 +1,87 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(COPYTARGETIMAGE__H)
+
+#define COPYTARGETIMAGE__H
+
+#include "core/backupimage.h"
+#include "core/copytarget.h"
+
+#include <QFile>
+#include <QList>
+#include <QThreadPool>
+#include <QtGlobal>
+
+class QString;
+class CompressChunkTask;
+class FileSystem;
+
+/** A compressed BackupImage to copy to.
+
+    Sectors must be written front to back. They are collected into chunks, which are compressed on
+    a thread pool and appended to the image in order. close() writes the index and the header.
+
+    @see CopySourceImage, CopyTargetFile
+*/
+class CopyTargetImage : public CopyTarget
+{
+public:
+    CopyTargetImage(const QString& filename, qint32 sectorsize);
+    ~CopyTargetImage() override;
+
+public:
+    bool open() override;
+    bool writeSectors(void* buffer, qint64 writeOffset, qint64 numSectors) override;
+    bool skipSectors(qint64 writeOffset, qint64 numSectors) override;
+    bool close();
+
+    void setFileSystem(const FileSystem& fs);
+
+    qint32 sectorSize() const override {
+        return m_SectorSize;    /**< @return the image's sector size */
+    }
+    qint64 firstSector() const override {
+        return 0;    /**< @return always 0 for an image */
+    }
+    qint64 lastSector() const override {
+        return sectorsWritten();    /**< @return the number of sectors written so far */
+    }
+
+protected:
+    bool append(const char* data, qint64 writeOffset, qint64 numSectors);
+    bool finishChunk();
+    bool writeChunks(qint32 maxPending);
+
+    QFile& file() {
+        return m_File;
+    }
+
+protected:
+    QFile m_File;
+    qint32 m_SectorSize;
+    BackupImage::Header m_Header;
+    QByteArray m_Chunk;
+    qint64 m_ChunkFill;
+    bool m_ChunkUsed;
+    QList<CompressChunkTask*> m_Pending;
+    QList<BackupImage::IndexEntry> m_Index;
+    QThreadPool m_Pool;
+    bool m_Failed;
+};
+
+#endif
@@ -18,6 +18,7 @@
 
 #include "core/device.h"
 #include "core/partitiontable.h"
+#include "core/smartcollector.h"
 #include "core/smartstatus.h"
 
 #include "util/capacity.h"
@@ -82,6 +83,18 @@ bool Device::operator!=(const Device& other) const
     return !(other == *this);
 }
 
+/** Takes over the SMART status SmartCollector last collected for this Device.
+
+    The status is collected in the background and smartStatus() is not valid until that has
+    finished for this Device. DeviceScanner calls this when SmartCollector::smartStatusReady()
+    is emitted. A new collection is requested if the last one is too old.
+*/
+void Device::refreshSmartStatus()
+{
+    if (m_SmartStatus)
+        SmartCollector::self()->status(deviceNode(), *m_SmartStatus);
+}
+
 QString Device::prettyName() const
 {
     return xi18nc("@item:inlistbox Device name – Capacity (device node)", "%1 – %2 (%3)", name(), Capacity::formatByteSize(capacity()), deviceNode());
@@ -97,12 +97,12 @@ public:
     }
 
     virtual SmartStatus& smartStatus() {
-        return *m_SmartStatus;
+        return *m_SmartStatus;    /**< @return the SMART status last taken over with refreshSmartStatus() */
     }
-
     virtual const SmartStatus& smartStatus() const {
-        return *m_SmartStatus;
+        return *m_SmartStatus;    /**< @return the SMART status last taken over with refreshSmartStatus() */
     }
+    void refreshSmartStatus();
 
     virtual void setPartitionTable(PartitionTable* ptable) {
         m_PartitionTable = ptable;
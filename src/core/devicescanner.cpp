@@ -21,25 +21,61 @@
 #include "backend/corebackend.h"
 #include "backend/corebackendmanager.h"
 
+#include "core/blockdeviceinfo.h"
 #include "core/operationstack.h"
 #include "core/device.h"
 #include "core/lvmdevice.h"
+#include "core/lvminventory.h"
+#include "core/mounttable.h"
+#include "core/partition.h"
+#include "core/partitiontable.h"
+#include "core/scancache.h"
+#include "core/smartcollector.h"
+#include "core/ueventmonitor.h"
 #include "core/diskdevice.h"
 
+#include "fs/filesystem.h"
 #include "fs/lvm2_pv.h"
 
+#include "util/blkidprobe.h"
 #include "util/externalcommand.h"
+#include "util/globallog.h"
 
+#include <KLocalizedString>
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
 #include <QRegularExpression>
+#include <QTimer>
+#include <QWriteLocker>
 
 /** Constructs a DeviceScanner
     @param ostack the OperationStack where the devices will be created
 */
 DeviceScanner::DeviceScanner(QObject* parent, OperationStack& ostack) :
     QThread(parent),
-    m_OperationStack(ostack)
+    m_OperationStack(ostack),
+    m_UEventMonitor(nullptr),
+    m_RescanTimer(nullptr),
+    m_Prefetch(true),
+    m_Rescanning(false),
+    m_RescanApplyPending(false),
+    m_RescanRequests(),
+    m_RescannedDevices(),
+    m_RescannedVolumeGroups(),
+    m_SignatureMutex(),
+    m_Signatures()
 {
     setupConnections();
+
+    // the DeviceScanner object lives in the thread that created it, so this is queued to there
+    connect(this, &DeviceScanner::rescanned, this, &DeviceScanner::onRescanned, Qt::QueuedConnection);
+
+    // SMART status is collected on worker threads and taken over by the Devices in this thread
+    connect(SmartCollector::self(), &SmartCollector::smartStatusReady, this, &DeviceScanner::onSmartStatusReady, Qt::QueuedConnection);
 }
 
 void DeviceScanner::setupConnections()
@@ -55,6 +91,13 @@ void DeviceScanner::clear()
 
 void DeviceScanner::run()
 {
+    if (m_Rescanning) {
+        m_Rescanning = false;
+        collectRescan(m_RescanRequests, m_RescannedDevices, m_RescannedVolumeGroups);
+        emit rescanned();
+        return;
+    }
+
     scan();
 }
 
@@ -64,15 +107,50 @@ void DeviceScanner::scan()
 
     clear();
 
+    // probe each device node only once for all partitions and logical volumes
+    BlkidProbe::Scan blkidScan;
+    // and run lvm once for all volume groups, logical and physical volumes
+    LvmInventory::Scan lvmScan;
+    // and read the mount table once for all of them
+    MountTable::Scan mountScan;
+
     const QList<Device*> deviceList = CoreBackendManager::self()->backend()->scanDevices();
-    const QList<LvmDevice*> lvmList = LvmDevice::scanSystemLVM();
-    LVM::pvList = FS::lvm2_pv::getPVs(deviceList);
 
-    for (const auto &d : deviceList)
+    for (const auto &d : deviceList) {
         operationStack().addDevice(d);
 
+        // SMART status is collected in the background, scanning does not wait for it
+        if (d->type() == Device::Disk_Device) {
+            d->refreshSmartStatus();
+            rememberSignature(d->deviceNode());
+        }
+    }
+
     operationStack().sortDevices();
 
+    scanVolumeGroups(deviceList);
+
+    ScanCache::self()->save();
+
+    prefetchAttributes(operationStack().previewDevices());
+}
+
+/** Scans the LVM volume groups and adds them after the given disks.
+    @param deviceList the disks to look for physical volumes on
+*/
+void DeviceScanner::scanVolumeGroups(const QList<Device*>& deviceList)
+{
+    addVolumeGroups(deviceList, LvmDevice::scanSystemLVM());
+}
+
+/** Adds volume groups that have already been scanned after the given disks.
+    @param deviceList the disks to look for physical volumes on
+    @param lvmList the volume groups
+*/
+void DeviceScanner::addVolumeGroups(const QList<Device*>& deviceList, const QList<LvmDevice*>& lvmList)
+{
+    LVM::pvList = FS::lvm2_pv::getPVs(deviceList);
+
     for (const auto &d : lvmList) {
         operationStack().addDevice(d);
         LVM::pvList.append(FS::lvm2_pv::getPVinNode(d->partitionTable()));
@@ -85,3 +163,334 @@ void DeviceScanner::scan()
                 d->physicalVolumes().append(p.partition());
 }
 
+/** Starts reading the attributes scanning left to be read later in the background.
+
+    Used capacity, labels and UUIDs that need tools to be read are only read when first asked
+    for (see FileSystem::setLazy()). For a user interface that shows all of them anyway, it is
+    better to start reading them right after scanning. Nothing is done if prefetch() is false or
+    there are operations waiting to be applied, since those may change the file systems while the
+    tools read them.
+
+    @param deviceList the Devices to read the attributes of the partitions on
+*/
+void DeviceScanner::prefetchAttributes(const QList<Device*>& deviceList)
+{
+    if (!prefetch() || operationStack().size() > 0)
+        return;
+
+    for (const auto &d : deviceList) {
+        if (d->partitionTable() == nullptr)
+            continue;
+
+        for (const auto &p : d->partitionTable()->children()) {
+            p->fileSystem().prefetch();
+
+            for (const auto &child : p->children())
+                child->fileSystem().prefetch();
+        }
+    }
+}
+
+/** @return what the kernel and the start of a disk say about its partitions, to tell whether the
+    disk really changed, or an empty QByteArray if the disk is gone
+*/
+static QByteArray diskSignature(const QString& deviceNode)
+{
+    BlockDeviceInfo info;
+
+    if (!BlockDeviceInfo::read(deviceNode, info))
+        return QByteArray();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QByteArray::number(info.size));
+
+    const QString sysfs = QStringLiteral("/sys/class/block/") + info.name + QLatin1Char('/');
+    const QStringList partitions = QDir(sysfs).entryList({ info.name + QLatin1Char('*') }, QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+
+    for (const QString& partition : partitions) {
+        for (const QString& attribute : { QStringLiteral("/start"), QStringLiteral("/size") }) {
+            QFile f(sysfs + partition + attribute);
+            if (f.open(QIODevice::ReadOnly)) {
+                hash.addData(partition.toUtf8());
+                hash.addData(f.readAll());
+            }
+        }
+    }
+
+    // opened read only, so closing it again does not make udev report a change
+    QFile disk(deviceNode);
+    if (disk.open(QIODevice::ReadOnly))
+        hash.addData(disk.read(34 * static_cast<qint64>(info.logicalBlockSize)));
+
+    return hash.result();
+}
+
+/** Remembers what a disk looked like right after it was scanned.
+    @param deviceNode the disk
+*/
+void DeviceScanner::rememberSignature(const QString& deviceNode)
+{
+    const QByteArray signature = diskSignature(deviceNode);
+
+    QMutexLocker locker(&m_SignatureMutex);
+    m_Signatures.insert(deviceNode, signature);
+}
+
+/** Starts rescanning devices incrementally as the kernel reports changes to them.
+
+    Instead of scanning all devices again, only the disks the kernel sends a uevent for are
+    scanned again and replaced in the OperationStack, followed by the volume groups. Events are
+    collected for a short moment first, so a new partition table with many partitions on it
+    causes one rescan of the disk, not one per partition.
+
+    The disks are scanned on the DeviceScanner's worker thread. The new Devices then replace the
+    old ones in the OperationStack in the thread the DeviceScanner lives in, so the old ones are
+    deleted where the user interface uses them, right before devicesChanged() is emitted.
+
+    libparted opens a disk for writing to scan it, and udev makes the kernel report a "change" of
+    the disk when it is closed again. Such a change of a whole disk therefore only causes a rescan
+    if the kernel's view of its partitions or the start of the disk differ from what they were
+    after the disk was last scanned; otherwise every rescan would cause the next one.
+
+    @return true if listening to uevents could be started
+*/
+bool DeviceScanner::startMonitoring()
+{
+    if (m_UEventMonitor == nullptr) {
+        m_UEventMonitor = new UEventMonitor(this);
+        connect(m_UEventMonitor, &UEventMonitor::blockDeviceEvent, this, &DeviceScanner::onBlockDeviceEvent);
+
+        m_RescanTimer = new QTimer(this);
+        m_RescanTimer->setSingleShot(true);
+        m_RescanTimer->setInterval(250);
+        connect(m_RescanTimer, &QTimer::timeout, this, &DeviceScanner::onRescanTimeout);
+    }
+
+    return m_UEventMonitor->start();
+}
+
+/** Stops rescanning devices incrementally. */
+void DeviceScanner::stopMonitoring()
+{
+    if (m_UEventMonitor)
+        m_UEventMonitor->stop();
+
+    m_PendingRescans.clear();
+}
+
+/** Finds the disk a uevent is about.
+
+    A partition changing means the partition table of its disk has to be read again, so for a
+    partition this is the disk it is on.
+
+    @param event the uevent
+    @return the kernel name of the disk, e.g. "sda", or an empty string if scanning does not look at it
+*/
+QString DeviceScanner::diskForEvent(const UEvent& event)
+{
+    QString diskName;
+
+    if (event.devType() == QStringLiteral("disk"))
+        diskName = event.devName().isEmpty() ? event.devPath.section(QLatin1Char('/'), -1) : event.devName();
+    else if (event.devType() == QStringLiteral("partition"))
+        diskName = event.devPath.section(QLatin1Char('/'), -2, -2);
+
+    // devices scanDevices() does not look at either
+    static const QRegularExpression ignored(QStringLiteral("^(ram|zram|sr|fd|dm-|md|nbd)"));
+
+    if (diskName.isEmpty() || ignored.match(diskName).hasMatch())
+        return QString();
+
+    if (diskName.startsWith(QStringLiteral("loop")) && !BlockDeviceInfo::policy().includeLoop)
+        return QString();
+
+    return diskName;
+}
+
+void DeviceScanner::onBlockDeviceEvent(const UEvent& event)
+{
+    const QString diskName = diskForEvent(event);
+
+    if (diskName.isEmpty())
+        return;
+
+    const QString deviceNode = QStringLiteral("/dev/") + diskName;
+
+    // true if the disk is only to be scanned if it really changed, see startMonitoring()
+    const bool onlyIfChanged = event.action == QStringLiteral("change") && event.devType() == QStringLiteral("disk");
+
+    m_PendingRescans.insert(deviceNode, m_PendingRescans.value(deviceNode, true) && onlyIfChanged);
+
+    m_RescanTimer->start();
+}
+
+void DeviceScanner::onRescanTimeout()
+{
+    if (m_PendingRescans.isEmpty())
+        return;
+
+    // try again once the scan running or the rescan waiting to be applied is done
+    if (isRunning() || m_RescanApplyPending) {
+        m_RescanTimer->start();
+        return;
+    }
+
+    if (operationStack().size() > 0) {
+        Log(Log::warning) << xi18nc("@info:status", "Not rescanning changed devices while there are pending operations.");
+        m_PendingRescans.clear();
+        return;
+    }
+
+    m_RescanRequests = m_PendingRescans;
+    m_PendingRescans.clear();
+
+    m_Rescanning = true;
+    m_RescanApplyPending = true;
+    start();
+}
+
+void DeviceScanner::onRescanned()
+{
+    const QList<RescannedDevice> devices = m_RescannedDevices;
+    const QList<LvmDevice*> volumeGroups = m_RescannedVolumeGroups;
+
+    m_RescannedDevices.clear();
+    m_RescannedVolumeGroups.clear();
+    m_RescanApplyPending = false;
+
+    applyRescan(devices, volumeGroups);
+
+    if (!m_PendingRescans.isEmpty())
+        m_RescanTimer->start();
+}
+
+/** Hands SMART status that has just been collected to the Device it was collected for.
+    @param devicePath the device the status was collected for
+*/
+void DeviceScanner::onSmartStatusReady(const QString& devicePath)
+{
+    // the Device's SmartStatus is overwritten, so nobody else may be reading it
+    QWriteLocker lockDevices(&operationStack().lock());
+
+    for (Device* d : operationStack().previewDevices())
+        if (d->deviceNode() == devicePath)
+            d->refreshSmartStatus();
+}
+
+/** Scans only the given disks again and replaces them in the OperationStack.
+
+    Disks that are gone are removed. The volume groups are scanned again afterwards, because they
+    refer to physical volumes on the disks. Nothing is done while there are pending operations,
+    since those refer to the Devices that would be replaced.
+
+    @param deviceNodes the disks to scan again, e.g. "/dev/sdb"
+*/
+void DeviceScanner::rescan(const QStringList& deviceNodes)
+{
+    if (operationStack().size() > 0) {
+        Log(Log::warning) << xi18nc("@info:status", "Not rescanning changed devices while there are pending operations.");
+        return;
+    }
+
+    QHash<QString, bool> requests;
+    for (const auto &deviceNode : deviceNodes)
+        requests.insert(deviceNode, false);
+
+    QList<RescannedDevice> devices;
+    QList<LvmDevice*> volumeGroups;
+
+    collectRescan(requests, devices, volumeGroups);
+    applyRescan(devices, volumeGroups);
+}
+
+/** Scans disks and all volume groups again, without touching the OperationStack.
+    @param requests the disks to scan, each with true if it is only to be scanned if it really changed
+    @param devices set to the scanned disks
+    @param volumeGroups set to the scanned volume groups
+*/
+void DeviceScanner::collectRescan(const QHash<QString, bool>& requests, QList<RescannedDevice>& devices, QList<LvmDevice*>& volumeGroups)
+{
+    BlkidProbe::Scan blkidScan;
+    LvmInventory::Scan lvmScan;
+    MountTable::Scan mountScan;
+
+    for (auto it = requests.constBegin(); it != requests.constEnd(); ++it) {
+        const QString& deviceNode = it.key();
+
+        if (it.value()) {
+            const QByteArray signature = diskSignature(deviceNode);
+
+            QMutexLocker locker(&m_SignatureMutex);
+            if (!signature.isEmpty() && m_Signatures.value(deviceNode) == signature)
+                continue;
+        }
+
+        emit progress(deviceNode, 0);
+
+        Device* d = nullptr;
+
+        // the kernel said the disk changed, so what the cache has about it cannot be trusted
+        ScanCache::self()->invalidate(deviceNode);
+
+        if (QFileInfo::exists(QStringLiteral("/sys/block/") + QString(deviceNode).remove(QStringLiteral("/dev/"))))
+            d = CoreBackendManager::self()->backend()->scanDevice(deviceNode);
+
+        if (d)
+            rememberSignature(deviceNode);
+
+        devices.append({ deviceNode, d });
+    }
+
+    // only scan the volume groups again if a disk was
+    if (!devices.isEmpty())
+        volumeGroups = LvmDevice::scanSystemLVM();
+}
+
+/** Replaces the rescanned disks and all volume groups in the OperationStack.
+    @param devices the scanned disks
+    @param volumeGroups the scanned volume groups
+*/
+void DeviceScanner::applyRescan(const QList<RescannedDevice>& devices, const QList<LvmDevice*>& volumeGroups)
+{
+    if (devices.isEmpty())
+        return;
+
+    // operations may have been added while the disks were being scanned
+    if (operationStack().size() > 0) {
+        Log(Log::warning) << xi18nc("@info:status", "Not rescanning changed devices while there are pending operations.");
+
+        for (const auto &r : devices)
+            delete r.device;
+        qDeleteAll(volumeGroups);
+
+        return;
+    }
+
+    QStringList oldVolumeGroups;
+    for (const auto &d : operationStack().previewDevices())
+        if (d->type() == Device::LVM_Device)
+            oldVolumeGroups.append(d->deviceNode());
+
+    for (const auto &deviceNode : oldVolumeGroups)
+        operationStack().removeDevice(deviceNode);
+
+    for (const auto &r : devices) {
+        if (r.device) {
+            operationStack().replaceDevice(r.device);
+            SmartCollector::self()->invalidate(r.deviceNode);
+            SmartCollector::self()->request(r.deviceNode);
+        } else
+            operationStack().removeDevice(r.deviceNode);
+    }
+
+    operationStack().sortDevices();
+
+    const QList<Device*> deviceList = operationStack().previewDevices();
+    addVolumeGroups(deviceList, volumeGroups);
+
+    ScanCache::self()->save();
+
+    prefetchAttributes(operationStack().previewDevices());
+
+    emit progress(QString(), 100);
+}
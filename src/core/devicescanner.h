@@ -20,9 +20,19 @@
 
 #include "util/libpartitionmanagerexport.h"
 
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QStringList>
 #include <QThread>
 
+class Device;
+class LvmDevice;
 class OperationStack;
+class QTimer;
+class UEventMonitor;
+struct UEvent;
 
 /** Thread to scan for all available Devices on this computer.
 
@@ -40,13 +50,32 @@ public:
 public:
     void clear(); /**< clear Devices and the OperationStack */
     void scan(); /**< do the actual scanning; blocks if called directly */
+    void rescan(const QStringList& deviceNodes); /**< scan only the given disks again; blocks */
     void setupConnections();
 
+    bool startMonitoring();
+    void stopMonitoring();
+
+    bool prefetch() const {
+        return m_Prefetch;    /**< @return true if attributes left to be read later are read in the background after scanning */
+    }
+    void setPrefetch(bool b) {
+        m_Prefetch = b;    /**< @param b false to only read attributes when they are asked for */
+    }
+
+    static QString diskForEvent(const UEvent& event);
+
 Q_SIGNALS:
     void progress(const QString& deviceNode, int progress);
 
+    /** Emitted on the worker thread when the disks of a rescan have been scanned. Internal. */
+    void rescanned();
+
 protected:
     void run() override;
+    void scanVolumeGroups(const QList<Device*>& deviceList);
+    void addVolumeGroups(const QList<Device*>& deviceList, const QList<LvmDevice*>& lvmList);
+    void prefetchAttributes(const QList<Device*>& deviceList);
     OperationStack& operationStack() {
         return m_OperationStack;
     }
@@ -54,8 +83,38 @@ protected:
         return m_OperationStack;
     }
 
+private Q_SLOTS:
+    void onBlockDeviceEvent(const UEvent& event);
+    void onRescanTimeout();
+    void onRescanned();
+    void onSmartStatusReady(const QString& devicePath);
+
+private:
+    /** A disk scanned again by a rescan; device is nullptr if the disk is gone */
+    struct RescannedDevice {
+        QString deviceNode;
+        Device* device;
+    };
+
+    void collectRescan(const QHash<QString, bool>& requests, QList<RescannedDevice>& devices, QList<LvmDevice*>& volumeGroups);
+    void applyRescan(const QList<RescannedDevice>& devices, const QList<LvmDevice*>& volumeGroups);
+    void rememberSignature(const QString& deviceNode);
+
 private:
     OperationStack& m_OperationStack;
+    UEventMonitor* m_UEventMonitor;
+    QTimer* m_RescanTimer;
+    QHash<QString, bool> m_PendingRescans;
+    bool m_Prefetch;
+
+    bool m_Rescanning;
+    bool m_RescanApplyPending;
+    QHash<QString, bool> m_RescanRequests;
+    QList<RescannedDevice> m_RescannedDevices;
+    QList<LvmDevice*> m_RescannedVolumeGroups;
+
+    QMutex m_SignatureMutex;
+    QHash<QString, QByteArray> m_Signatures;
 };
 
 #endif
@@ -37,6 +37,10 @@
 #define BLKPBSZGET _IO(0x12,123)/* get block physical sector size */
 #endif
 
+#if !defined(BLKIOOPT)
+#define BLKIOOPT _IO(0x12,121)/* get optimal I/O size */
+#endif
+
 static qint32 getPhysicalSectorSize(const QString& device_node)
 {
     /*
@@ -70,6 +74,36 @@ static qint32 getPhysicalSectorSize(const QString& device_node)
     return -1;
 }
 
+static qint64 getOptimalIOSize(const QString& device_node)
+{
+    /*
+     * the optimal I/O size is what the device reports as its preferred request
+     * size, e.g. the stripe width of a RAID; most plain disks report 0
+     */
+
+#if defined(BLKIOOPT)
+    unsigned int ioOpt = 0;
+    int fd = open(device_node.toLocal8Bit().constData(), O_RDONLY);
+    if (fd != -1) {
+        if (ioctl(fd, BLKIOOPT, &ioOpt) >= 0) {
+            close(fd);
+            return ioOpt;
+        }
+
+        close(fd);
+    }
+#endif
+
+    QFile f(QStringLiteral("/sys/block/%1/queue/optimal_io_size").arg(QString(device_node).remove(QStringLiteral("/dev/"))));
+
+    if (f.open(QIODevice::ReadOnly)) {
+        QByteArray a = f.readLine();
+        return a.trimmed().toLongLong();
+    }
+
+    return 0;
+}
+
 /** Constructs a Disk Device with an empty PartitionTable.
     @param name the Device's name, usually some string defined by the manufacturer
     @param deviceNode the Device's node, for example "/dev/sda"
@@ -91,5 +125,38 @@ DiskDevice::DiskDevice(const QString& name,
     , m_Cylinders(cylinders)
     , m_LogicalSectorSize(sectorSize)
     , m_PhysicalSectorSize(getPhysicalSectorSize(deviceNode))
+    , m_OptimalIOSize(getOptimalIOSize(deviceNode))
+{
+}
+
+/** Constructs a Disk Device with an empty PartitionTable from sizes the caller already knows.
+
+    This does not open the device to ask it for its physical sector size and optimal I/O size.
+
+    @param name the Device's name, usually some string defined by the manufacturer
+    @param deviceNode the Device's node, for example "/dev/sda"
+    @param heads the number of heads in CHS notation
+    @param numSectors the number of sectors in CHS notation
+    @param cylinders the number of cylinders in CHS notation
+    @param sectorSize the size of a sector in bytes
+    @param physicalSectorSize the physical sector size in bytes or -1 if unknown
+    @param optimalIOSize the optimal I/O size in bytes or 0 if unknown
+*/
+DiskDevice::DiskDevice(const QString& name,
+                       const QString& deviceNode,
+                       qint32 heads,
+                       qint32 numSectors,
+                       qint32 cylinders,
+                       qint32 sectorSize,
+                       qint32 physicalSectorSize,
+                       qint64 optimalIOSize,
+                       const QString& iconName)
+    : Device(name, deviceNode, sectorSize, (static_cast<qint64>(heads) * cylinders * numSectors), iconName, Device::Disk_Device)
+    , m_Heads(heads)
+    , m_SectorsPerTrack(numSectors)
+    , m_Cylinders(cylinders)
+    , m_LogicalSectorSize(sectorSize)
+    , m_PhysicalSectorSize(physicalSectorSize)
+    , m_OptimalIOSize(optimalIOSize)
 {
 }
@@ -49,6 +49,7 @@ class LIBKPMCORE_EXPORT DiskDevice : public Device
 
 public:
     DiskDevice(const QString& name, const QString& deviceNode, qint32 heads, qint32 numSectors, qint32 cylinders, qint32 sectorSize, const QString& iconName = QString());
+    DiskDevice(const QString& name, const QString& deviceNode, qint32 heads, qint32 numSectors, qint32 cylinders, qint32 sectorSize, qint32 physicalSectorSize, qint64 optimalIOSize, const QString& iconName = QString());
 
 public:
     qint32 heads() const {
@@ -66,6 +67,9 @@ public:
     qint32 logicalSectorSize() const {
         return m_LogicalSectorSize;    /**< @return the logical sector size the Device uses */
     }
+    qint64 optimalIOSize() const {
+        return m_OptimalIOSize;    /**< @return the optimal I/O size in bytes the Device reports or 0 if unknown */
+    }
     qint64 totalSectors() const {
         return static_cast<qint64>(heads()) * cylinders() * sectorsPerTrack();    /**< @return the total number of sectors on the device */
     }
@@ -79,6 +83,7 @@ private:
     qint32 m_Cylinders;
     qint32 m_LogicalSectorSize;
     qint32 m_PhysicalSectorSize;
+    qint64 m_OptimalIOSize;
 };
 
 #endif
@@ -17,6 +17,8 @@
  *************************************************************************/
 
 #include "core/lvmdevice.h"
+#include "core/lvminventory.h"
+#include "core/mounttable.h"
 #include "core/partition.h"
 #include "fs/filesystem.h"
 #include "fs/lvm2_pv.h"
@@ -24,12 +26,17 @@
 #include "fs/filesystemfactory.h"
 
 #include "core/partitiontable.h"
+#include "util/blkidprobe.h"
 #include "util/externalcommand.h"
 #include "util/helpers.h"
+#include "util/progressparser.h"
 #include "util/report.h"
 
 #include <QRegularExpression>
-#include <QtMath>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QVector>
 
 #include <KDiskFreeSpaceInfo>
 #include <KLocalizedString>
@@ -86,14 +93,61 @@ void LvmDevice::initPartitions()
     setPartitionTable(pTable);
 }
 
+/** Scans one logical volume of those scanPartitions() looks at on a worker thread. */
+class ScanPartitionTask : public QRunnable
+{
+public:
+    ScanPartitionTask(const LvmDevice& device, const QString& lvPath, PartitionTable* pTable, Partition*& partition, QSemaphore& done) :
+        m_Device(device),
+        m_LVPath(lvPath),
+        m_PartitionTable(pTable),
+        m_Partition(partition),
+        m_Done(done)
+    {
+    }
+
+    void run() override {
+        m_Partition = m_Device.scanPartition(m_LVPath, m_PartitionTable);
+        m_Done.release();
+    }
+
+private:
+    const LvmDevice& m_Device;
+    const QString m_LVPath;
+    PartitionTable* m_PartitionTable;
+    Partition*& m_Partition;
+    QSemaphore& m_Done;
+};
+
+/** @return the thread pool logical volumes are scanned on */
+static QThreadPool& scanPartitionPool()
+{
+    // lvm serializes much of what it does with its own locks, so more threads do not help
+    static QThreadPool* pool = createThreadPool(2, 8);
+
+    return *pool;
+}
+
 /**
+ *  Logical volumes are scanned concurrently, since a volume group may have hundreds of them and
+ *  scanning one does not depend on the others. The list is still in the order of partitionNodes().
+ *
  *  @return an initialized Partition(LV) list
  */
 const QList<Partition*> LvmDevice::scanPartitions(PartitionTable* pTable) const
 {
+    const QStringList lvPaths = partitionNodes();
+    QVector<Partition*> scanned(lvPaths.size(), nullptr);
+    QSemaphore done;
+
+    for (qint32 i = 0; i < lvPaths.size(); ++i)
+        scanPartitionPool().start(new ScanPartitionTask(*this, lvPaths[i], pTable, scanned[i], done));
+
+    done.acquire(lvPaths.size());
+
     QList<Partition*> pList;
-    for (const auto &lvPath : partitionNodes()) {
-        pList.append(scanPartition(lvPath, pTable));
+    for (const auto &p : scanned) {
+        pList.append(p);
     }
     return pList;
 }
@@ -127,6 +181,7 @@ Partition* LvmDevice::scanPartition(const QString& lvPath, PartitionTable* pTabl
     PartitionRole::Roles r = PartitionRole::Lvm_Lv;
     QString mountPoint;
     bool mounted;
+    FileSystem::LazyAttributes lazy = FileSystem::LazyNone;
 
     // Handle LUKS partition
     if (fs->type() == FileSystem::Luks) {
@@ -148,14 +203,24 @@ Partition* LvmDevice::scanPartition(const QString& lvPath, PartitionTable* pTabl
                 fs->setSectorsUsed(freeSpaceInfo.used() / logicalSize());
         }
         else if (fs->supportGetUsed() == FileSystem::cmdSupportFileSystem)
-            fs->setSectorsUsed(qCeil(fs->readUsedCapacity(lvPath) / static_cast<float>(logicalSize())));
+            lazy |= FileSystem::LazyUsed;
    }
 
+    // reading these for LUKS needs the state initLUKS() set up, so do it right away
     if (fs->supportGetLabel() != FileSystem::cmdSupportNone) {
-        fs->setLabel(fs->readLabel(lvPath));
+        if (fs->type() == FileSystem::Luks)
+            fs->setLabel(fs->readLabel(lvPath));
+        else
+            lazy |= FileSystem::LazyLabel;
+    }
+    if (fs->supportGetUUID() != FileSystem::cmdSupportNone) {
+        if (fs->type() == FileSystem::Luks)
+            fs->setUUID(fs->readUUID(lvPath));
+        else
+            lazy |= FileSystem::LazyUUID;
     }
-    if (fs->supportGetUUID() != FileSystem::cmdSupportNone)
-        fs->setUUID(fs->readUUID(lvPath));
+
+    fs->setLazy(lvPath, logicalSize(), lazy, true);
 
     Partition* part = new Partition(pTable,
                     *this,
@@ -176,6 +241,10 @@ Partition* LvmDevice::scanPartition(const QString& lvPath, PartitionTable* pTabl
  */
 QList<LvmDevice*> LvmDevice::scanSystemLVM()
 {
+    BlkidProbe::Scan blkidScan;
+    LvmInventory::Scan lvmScan;
+    MountTable::Scan mountScan;
+
     QList<LvmDevice*> lvmList;
     for (const auto &vgName : getVGs()) {
         lvmList.append(new LvmDevice(vgName));
@@ -237,6 +306,10 @@ const QStringList LvmDevice::getVGs()
 const QStringList LvmDevice::getLVs(const QString& vgName)
 {
     QStringList lvPathList;
+
+    if (LvmInventory::logicalVolumes(vgName, lvPathList))
+        return lvPathList;
+
     QString cmdOutput = getField(QStringLiteral("lv_path"), vgName);
 
     if (cmdOutput.size()) {
@@ -279,6 +352,8 @@ QString LvmDevice::getUUID(const QString& vgName)
 }
 
 /** Get LVM vgs command output with field name
+ *
+ * During a scan the field is looked up in the LvmInventory instead of running vgs.
  *
  * @param fieldName LVM field name
  * @param vgName the name of LVM Volume Group
@@ -287,6 +362,10 @@ QString LvmDevice::getUUID(const QString& vgName)
 
 QString LvmDevice::getField(const QString& fieldName, const QString& vgName)
 {
+    QString value;
+    if (LvmInventory::vgField(fieldName, vgName, value))
+        return value;
+
     QStringList args = { QStringLiteral("vgs"),
               QStringLiteral("--foreign"),
               QStringLiteral("--readonly"),
@@ -308,6 +387,13 @@ QString LvmDevice::getField(const QString& fieldName, const QString& vgName)
 
 qint64 LvmDevice::getTotalLE(const QString& lvPath)
 {
+    QString lvSize;
+    QString extentSize;
+    if (LvmInventory::lvField(QStringLiteral("lv_size"), lvPath, lvSize) &&
+            LvmInventory::lvField(QStringLiteral("vg_extent_size"), lvPath, extentSize)) {
+        return lvSize.isEmpty() || extentSize.toLongLong() <= 0 ? -1 : lvSize.toLongLong() / extentSize.toLongLong();
+    }
+
     ExternalCommand cmd(QStringLiteral("lvm"),
             { QStringLiteral("lvdisplay"),
               lvPath});
@@ -407,12 +493,16 @@ bool LvmDevice::movePV(Report& report, const QString& pvPath, const QStringList&
 
     QStringList args = QStringList();
     args << QStringLiteral("pvmove");
+    args << QStringLiteral("--interval") << QStringLiteral("2");
     args << pvPath;
     if (!destinations.isEmpty())
         for (const auto &destPath : destinations)
             args << destPath.trimmed();
 
     ExternalCommand cmd(report, QStringLiteral("lvm"), args);
+    ProgressParser progress(report, ProgressParser::pvmove());
+    cmd.setProgressParser(&progress);
+    cmd.setOutputLimit(64 * 1024);
     return (cmd.run(-1) && cmd.exitCode() == 0);
 }
 
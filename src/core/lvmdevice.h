@@ -44,6 +44,8 @@ class LIBKPMCORE_EXPORT LvmDevice : public VolumeManagerDevice
 {
     Q_DISABLE_COPY(LvmDevice)
 
+    friend class ScanPartitionTask;
+
 public:
     LvmDevice(const QString& name, const QString& iconName = QString());
     ~LvmDevice();
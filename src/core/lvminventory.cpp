@@ -0,0 +1,248 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/lvminventory.h"
+
+#include "util/externalcommand.h"
+
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+
+static QMutex s_ScanMutex;
+static qint32 s_ScanDepth = 0;
+static LvmInventory* s_Inventory = nullptr;
+static bool s_Loaded = false;
+static QFuture<ExternalCommand::Result> s_Report;
+
+LvmInventory::Scan::Scan()
+{
+    QMutexLocker locker(&s_ScanMutex);
+
+    // start lvm right away, so it runs while the disks are being scanned
+    if (++s_ScanDepth == 1)
+        s_Report = ExternalCommand::runAsync(QStringLiteral("lvm"), {
+                          QStringLiteral("fullreport"),
+                          QStringLiteral("--foreign"),
+                          QStringLiteral("--readonly"),
+                          QStringLiteral("--reportformat"), QStringLiteral("json"),
+                          QStringLiteral("--units"), QStringLiteral("B"),
+                          QStringLiteral("--nosuffix"),
+                          QStringLiteral("--configreport"), QStringLiteral("vg"),
+                          QStringLiteral("--options"), QStringLiteral("vg_name,vg_uuid,vg_extent_size,vg_extent_count,vg_free_count"),
+                          QStringLiteral("--configreport"), QStringLiteral("lv"),
+                          QStringLiteral("--options"), QStringLiteral("lv_path,lv_size"),
+                          QStringLiteral("--configreport"), QStringLiteral("pv"),
+                          QStringLiteral("--options"), QStringLiteral("pv_name,pv_uuid,pv_used,pe_start,pv_pe_count,pv_pe_alloc_count"),
+                          QStringLiteral("--configreport"), QStringLiteral("pvseg"),
+                          QStringLiteral("--options"), QStringLiteral("pvseg_start"),
+                          QStringLiteral("--configreport"), QStringLiteral("seg"),
+                          QStringLiteral("--options"), QStringLiteral("seg_start") }, -1);
+}
+
+LvmInventory::Scan::~Scan()
+{
+    QMutexLocker locker(&s_ScanMutex);
+
+    if (--s_ScanDepth == 0) {
+        delete s_Inventory;
+        s_Inventory = nullptr;
+        s_Loaded = false;
+        s_Report = QFuture<ExternalCommand::Result>();
+    }
+}
+
+LvmInventory::LvmInventory() :
+    m_VolumeGroups(),
+    m_LogicalVolumes(),
+    m_PhysicalVolumes()
+{
+}
+
+/** @return the snapshot for the current scan, loading it on first use, or nullptr if there is none */
+const LvmInventory* LvmInventory::current()
+{
+    QMutexLocker locker(&s_ScanMutex);
+
+    if (s_ScanDepth == 0)
+        return nullptr;
+
+    if (!s_Loaded) {
+        s_Loaded = true;
+
+        const ExternalCommand::Result report = s_Report.result();
+        LvmInventory* inventory = new LvmInventory();
+
+        if (report.success() && inventory->load(report.output))
+            s_Inventory = inventory;
+        else
+            delete inventory;
+    }
+
+    return s_Inventory;
+}
+
+/** Keeps the fields of all volume groups, logical and physical volumes from lvm fullreport.
+
+    Each element of the report describes one volume group together with its logical and physical
+    volumes; physical volumes not in any volume group come in an element without a volume group.
+    The physical and logical volumes are given the name and extent size of their volume group, so
+    lookups do not need to go through the volume group.
+
+    @param output the JSON output of lvm fullreport
+    @return true if the report could be parsed
+*/
+bool LvmInventory::load(const QString& output)
+{
+    const QJsonDocument document = QJsonDocument::fromJson(output.toUtf8());
+
+    if (!document.isObject() || !document.object().value(QStringLiteral("report")).isArray())
+        return false;
+
+    const auto rows = [](const QJsonObject& report, const QString& name) {
+        QList<Fields> result;
+        for (const QJsonValue& row : report.value(name).toArray()) {
+            Fields fields;
+            const QJsonObject object = row.toObject();
+            for (auto it = object.constBegin(); it != object.constEnd(); ++it)
+                fields.insert(it.key(), it.value().toString().trimmed());
+            result.append(fields);
+        }
+        return result;
+    };
+
+    for (const QJsonValue& element : document.object().value(QStringLiteral("report")).toArray()) {
+        const QJsonObject report = element.toObject();
+
+        const QList<Fields> vgs = rows(report, QStringLiteral("vg"));
+        const QString vgName = vgs.isEmpty() ? QString() : vgs.first().value(QStringLiteral("vg_name"));
+        const QString extentSize = vgs.isEmpty() ? QString() : vgs.first().value(QStringLiteral("vg_extent_size"));
+
+        m_VolumeGroups.append(vgs);
+
+        for (Fields lv : rows(report, QStringLiteral("lv"))) {
+            // hidden logical volumes like mirror legs and thin pool data have no path
+            if (lv.value(QStringLiteral("lv_path")).isEmpty())
+                continue;
+
+            lv.insert(QStringLiteral("vg_name"), vgName);
+            lv.insert(QStringLiteral("vg_extent_size"), extentSize);
+            m_LogicalVolumes.append(lv);
+        }
+
+        for (Fields pv : rows(report, QStringLiteral("pv"))) {
+            pv.insert(QStringLiteral("vg_name"), vgName);
+            pv.insert(QStringLiteral("vg_extent_size"), extentSize);
+            m_PhysicalVolumes.append(pv);
+        }
+    }
+
+    return true;
+}
+
+bool LvmInventory::field(const QList<Fields>& rows, const QString& keyName, const QString& fieldName, const QString& key, QString& value)
+{
+    QStringList values;
+
+    for (const Fields& row : rows) {
+        if (!row.contains(fieldName))
+            return false;
+
+        if (key.isEmpty() || row.value(keyName) == key)
+            values.append(row.value(fieldName));
+    }
+
+    value = values.join(QStringLiteral("\n"));
+    return true;
+}
+
+/** Looks up a field of a volume group.
+    @param fieldName the LVM name of the field, e.g. "vg_extent_size"
+    @param vgName the name of the volume group or an empty string for the field of all volume groups, one per line
+    @param value set to the field's value; empty if there is no such volume group
+    @return true if the field could be looked up in the snapshot
+*/
+bool LvmInventory::vgField(const QString& fieldName, const QString& vgName, QString& value)
+{
+    const LvmInventory* inventory = current();
+    return inventory && field(inventory->m_VolumeGroups, QStringLiteral("vg_name"), fieldName, vgName, value);
+}
+
+/** Looks up a field of a logical volume.
+    @param fieldName the LVM name of the field, e.g. "lv_size"
+    @param lvPath the path of the logical volume, e.g. "/dev/vg/lv"
+    @param value set to the field's value; empty if there is no such logical volume
+    @return true if the field could be looked up in the snapshot
+*/
+bool LvmInventory::lvField(const QString& fieldName, const QString& lvPath, QString& value)
+{
+    const LvmInventory* inventory = current();
+    return inventory && field(inventory->m_LogicalVolumes, QStringLiteral("lv_path"), fieldName, lvPath, value);
+}
+
+/** Lists the logical volumes of a volume group.
+    @param vgName the name of the volume group
+    @param lvPaths set to the paths of its logical volumes, e.g. "/dev/vg/lv"
+    @return true if the logical volumes could be looked up in the snapshot
+*/
+bool LvmInventory::logicalVolumes(const QString& vgName, QStringList& lvPaths)
+{
+    const LvmInventory* inventory = current();
+
+    if (inventory == nullptr)
+        return false;
+
+    lvPaths.clear();
+
+    for (const Fields& lv : inventory->m_LogicalVolumes)
+        if (lv.value(QStringLiteral("vg_name")) == vgName)
+            lvPaths.append(lv.value(QStringLiteral("lv_path")));
+
+    return true;
+}
+
+/** Looks up a field of a physical volume.
+    @param fieldName the LVM name of the field, e.g. "pv_uuid"
+    @param deviceNode the device node of the physical volume or an empty string for the field of all physical volumes, one per line
+    @param value set to the field's value; empty if there is no such physical volume
+    @return true if the field could be looked up in the snapshot
+*/
+bool LvmInventory::pvField(const QString& fieldName, const QString& deviceNode, QString& value)
+{
+    const LvmInventory* inventory = current();
+
+    if (inventory == nullptr)
+        return false;
+
+    if (!field(inventory->m_PhysicalVolumes, QStringLiteral("pv_name"), fieldName, deviceNode, value))
+        return false;
+
+    // lvm names physical volumes by the device node it found them on, which may be another
+    // name for the same device, e.g. /dev/dm-0 instead of /dev/mapper/luks-...
+    if (value.isEmpty() && !deviceNode.isEmpty()) {
+        const QString canonicalNode = QFileInfo(deviceNode).canonicalFilePath();
+
+        for (const Fields& pv : inventory->m_PhysicalVolumes)
+            if (!canonicalNode.isEmpty() && QFileInfo(pv.value(QStringLiteral("pv_name"))).canonicalFilePath() == canonicalNode)
+                value = pv.value(fieldName);
+    }
+
+    return true;
+}
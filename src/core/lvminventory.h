@@ -0,0 +1,85 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(LVMINVENTORY__H)
+
+#define LVMINVENTORY__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QtGlobal>
+
+/** A snapshot of all LVM volume groups, logical volumes and physical volumes.
+
+    Scanning asks LVM for many single fields: the extent size, extent count, free count, UUID
+    and logical volumes of each volume group, the size of each logical volume and several fields
+    of each physical volume. Running lvm for each of those means hundreds of processes on hosts
+    with many volumes. When the first LvmInventory::Scan object is created, a single
+    "lvm fullreport --reportformat json" is started in the background; the first query waits for
+    it and every query is answered from its output.
+
+    Fields are kept by their LVM names (e.g. "vg_extent_size" or "pv_uuid"), the same names
+    LvmDevice::getField() and lvm2_pv::getpvField() use. A query for a field not in the snapshot,
+    any query outside of a scan and any query when lvm fullreport failed return false and the
+    caller runs lvm itself, as before.
+*/
+class LIBKPMCORE_EXPORT LvmInventory
+{
+    Q_DISABLE_COPY(LvmInventory)
+
+public:
+    /** Keeps the snapshot for as long as it exists.
+
+        Scans may be nested; the snapshot is dropped when the outermost Scan ends, so the next
+        scan sees the changes made in the meantime.
+    */
+    class LIBKPMCORE_EXPORT Scan
+    {
+        Q_DISABLE_COPY(Scan)
+
+    public:
+        Scan();
+        ~Scan();
+    };
+
+private:
+    LvmInventory();
+
+public:
+    static bool vgField(const QString& fieldName, const QString& vgName, QString& value);
+    static bool lvField(const QString& fieldName, const QString& lvPath, QString& value);
+    static bool pvField(const QString& fieldName, const QString& deviceNode, QString& value);
+    static bool logicalVolumes(const QString& vgName, QStringList& lvPaths);
+
+private:
+    typedef QHash<QString, QString> Fields;
+
+    static const LvmInventory* current();
+    static bool field(const QList<Fields>& rows, const QString& keyName, const QString& fieldName, const QString& key, QString& value);
+
+    bool load(const QString& output);
+
+private:
+    QList<Fields> m_VolumeGroups;
+    QList<Fields> m_LogicalVolumes;
+    QList<Fields> m_PhysicalVolumes;
+};
+
+#endif
@@ -0,0 +1,363 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/mounttable.h"
+
+#include <KMountPoint>
+
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSocketNotifier>
+
+#include <algorithm>
+
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+static QMutex s_ScanMutex;
+static qint32 s_ScanDepth = 0;
+static MountTable* s_MountTable = nullptr;
+
+static QByteArray readProcFile(QFile& file)
+{
+    // files in /proc have no size, so QFile::readAll() has to read until the end
+    file.seek(0);
+    return file.readAll();
+}
+
+static QByteArray readProcFile(const QString& fileName)
+{
+    QFile file(fileName);
+    return file.open(QIODevice::ReadOnly) ? readProcFile(file) : QByteArray();
+}
+
+/** Undoes the octal escapes (e.g. "\040" for a space) the kernel uses in mount tables. */
+static QString unescape(const QByteArray& s)
+{
+    QByteArray rval;
+    rval.reserve(s.size());
+
+    for (qint32 i = 0; i < s.size(); i++) {
+        bool ok = false;
+        const qint32 c = s[i] == '\\' && i + 3 < s.size() ? s.mid(i + 1, 3).toInt(&ok, 8) : 0;
+
+        if (ok) {
+            rval += static_cast<char>(c);
+            i += 3;
+        } else
+            rval += s[i];
+    }
+
+    return QString::fromLocal8Bit(rval);
+}
+
+static quint64 deviceNumber(quint32 major, quint32 minor)
+{
+    return (static_cast<quint64>(major) << 32) | minor;
+}
+
+/** @return the device number of a block device node or 0 if it is not one */
+static quint64 deviceNumber(const QString& deviceNode)
+{
+    struct stat st;
+
+    if (deviceNode.isEmpty() || stat(deviceNode.toLocal8Bit().constData(), &st) != 0 || !S_ISBLK(st.st_mode))
+        return 0;
+
+    return deviceNumber(major(st.st_rdev), minor(st.st_rdev));
+}
+
+MountTable::Scan::Scan()
+{
+    QMutexLocker locker(&s_ScanMutex);
+
+    if (s_ScanDepth++ == 0)
+        s_MountTable = new MountTable();
+}
+
+MountTable::Scan::~Scan()
+{
+    QMutexLocker locker(&s_ScanMutex);
+
+    if (--s_ScanDepth == 0) {
+        delete s_MountTable;
+        s_MountTable = nullptr;
+    }
+}
+
+/** Reads the current mount table, the active swap spaces and /etc/fstab. */
+MountTable::MountTable() :
+    MountTable(readProcFile(QStringLiteral("/proc/self/mountinfo")), readProcFile(QStringLiteral("/proc/swaps")))
+{
+}
+
+/** Creates a MountTable from the content of /proc/self/mountinfo and /proc/swaps and reads /etc/fstab.
+    @param mountInfo the content of /proc/self/mountinfo
+    @param swaps the content of /proc/swaps
+*/
+MountTable::MountTable(const QByteArray& mountInfo, const QByteArray& swaps) :
+    m_Entries(),
+    m_ByDeviceNode(),
+    m_ByDeviceNumber(),
+    m_FstabMountPoints()
+{
+    parseMountInfo(mountInfo);
+    parseSwaps(swaps);
+    readFstab();
+}
+
+/** @return the snapshot of the current scan or nullptr if no scan is running */
+const MountTable* MountTable::current()
+{
+    QMutexLocker locker(&s_ScanMutex);
+    return s_MountTable;
+}
+
+void MountTable::parseMountInfo(const QByteArray& mountInfo)
+{
+    // 36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw,errors=continue
+    for (const QByteArray& line : mountInfo.split('\n')) {
+        const QList<QByteArray> fields = line.split(' ');
+        const qint32 separator = fields.indexOf("-");
+
+        if (fields.size() < 5 || separator < 0 || separator + 2 >= fields.size())
+            continue;
+
+        const QList<QByteArray> number = fields[2].split(':');
+
+        if (number.size() != 2)
+            continue;
+
+        addEntry({ unescape(fields[separator + 2]), number[0].toUInt(), number[1].toUInt(), unescape(fields[4]), unescape(fields[separator + 1]) });
+    }
+}
+
+void MountTable::parseSwaps(const QByteArray& swaps)
+{
+    // Filename    Type        Size    Used    Priority
+    // /dev/sda2   partition   8388604 0       -2
+    const QList<QByteArray> lines = swaps.split('\n');
+
+    for (qint32 i = 1; i < lines.size(); i++) {
+        const QList<QByteArray> fields = lines[i].simplified().split(' ');
+
+        if (fields.size() < 2 || fields[1] != "partition")
+            continue;
+
+        const QString deviceNode = unescape(fields[0]);
+        const quint64 number = deviceNumber(deviceNode);
+
+        addEntry({ deviceNode, static_cast<quint32>(number >> 32), static_cast<quint32>(number & 0xffffffff), QString(), QStringLiteral("swap") });
+    }
+}
+
+/** Reads the mount points for devices that are not mounted from /etc/fstab.
+
+    KMountPoint resolves UUID= and LABEL= entries to device nodes, so this goes through it.
+*/
+void MountTable::readFstab()
+{
+    const KMountPoint::List possible = KMountPoint::possibleMountPoints(KMountPoint::NeedRealDeviceName);
+
+    for (const KMountPoint::Ptr& mp : possible) {
+        const QString deviceNode = mp->realDeviceName().isEmpty() ? mp->mountedFrom() : mp->realDeviceName();
+
+        if (!deviceNode.isEmpty() && !m_FstabMountPoints.contains(deviceNode))
+            m_FstabMountPoints.insert(deviceNode, mp->mountPoint());
+    }
+}
+
+void MountTable::addEntry(const Entry& e)
+{
+    const qint32 index = m_Entries.size();
+    m_Entries.append(e);
+
+    if (e.deviceNode.startsWith(QLatin1Char('/'))) {
+        m_ByDeviceNode.insert(e.deviceNode, index);
+
+        const QString canonical = QFileInfo(e.deviceNode).canonicalFilePath();
+        if (!canonical.isEmpty() && canonical != e.deviceNode)
+            m_ByDeviceNode.insert(canonical, index);
+    }
+
+    // file systems like btrfs, NFS or tmpfs are mounted from an anonymous device with major number 0
+    if (e.major != 0)
+        m_ByDeviceNumber.insert(deviceNumber(e.major, e.minor), index);
+}
+
+/** @return the entries for a device node, in the order of the mount table */
+QList<const MountTable::Entry*> MountTable::find(const QString& deviceNode) const
+{
+    QList<qint32> indexes = m_ByDeviceNode.values(deviceNode);
+
+    const QString canonical = QFileInfo(deviceNode).canonicalFilePath();
+    if (!canonical.isEmpty() && canonical != deviceNode)
+        indexes += m_ByDeviceNode.values(canonical);
+
+    const quint64 number = deviceNumber(deviceNode);
+    if (number != 0)
+        indexes += m_ByDeviceNumber.values(number);
+
+    std::sort(indexes.begin(), indexes.end());
+    indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+
+    QList<const Entry*> rval;
+    for (const qint32 i : indexes)
+        rval.append(&m_Entries[i]);
+
+    return rval;
+}
+
+/** @param deviceNode the device node to look for
+    @return true if the device is mounted or an active swap space
+*/
+bool MountTable::isMounted(const QString& deviceNode) const
+{
+    return !find(deviceNode).isEmpty();
+}
+
+/** @param deviceNode the device node to look for
+    @return all mount points the device is mounted on, in the order of the mount table
+*/
+QStringList MountTable::mountPoints(const QString& deviceNode) const
+{
+    QStringList rval;
+
+    for (const Entry* e : find(deviceNode))
+        if (!e->mountPoint.isEmpty())
+            rval.append(e->mountPoint);
+
+    return rval;
+}
+
+/** Finds the mount point of a device.
+
+    This is the first mount point the device is mounted on or, if it is not mounted, the mount
+    point /etc/fstab has for it.
+
+    @param deviceNode the device node to look for
+    @return the mount point or an empty string if there is none
+*/
+QString MountTable::mountPoint(const QString& deviceNode) const
+{
+    const QStringList mounted = mountPoints(deviceNode);
+
+    if (!mounted.isEmpty())
+        return mounted.first();
+
+    if (m_FstabMountPoints.contains(deviceNode))
+        return m_FstabMountPoints.value(deviceNode);
+
+    const QString canonical = QFileInfo(deviceNode).canonicalFilePath();
+    return m_FstabMountPoints.value(canonical);
+}
+
+/** @param other an older MountTable
+    @return the device nodes whose mount points or swap state differ between the two tables
+*/
+QStringList MountTable::changedDevices(const MountTable& other) const
+{
+    QHash<QString, QStringList> before;
+    QHash<QString, QStringList> after;
+
+    for (const Entry& e : other.entries())
+        before[e.deviceNode].append(e.mountPoint.isEmpty() ? e.type : e.mountPoint);
+
+    for (const Entry& e : entries())
+        after[e.deviceNode].append(e.mountPoint.isEmpty() ? e.type : e.mountPoint);
+
+    QStringList rval;
+
+    for (auto it = after.constBegin(); it != after.constEnd(); ++it)
+        if (before.value(it.key()) != it.value() && it.key().startsWith(QLatin1Char('/')))
+            rval.append(it.key());
+
+    for (auto it = before.constBegin(); it != before.constEnd(); ++it)
+        if (!after.contains(it.key()) && it.key().startsWith(QLatin1Char('/')))
+            rval.append(it.key());
+
+    rval.sort();
+
+    return rval;
+}
+
+// --------------------------------------------------------------------------
+
+MountTableWatcher::MountTableWatcher(QObject* parent) :
+    QObject(parent),
+    m_MountInfo(QStringLiteral("/proc/self/mountinfo")),
+    m_Swaps(QStringLiteral("/proc/swaps")),
+    m_MountInfoNotifier(nullptr),
+    m_SwapsNotifier(nullptr),
+    m_MountTable(QByteArray(), QByteArray())
+{
+}
+
+MountTableWatcher::~MountTableWatcher()
+{
+    stop();
+}
+
+/** Reads the mount table and starts watching it for changes.
+    @return true if /proc/self/mountinfo could be opened
+*/
+bool MountTableWatcher::start()
+{
+    if (isActive())
+        return true;
+
+    if (!m_MountInfo.open(QIODevice::ReadOnly))
+        return false;
+
+    // the kernel signals changes as an exceptional condition (POLLPRI) on these files, until they are read again
+    m_MountInfoNotifier = new QSocketNotifier(m_MountInfo.handle(), QSocketNotifier::Exception, this);
+    connect(m_MountInfoNotifier, &QSocketNotifier::activated, this, &MountTableWatcher::onChanged);
+
+    if (m_Swaps.open(QIODevice::ReadOnly)) {
+        m_SwapsNotifier = new QSocketNotifier(m_Swaps.handle(), QSocketNotifier::Exception, this);
+        connect(m_SwapsNotifier, &QSocketNotifier::activated, this, &MountTableWatcher::onChanged);
+    }
+
+    m_MountTable = MountTable(readProcFile(m_MountInfo), m_Swaps.isOpen() ? readProcFile(m_Swaps) : QByteArray());
+
+    return true;
+}
+
+/** Stops watching the mount table. */
+void MountTableWatcher::stop()
+{
+    delete m_MountInfoNotifier;
+    m_MountInfoNotifier = nullptr;
+
+    delete m_SwapsNotifier;
+    m_SwapsNotifier = nullptr;
+
+    m_MountInfo.close();
+    m_Swaps.close();
+}
+
+void MountTableWatcher::onChanged()
+{
+    const MountTable mountTable(readProcFile(m_MountInfo), m_Swaps.isOpen() ? readProcFile(m_Swaps) : QByteArray());
+    const QStringList changed = mountTable.changedDevices(m_MountTable);
+
+    m_MountTable = mountTable;
+
+    if (!changed.isEmpty())
+        emit mountsChanged(changed);
+}
@@ -0,0 +1,148 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(MOUNTTABLE__H)
+
+#define MOUNTTABLE__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMultiHash>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QtGlobal>
+
+class QSocketNotifier;
+
+/** A snapshot of the mounted file systems and active swap spaces.
+
+    The table is read once from /proc/self/mountinfo and /proc/swaps, together with the mount
+    points /etc/fstab has for devices that are not mounted. Entries are indexed by device node and
+    by the major:minor number of the mounted device, so a device can be found whichever of its
+    names (e.g. /dev/mapper/foo or /dev/dm-0) is asked for.
+
+    While a MountTable::Scan object exists, FileSystem::detectMountPoint() and isMounted() answer
+    from one shared snapshot instead of reading the mount table, /etc/fstab or running lsblk again
+    for every partition.
+
+    @see MountTableWatcher
+*/
+class LIBKPMCORE_EXPORT MountTable
+{
+public:
+    /** A mounted file system or an active swap space */
+    struct Entry {
+        QString deviceNode;     /**< the mounted device as given in the mount table */
+        quint32 major;          /**< major number of the mounted device */
+        quint32 minor;          /**< minor number of the mounted device */
+        QString mountPoint;     /**< the mount point; empty for swap */
+        QString type;           /**< the file system type, "swap" for swap */
+    };
+
+    /** Keeps a snapshot of the mount table for as long as it exists.
+
+        Scans may be nested; the snapshot is dropped when the outermost Scan ends.
+    */
+    class LIBKPMCORE_EXPORT Scan
+    {
+        Q_DISABLE_COPY(Scan)
+
+    public:
+        Scan();
+        ~Scan();
+    };
+
+public:
+    MountTable();
+    MountTable(const QByteArray& mountInfo, const QByteArray& swaps);
+
+public:
+    static const MountTable* current();
+
+    bool isMounted(const QString& deviceNode) const;
+    QString mountPoint(const QString& deviceNode) const;
+    QStringList mountPoints(const QString& deviceNode) const;
+    QStringList changedDevices(const MountTable& other) const;
+
+    const QList<Entry>& entries() const {
+        return m_Entries;    /**< @return all mounted file systems and active swap spaces */
+    }
+
+private:
+    void parseMountInfo(const QByteArray& mountInfo);
+    void parseSwaps(const QByteArray& swaps);
+    void readFstab();
+    void addEntry(const Entry& e);
+    QList<const Entry*> find(const QString& deviceNode) const;
+
+private:
+    QList<Entry> m_Entries;
+    QMultiHash<QString, qint32> m_ByDeviceNode;
+    QMultiHash<quint64, qint32> m_ByDeviceNumber;
+    QHash<QString, QString> m_FstabMountPoints;
+};
+
+/** Keeps a MountTable up to date and tells when mounts change.
+
+    The kernel flags /proc/self/mountinfo and /proc/swaps when something is mounted, unmounted,
+    swapped on or swapped off. MountTableWatcher polls both files for that and re-reads only the
+    mount table then, so a GUI or daemon can update the partitions whose mount state changed
+    instead of scanning all devices again.
+*/
+class LIBKPMCORE_EXPORT MountTableWatcher : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(MountTableWatcher)
+
+public:
+    explicit MountTableWatcher(QObject* parent = nullptr);
+    ~MountTableWatcher();
+
+public:
+    bool start();
+    void stop();
+
+    bool isActive() const {
+        return m_MountInfoNotifier != nullptr;    /**< @return true if the mount table is being watched */
+    }
+    const MountTable& mountTable() const {
+        return m_MountTable;    /**< @return the mount table as of the last change */
+    }
+
+Q_SIGNALS:
+    /** Emitted when mounts changed.
+        @param deviceNodes the devices that were mounted, unmounted, swapped on or swapped off
+    */
+    void mountsChanged(const QStringList& deviceNodes);
+
+private Q_SLOTS:
+    void onChanged();
+
+private:
+    QFile m_MountInfo;
+    QFile m_Swaps;
+    QSocketNotifier* m_MountInfoNotifier;
+    QSocketNotifier* m_SwapsNotifier;
+    MountTable m_MountTable;
+};
+
+#endif
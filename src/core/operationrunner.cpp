@@ -18,7 +18,11 @@
 
 #include "core/operationrunner.h"
 
+#include "core/device.h"
 #include "core/operationstack.h"
+#include "core/scancache.h"
+
+#include "fs/filesystem.h"
 
 #include "ops/operation.h"
 
@@ -45,6 +49,9 @@ void OperationRunner::run()
 
     setCancelling(false);
 
+    // tools still reading file systems in the background must not see them change under their feet
+    FileSystem::cancelPrefetch();
+
     bool status = true;
 
     for (int i = 0; i < numOperations(); i++) {
@@ -65,6 +72,11 @@ void OperationRunner::run()
         status = op->execute(report());
         op->preview();
 
+        // whatever the operation did, the next scan must not take it from the cache
+        for (const Device* d : operationStack().previewDevices())
+            if (op->targets(*d))
+                ScanCache::self()->invalidate(d->deviceNode());
+
         disconnect(op, &Operation::progress, this, &OperationRunner::progressSub);
 
         emit opFinished(i + 1, op);
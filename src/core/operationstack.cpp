@@ -552,6 +552,47 @@ void OperationStack::addDevice(Device* d)
     emit devicesChanged();
 }
 
+/** Replaces the Device with the same device node by a newly scanned one.
+
+    If there is no such Device, the new one is added.
+
+    @param d pointer to the new Device
+*/
+void OperationStack::replaceDevice(Device* d)
+{
+    Q_ASSERT(d);
+
+    QWriteLocker lockDevices(&lock());
+
+    for (qint32 i = 0; i < previewDevices().size(); i++) {
+        if (previewDevices()[i]->deviceNode() == d->deviceNode()) {
+            delete previewDevices()[i];
+            previewDevices()[i] = d;
+            emit devicesChanged();
+            return;
+        }
+    }
+
+    previewDevices().append(d);
+    emit devicesChanged();
+}
+
+/** Removes and deletes the Device with the given device node, if there is one.
+    @param deviceNode the device node of the Device to remove
+*/
+void OperationStack::removeDevice(const QString& deviceNode)
+{
+    QWriteLocker lockDevices(&lock());
+
+    for (qint32 i = 0; i < previewDevices().size(); i++) {
+        if (previewDevices()[i]->deviceNode() == deviceNode) {
+            delete previewDevices().takeAt(i);
+            emit devicesChanged();
+            return;
+        }
+    }
+}
+
 static bool deviceLessThan(const Device* d1, const Device* d2)
 {
     return d1->deviceNode() <= d2->deviceNode();
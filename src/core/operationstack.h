@@ -90,6 +90,8 @@ public:
 protected:
     void clearDevices();
     void addDevice(Device* d);
+    void replaceDevice(Device* d);
+    void removeDevice(const QString& deviceNode);
     void sortDevices();
 
     bool mergeNewOperation(Operation*& currentOp, Operation*& pushedOp);
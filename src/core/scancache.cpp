@@ -0,0 +1,443 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/scancache.h"
+
+#include "core/blockdeviceinfo.h"
+#include "core/diskdevice.h"
+#include "core/partition.h"
+#include "core/partitiontable.h"
+
+#include "fs/filesystem.h"
+
+#include "util/globallog.h"
+
+#include <KLocalizedString>
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtEndian>
+
+#include <cstring>
+
+static const char cacheMagic[] = "KPMCORESCANCACHE";
+static const quint32 cacheVersion = 3;
+
+// the number of sectors at the start of the disk that hold an MBR or a GPT with 128 entries
+static const qint32 tableSectors = 34;
+
+// more than the entries of any GPT written by a partitioning tool
+static const qint64 maxGptEntryBytes = 1024 * 1024;
+
+// enough of a partition's start for the superblocks of all supported file systems, including
+// the one btrfs has at 64 KiB
+static const qint64 superblockBytes = 68 * 1024;
+
+static QDataStream& operator<<(QDataStream& stream, const ScanCache::PartitionEntry& p)
+{
+    return stream << p.roles << p.fileSystemType << p.firstSector << p.lastSector << p.deviceNode << p.availableFlags << p.activeFlags
+                  << p.sectorsUsed << p.label << p.uuid << p.pending << p.superblockDigest;
+}
+
+static QDataStream& operator>>(QDataStream& stream, ScanCache::PartitionEntry& p)
+{
+    return stream >> p.roles >> p.fileSystemType >> p.firstSector >> p.lastSector >> p.deviceNode >> p.availableFlags >> p.activeFlags
+                  >> p.sectorsUsed >> p.label >> p.uuid >> p.pending >> p.superblockDigest;
+}
+
+static QDataStream& operator<<(QDataStream& stream, const ScanCache::DeviceEntry& d)
+{
+    return stream << d.identity << d.deviceNode << d.name << d.heads << d.sectorsPerTrack << d.cylinders << d.logicalSectorSize
+                  << d.physicalSectorSize << d.optimalIOSize << d.tableType << d.firstUsable << d.lastUsable << d.maxPrimaries
+                  << d.tableDigest << d.partitions;
+}
+
+static QDataStream& operator>>(QDataStream& stream, ScanCache::DeviceEntry& d)
+{
+    return stream >> d.identity >> d.deviceNode >> d.name >> d.heads >> d.sectorsPerTrack >> d.cylinders >> d.logicalSectorSize
+                  >> d.physicalSectorSize >> d.optimalIOSize >> d.tableType >> d.firstUsable >> d.lastUsable >> d.maxPrimaries
+                  >> d.tableDigest >> d.partitions;
+}
+
+/** @return a digest of length bytes at offset in a device, or an empty QByteArray if they cannot be read */
+static QByteArray readDigest(const QString& deviceNode, qint64 offset, qint64 length)
+{
+    QFile f(deviceNode);
+
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Unbuffered) || !f.seek(offset))
+        return QByteArray();
+
+    const QByteArray data = f.read(length);
+
+    if (data.isEmpty())
+        return QByteArray();
+
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
+
+/** Adds a GPT header and the partition entries it points to to a digest.
+    @param hash the digest
+    @param disk the disk, opened for reading
+    @param lba the sector the header is in
+    @param sectorSize the logical sector size of the disk
+*/
+static void addGptDigest(QCryptographicHash& hash, QFile& disk, qint64 lba, qint32 sectorSize)
+{
+    if (lba <= 0 || !disk.seek(lba * sectorSize))
+        return;
+
+    // the header also has the CRC-32 of the entries, but a table written without updating it is just as changed
+    const QByteArray header = disk.read(sectorSize);
+    hash.addData(header);
+
+    if (header.size() < 92 || !header.startsWith("EFI PART"))
+        return;
+
+    const qint64 entryLba = qFromLittleEndian<quint64>(reinterpret_cast<const uchar*>(header.constData() + 72));
+    const qint64 entryBytes = static_cast<qint64>(qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(header.constData() + 80))) *
+                              qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(header.constData() + 84));
+
+    if (entryLba > 0 && entryBytes > 0 && entryBytes <= maxGptEntryBytes && disk.seek(entryLba * sectorSize))
+        hash.addData(disk.read(entryBytes));
+}
+
+ScanCache::ScanCache() :
+    m_Mutex(),
+    m_Entries(),
+    m_Loaded(false),
+    m_Modified(false),
+    m_Enabled(false)
+{
+}
+
+/** @return the ScanCache */
+ScanCache* ScanCache::self()
+{
+    static ScanCache* p = new ScanCache();
+
+    return p;
+}
+
+/** Looks up what the cache has for a disk.
+
+    The entry is only returned if the disk is the same one and neither its partition tables nor the
+    kernel's view of its partitions have changed since it was stored. Checking the partitions on it
+    is up to the caller.
+
+    @param deviceNode the disk, e.g. "/dev/sda"
+    @param entry set to what the cache has
+    @return true if the cache has a valid entry for the disk
+*/
+bool ScanCache::lookup(const QString& deviceNode, DeviceEntry& entry)
+{
+    const QString id = identity(deviceNode);
+
+    if (id.isEmpty())
+        return false;
+
+    {
+        QMutexLocker locker(&m_Mutex);
+
+        if (!m_Enabled)
+            return false;
+
+        load();
+
+        auto it = m_Entries.constFind(id);
+        if (it == m_Entries.constEnd() || it->deviceNode != deviceNode)
+            return false;
+
+        entry = *it;
+    }
+
+    return !entry.tableDigest.isEmpty() && tableDigest(deviceNode, entry.logicalSectorSize) == entry.tableDigest;
+}
+
+/** Stores what a scan found on a disk.
+
+    Nothing is stored for disks the cache cannot tell apart from others and for disks with
+    partitions it cannot check cheaply.
+
+    @param d the disk just scanned
+*/
+void ScanCache::store(const DiskDevice& d)
+{
+    const QString id = identity(d.deviceNode());
+
+    if (id.isEmpty() || !isEnabled())
+        return;
+
+    DeviceEntry entry;
+    entry.identity = id;
+    entry.deviceNode = d.deviceNode();
+    entry.name = d.name();
+    entry.heads = d.heads();
+    entry.sectorsPerTrack = d.sectorsPerTrack();
+    entry.cylinders = d.cylinders();
+    entry.logicalSectorSize = d.logicalSectorSize();
+    entry.physicalSectorSize = d.physicalSectorSize();
+    entry.optimalIOSize = d.optimalIOSize();
+    entry.tableDigest = tableDigest(d.deviceNode(), d.logicalSectorSize());
+
+    bool cacheable = !entry.tableDigest.isEmpty() && d.partitionTable() != nullptr;
+
+    if (cacheable) {
+        const PartitionTable* table = d.partitionTable();
+
+        // the backend decides whether a table is sector based after reading it
+        entry.tableType = table->type() == PartitionTable::msdos_sectorbased ? PartitionTable::msdos : table->type();
+        entry.firstUsable = table->firstUsable();
+        entry.lastUsable = table->lastUsable();
+        entry.maxPrimaries = table->maxPrimaries();
+
+        for (const Partition* p : table->children()) {
+            if (p->roles().has(PartitionRole::Unallocated))
+                continue;
+
+            if (p->roles().has(PartitionRole::Extended) || p->roles().has(PartitionRole::Luks) || p->fileSystem().type() == FileSystem::Lvm2_PV) {
+                cacheable = false;
+                break;
+            }
+
+            PartitionEntry pe;
+            pe.roles = static_cast<qint32>(p->roles().roles());
+            pe.fileSystemType = p->fileSystem().type();
+            pe.firstSector = p->firstSector();
+            pe.lastSector = p->lastSector();
+            pe.deviceNode = p->deviceNode();
+            pe.availableFlags = static_cast<qint32>(p->availableFlags());
+            pe.activeFlags = static_cast<qint32>(p->activeFlags());
+
+            // storing must not read what scanning left to be read when it is first asked for
+            const FileSystem& fs = p->fileSystem();
+            pe.pending = static_cast<qint32>(fs.pending());
+            pe.sectorsUsed = (fs.pending() & FileSystem::LazyUsed) ? -1 : fs.sectorsUsed();
+            pe.label = (fs.pending() & FileSystem::LazyLabel) ? QString() : fs.label();
+            pe.uuid = (fs.pending() & FileSystem::LazyUUID) ? QString() : fs.uuid();
+            pe.superblockDigest = superblockDigest(p->deviceNode());
+
+            entry.partitions.append(pe);
+        }
+    }
+
+    QMutexLocker locker(&m_Mutex);
+
+    load();
+
+    if (cacheable)
+        m_Entries.insert(id, entry);
+    else
+        m_Entries.remove(id);
+
+    m_Modified = true;
+}
+
+/** Forgets what the cache has for a disk.
+    @param deviceNode the disk, e.g. "/dev/sda"
+*/
+void ScanCache::invalidate(const QString& deviceNode)
+{
+    QMutexLocker locker(&m_Mutex);
+
+    load();
+
+    for (auto it = m_Entries.begin(); it != m_Entries.end(); )
+        if (it->deviceNode == deviceNode) {
+            it = m_Entries.erase(it);
+            m_Modified = true;
+        } else
+            ++it;
+}
+
+/** Writes the cache to fileName() if anything was stored since it was read.
+    @return true on success or if there was nothing to write
+*/
+bool ScanCache::save()
+{
+    QMutexLocker locker(&m_Mutex);
+
+    if (!m_Enabled || !m_Modified)
+        return true;
+
+    const QString name = fileName();
+
+    if (!QDir().mkpath(QFileInfo(name).absolutePath()))
+        return false;
+
+    QSaveFile file(name);
+
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    stream.writeRawData(cacheMagic, 16);
+    stream << cacheVersion << m_Entries.values();
+
+    if (stream.status() != QDataStream::Ok || !file.commit()) {
+        Log(Log::warning) << xi18nc("@info:status", "Could not write the scan cache <filename>%1</filename>.", name);
+        return false;
+    }
+
+    m_Modified = false;
+
+    return true;
+}
+
+bool ScanCache::isEnabled() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_Enabled;
+}
+
+/** @param enabled true to use and write the cache; it is off by default */
+void ScanCache::setEnabled(bool enabled)
+{
+    QMutexLocker locker(&m_Mutex);
+    m_Enabled = enabled;
+}
+
+/** @return the name of the file the cache is kept in */
+QString ScanCache::fileName()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/kpmcore/scancache");
+}
+
+/** @return a digest of the start of a partition, where file systems keep their superblocks */
+QByteArray ScanCache::superblockDigest(const QString& partitionNode)
+{
+    return readDigest(partitionNode, 0, superblockBytes);
+}
+
+/** Reads the cache file, once. m_Mutex must be locked. */
+void ScanCache::load()
+{
+    if (m_Loaded)
+        return;
+
+    m_Loaded = true;
+
+    QFile file(fileName());
+
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    QDataStream stream(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    char magic[16];
+    quint32 version = 0;
+    QList<DeviceEntry> entries;
+
+    if (stream.readRawData(magic, 16) != 16 || memcmp(magic, cacheMagic, 16) != 0)
+        return;
+
+    stream >> version;
+
+    // a cache written by another version is simply thrown away and written again
+    if (version != cacheVersion)
+        return;
+
+    stream >> entries;
+
+    if (stream.status() != QDataStream::Ok)
+        return;
+
+    for (const DeviceEntry& e : entries)
+        m_Entries.insert(e.identity, e);
+}
+
+/** @return what identifies a disk no matter which device node it has, or an empty string if it has nothing that does */
+QString ScanCache::identity(const QString& deviceNode)
+{
+    BlockDeviceInfo info;
+
+    if (!BlockDeviceInfo::read(deviceNode, info))
+        return QString();
+
+    QString id;
+
+    for (const QString& path : { QStringLiteral("/wwid"), QStringLiteral("/device/wwid") }) {
+        QFile f(QStringLiteral("/sys/class/block/") + info.name + path);
+        if (f.open(QIODevice::ReadOnly) && !(id = QString::fromLocal8Bit(f.readLine()).trimmed()).isEmpty())
+            break;
+    }
+
+    if (id.isEmpty() && !info.serial.isEmpty())
+        id = info.model + QLatin1Char(' ') + info.serial;
+
+    if (id.isEmpty())
+        return QString();
+
+    return id + QLatin1Char(' ') + QString::number(info.size);
+}
+
+/** Computes a digest of everything that tells whether the partitions on a disk changed.
+
+    This is the start of the disk with an MBR or the primary GPT, both GPT headers and the
+    partition entries each of them points to, and where the kernel thinks each partition starts
+    and ends.
+
+    @return the digest or an empty QByteArray if the disk cannot be read
+*/
+QByteArray ScanCache::tableDigest(const QString& deviceNode, qint32 sectorSize)
+{
+    BlockDeviceInfo info;
+
+    if (sectorSize <= 0 || !BlockDeviceInfo::read(deviceNode, info))
+        return QByteArray();
+
+    QFile disk(deviceNode);
+
+    if (!disk.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+        return QByteArray();
+
+    const QByteArray start = disk.read(static_cast<qint64>(tableSectors) * sectorSize);
+
+    if (start.isEmpty())
+        return QByteArray();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(start);
+
+    addGptDigest(hash, disk, 1, sectorSize);
+    addGptDigest(hash, disk, info.size / sectorSize - 1, sectorSize);
+
+    const QString sysfs = QStringLiteral("/sys/class/block/") + info.name + QLatin1Char('/');
+    const QStringList partitions = QDir(sysfs).entryList({ info.name + QLatin1Char('*') }, QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+
+    for (const QString& partition : partitions) {
+        for (const QString& attribute : { QStringLiteral("/start"), QStringLiteral("/size") }) {
+            QFile f(sysfs + partition + attribute);
+            if (f.open(QIODevice::ReadOnly)) {
+                hash.addData(partition.toUtf8());
+                hash.addData(f.readAll());
+            }
+        }
+    }
+
+    return hash.result();
+}
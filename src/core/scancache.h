@@ -0,0 +1,123 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(SCANCACHE__H)
+
+#define SCANCACHE__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QtGlobal>
+
+class DiskDevice;
+
+/** Remembers what scanning found on each disk across runs.
+
+    Scanning a disk forks tools to find out the used capacity, label and UUID of each file system
+    on it. That takes long on hosts with many disks, although most of them have not changed since
+    the last run. This cache keeps what a scan found for each disk in a file in the user's cache
+    directory ($XDG_CACHE_HOME/kpmcore/scancache), so the next scan can take it from there.
+
+    The cache is off unless it is turned on with setEnabled().
+
+    A disk is identified by its WWN or serial number and its size. What the cache has for it is
+    only used if the start of the disk, both GPT headers with their partition entries and the
+    kernel's view of the partitions are still the same, which costs a few small reads. The backend checks the start of each unmounted partition in the same way, so a file
+    system that was changed on another computer is scanned again. Disks with LUKS, LVM physical
+    volumes or extended partitions on them are not cached, because there is more to them than the
+    start of the disk and of each partition shows.
+
+    The cache never replaces a scan of a disk the kernel reported a change for: DeviceScanner
+    invalidates the disk before scanning it again.
+*/
+class LIBKPMCORE_EXPORT ScanCache
+{
+    Q_DISABLE_COPY(ScanCache)
+
+private:
+    ScanCache();
+
+public:
+    /** What the cache has about a Partition */
+    struct PartitionEntry {
+        qint32 roles;
+        qint32 fileSystemType;
+        qint64 firstSector;
+        qint64 lastSector;
+        QString deviceNode;
+        qint32 availableFlags;
+        qint32 activeFlags;
+        qint64 sectorsUsed;
+        QString label;
+        QString uuid;
+        qint32 pending;
+        QByteArray superblockDigest;
+    };
+
+    /** What the cache has about a DiskDevice and its PartitionTable */
+    struct DeviceEntry {
+        QString identity;
+        QString deviceNode;
+        QString name;
+        qint32 heads;
+        qint32 sectorsPerTrack;
+        qint32 cylinders;
+        qint32 logicalSectorSize;
+        qint32 physicalSectorSize;
+        qint64 optimalIOSize;
+        qint32 tableType;
+        qint64 firstUsable;
+        qint64 lastUsable;
+        qint32 maxPrimaries;
+        QByteArray tableDigest;
+        QList<PartitionEntry> partitions;
+    };
+
+public:
+    static ScanCache* self();
+
+    bool lookup(const QString& deviceNode, DeviceEntry& entry);
+    void store(const DiskDevice& d);
+    void invalidate(const QString& deviceNode);
+    bool save();
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    static QString fileName();
+    static QByteArray superblockDigest(const QString& partitionNode);
+
+private:
+    void load();
+
+    static QString identity(const QString& deviceNode);
+    static QByteArray tableDigest(const QString& deviceNode, qint32 sectorSize);
+
+private:
+    mutable QMutex m_Mutex;
+    QHash<QString, DeviceEntry> m_Entries;
+    bool m_Loaded;
+    bool m_Modified;
+    bool m_Enabled;
+};
+
+#endif
@@ -0,0 +1,147 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/smartcollector.h"
+#include "core/smartstatus.h"
+
+#include <QMutexLocker>
+#include <QRunnable>
+
+/** Collects the SMART status of one device on SmartCollector's thread pool. */
+class SmartCollectTask : public QRunnable
+{
+public:
+    SmartCollectTask(SmartCollector& collector, const QString& devicePath) :
+        m_Collector(collector),
+        m_DevicePath(devicePath)
+    {
+    }
+
+    void run() override {
+        m_Collector.collect(m_DevicePath);
+    }
+
+private:
+    SmartCollector& m_Collector;
+    const QString m_DevicePath;
+};
+
+SmartCollector::SmartCollector() :
+    QObject(),
+    m_Mutex(),
+    m_Entries(),
+    m_TimeToLive(300),
+    m_Pool()
+{
+    // a few disks at a time; more would only make them compete for the same controllers
+    m_Pool.setMaxThreadCount(4);
+}
+
+SmartCollector* SmartCollector::self()
+{
+    static SmartCollector* p = new SmartCollector();
+
+    return p;
+}
+
+/** Requests SMART status to be collected for a device.
+
+    Returns at once. If the cached status is still fresh or a collection is already running,
+    nothing is done.
+
+    @param devicePath the device to collect SMART status for, e.g. "/dev/sda"
+*/
+void SmartCollector::request(const QString& devicePath)
+{
+    QMutexLocker locker(&m_Mutex);
+
+    Entry& e = m_Entries[devicePath];
+
+    if (e.pending || (e.status && !e.age.hasExpired(static_cast<qint64>(m_TimeToLive) * 1000)))
+        return;
+
+    e.pending = true;
+    m_Pool.start(new SmartCollectTask(*this, devicePath));
+}
+
+/** Gets the last collected SMART status for a device.
+
+    If that status is older than timeToLive(), a new collection is requested.
+
+    @param devicePath the device to get the status for
+    @param status set to the last collected status, if there is one
+    @return true if a status had been collected
+*/
+bool SmartCollector::status(const QString& devicePath, SmartStatus& status)
+{
+    QSharedPointer<const SmartStatus> collected;
+
+    {
+        QMutexLocker locker(&m_Mutex);
+        collected = m_Entries.value(devicePath).status;
+    }
+
+    request(devicePath);
+
+    if (!collected)
+        return false;
+
+    status = *collected;
+    return true;
+}
+
+/** Drops the cached status of a device, so the next request collects it again.
+    @param devicePath the device to drop the status for
+*/
+void SmartCollector::invalidate(const QString& devicePath)
+{
+    QMutexLocker locker(&m_Mutex);
+
+    if (m_Entries.contains(devicePath) && !m_Entries[devicePath].pending)
+        m_Entries.remove(devicePath);
+}
+
+/** @return the number of seconds collected SMART status is kept */
+qint32 SmartCollector::timeToLive() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_TimeToLive;
+}
+
+/** @param seconds the number of seconds collected SMART status is kept */
+void SmartCollector::setTimeToLive(qint32 seconds)
+{
+    QMutexLocker locker(&m_Mutex);
+    m_TimeToLive = seconds;
+}
+
+void SmartCollector::collect(const QString& devicePath)
+{
+    QSharedPointer<SmartStatus> status(new SmartStatus(devicePath));
+    status->update();
+
+    {
+        QMutexLocker locker(&m_Mutex);
+
+        Entry& e = m_Entries[devicePath];
+        e.status = status;
+        e.age.start();
+        e.pending = false;
+    }
+
+    emit smartStatusReady(devicePath);
+}
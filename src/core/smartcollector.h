@@ -0,0 +1,88 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(SMARTCOLLECTOR__H)
+
+#define SMARTCOLLECTOR__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QSharedPointer>
+#include <QString>
+#include <QThreadPool>
+#include <QtGlobal>
+
+class SmartStatus;
+
+/** Collects SMART status in the background and keeps it for a while.
+
+    Reading SMART data through libatasmart can take hundreds of milliseconds per disk and stalls
+    on drives that first have to spin up, so it is never done while scanning. Instead, a
+    collection is requested for a device and done on a small thread pool; smartStatusReady() is
+    emitted when it is done. The status is then kept for timeToLive() seconds, during which further
+    requests for the device are answered from the cache.
+
+    Device::refreshSmartStatus() takes the status over from this class; DeviceScanner calls it when
+    smartStatusReady() is emitted. A Device's SmartStatus is invalid until then.
+*/
+class LIBKPMCORE_EXPORT SmartCollector : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(SmartCollector)
+
+private:
+    SmartCollector();
+
+public:
+    static SmartCollector* self();
+
+    void request(const QString& devicePath);
+    bool status(const QString& devicePath, SmartStatus& status);
+    void invalidate(const QString& devicePath);
+
+    qint32 timeToLive() const;
+    void setTimeToLive(qint32 seconds);
+
+Q_SIGNALS:
+    /** Emitted, possibly from a worker thread, when SMART status for a device has been collected.
+        @param devicePath the device the status was collected for
+    */
+    void smartStatusReady(const QString& devicePath);
+
+private:
+    void collect(const QString& devicePath);
+
+private:
+    struct Entry {
+        QSharedPointer<const SmartStatus> status;
+        QElapsedTimer age;
+        bool pending = false;
+    };
+
+    friend class SmartCollectTask;
+
+    mutable QMutex m_Mutex;
+    QHash<QString, Entry> m_Entries;
+    qint32 m_TimeToLive;
+    QThreadPool m_Pool;
+};
+
+#endif
@@ -41,9 +41,15 @@ SmartStatus::SmartStatus(const QString& device_path) :
     m_PowerCycles(-99),
     m_PoweredOn(-99)
 {
-    update();
 }
 
+/** Reads the SMART status from the device.
+
+    This talks to the drive through libatasmart and may take a while or wait for the drive to spin
+    up, so it is not done when a SmartStatus is created. Use SmartCollector to have it done in the
+    background.
+*/
+
 void SmartStatus::update()
 {
     SkDisk* skDisk = nullptr;
@@ -58,7 +58,7 @@ public:
     typedef QList<SmartAttribute> Attributes;
 
 public:
-    SmartStatus(const QString& device_path);
+    explicit SmartStatus(const QString& device_path);
 
 public:
     void update();
@@ -145,7 +145,7 @@ protected:
     static void callback(SkDisk* skDisk, const SkSmartAttributeParsedData* a, void* user_data);
 
 private:
-    const QString m_DevicePath;
+    QString m_DevicePath;
     bool m_InitSuccess;
     bool m_Status;
     QString m_ModelName;
@@ -0,0 +1,139 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/ueventmonitor.h"
+
+#include <QList>
+#include <QSocketNotifier>
+
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/** Parses a uevent message.
+    @param message the message as received from the kernel
+    @param event the UEvent to fill in
+    @return true if the message is a uevent
+*/
+bool UEvent::parse(const QByteArray& message, UEvent& event)
+{
+    const QList<QByteArray> fields = message.split('\0');
+
+    if (fields.isEmpty())
+        return false;
+
+    const qint32 at = fields.first().indexOf('@');
+
+    // messages from udev start with "libudev" and a binary header, not with ACTION@DEVPATH
+    if (at <= 0)
+        return false;
+
+    event.action = QString::fromUtf8(fields.first().left(at));
+    event.devPath = QString::fromUtf8(fields.first().mid(at + 1));
+    event.properties.clear();
+
+    for (qint32 i = 1; i < fields.size(); i++) {
+        const qint32 eq = fields[i].indexOf('=');
+
+        if (eq > 0)
+            event.properties.insert(QString::fromUtf8(fields[i].left(eq)), QString::fromUtf8(fields[i].mid(eq + 1)));
+    }
+
+    return true;
+}
+
+UEventMonitor::UEventMonitor(QObject* parent) :
+    QObject(parent),
+    m_Socket(-1),
+    m_Notifier(nullptr)
+{
+}
+
+UEventMonitor::~UEventMonitor()
+{
+    stop();
+}
+
+/** Starts listening to kernel uevents.
+    @return true on success
+*/
+bool UEventMonitor::start()
+{
+    if (isActive())
+        return true;
+
+    m_Socket = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+
+    if (m_Socket < 0)
+        return false;
+
+    struct sockaddr_nl addr = {};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_pid = 0;
+    addr.nl_groups = 1; // the kernel's multicast group
+
+    if (bind(m_Socket, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(m_Socket);
+        m_Socket = -1;
+        return false;
+    }
+
+    m_Notifier = new QSocketNotifier(m_Socket, QSocketNotifier::Read, this);
+    connect(m_Notifier, &QSocketNotifier::activated, this, &UEventMonitor::onReadyRead);
+
+    return true;
+}
+
+/** Stops listening to kernel uevents. */
+void UEventMonitor::stop()
+{
+    delete m_Notifier;
+    m_Notifier = nullptr;
+
+    if (m_Socket >= 0)
+        close(m_Socket);
+
+    m_Socket = -1;
+}
+
+/** Handles a uevent message as if it had been received from the kernel.
+    @param message the message, KEY=VALUE pairs separated by null bytes after the ACTION@DEVPATH header
+*/
+void UEventMonitor::feed(const QByteArray& message)
+{
+    UEvent event;
+
+    if (UEvent::parse(message, event) && event.subsystem() == QStringLiteral("block"))
+        emit blockDeviceEvent(event);
+}
+
+void UEventMonitor::onReadyRead()
+{
+    char buffer[8192];
+    struct sockaddr_nl sender = {};
+    socklen_t senderSize = sizeof(sender);
+    ssize_t size;
+
+    while ((size = recvfrom(m_Socket, buffer, sizeof(buffer), 0, reinterpret_cast<struct sockaddr*>(&sender), &senderSize)) > 0) {
+        // only trust messages the kernel sent; that includes the "change" udev asks the kernel for
+        // when a disk opened for writing is closed, which DeviceScanner has to filter out
+        if (sender.nl_pid == 0)
+            feed(QByteArray(buffer, size));
+
+        senderSize = sizeof(sender);
+    }
+}
@@ -0,0 +1,94 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(UEVENTMONITOR__H)
+
+#define UEVENTMONITOR__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QtGlobal>
+
+class QSocketNotifier;
+
+/** A kernel uevent, as sent on the NETLINK_KOBJECT_UEVENT socket.
+
+    A uevent is a header "ACTION@DEVPATH" followed by KEY=VALUE pairs, all terminated by a
+    null byte.
+*/
+struct LIBKPMCORE_EXPORT UEvent
+{
+    QString action;                         /**< "add", "remove", "change", ... */
+    QString devPath;                        /**< the path below /sys, e.g. "/devices/.../block/sda/sda1" */
+    QHash<QString, QString> properties;     /**< all KEY=VALUE pairs */
+
+    QString subsystem() const {
+        return properties.value(QStringLiteral("SUBSYSTEM"));    /**< @return the subsystem, e.g. "block" */
+    }
+    QString devType() const {
+        return properties.value(QStringLiteral("DEVTYPE"));    /**< @return the device type, e.g. "disk" or "partition" */
+    }
+    QString devName() const {
+        return properties.value(QStringLiteral("DEVNAME"));    /**< @return the device name below /dev, e.g. "sda1" */
+    }
+
+    static bool parse(const QByteArray& message, UEvent& event);
+};
+
+/** Listens to kernel uevents for block devices.
+
+    The monitor reads uevents from a NETLINK_KOBJECT_UEVENT socket and emits blockDeviceEvent()
+    for each one about a block device. Recorded uevents can be fed in with feed(), e.g. to replay
+    a sequence of hot plug events.
+*/
+class LIBKPMCORE_EXPORT UEventMonitor : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(UEventMonitor)
+
+public:
+    explicit UEventMonitor(QObject* parent = nullptr);
+    ~UEventMonitor();
+
+public:
+    bool start();
+    void stop();
+    bool isActive() const {
+        return m_Socket >= 0;    /**< @return true if the monitor is listening to the kernel */
+    }
+
+    void feed(const QByteArray& message);
+
+Q_SIGNALS:
+    /** Emitted for each uevent about a block device.
+        @param event the uevent
+    */
+    void blockDeviceEvent(const UEvent& event);
+
+private Q_SLOTS:
+    void onReadyRead();
+
+private:
+    int m_Socket;
+    QSocketNotifier* m_Notifier;
+};
+
+#endif
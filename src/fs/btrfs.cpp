@@ -17,6 +17,7 @@
  *************************************************************************/
 
 #include "fs/btrfs.h"
+#include "fs/superblock.h"
 
 #include "util/externalcommand.h"
 #include "util/capacity.h"
@@ -53,7 +54,7 @@ void btrfs::init()
     m_Create = findExternal(QStringLiteral("mkfs.btrfs")) ? cmdSupportFileSystem : cmdSupportNone;
     m_Check = findExternal(QStringLiteral("btrfsck"), QStringList(), 1) ? cmdSupportFileSystem : cmdSupportNone;
     m_Grow = (m_Check != cmdSupportNone && findExternal(QStringLiteral("btrfs"))) ? cmdSupportFileSystem : cmdSupportNone;
-    m_GetUsed = findExternal(QStringLiteral("btrfs")) ? cmdSupportFileSystem : cmdSupportNone;
+    m_GetUsed = cmdSupportFileSystem;
     m_Shrink = (m_Grow != cmdSupportNone && m_GetUsed != cmdSupportNone) ? cmdSupportFileSystem : cmdSupportNone;
 
     m_SetLabel = findExternal(QStringLiteral("btrfs")) ? cmdSupportFileSystem : cmdSupportNone;
@@ -106,6 +107,11 @@ qint64 btrfs::maxLabelLength() const
 
 qint64 btrfs::readUsedCapacity(const QString& deviceNode) const
 {
+    const Superblock superblock = Superblock::read(deviceNode, type());
+
+    if (superblock.hasUsage())
+        return superblock.usedBytes();
+
     ExternalCommand cmd(QStringLiteral("btrfs"),
                         { QStringLiteral("filesystem"), QStringLiteral("show"), QStringLiteral("--raw"), deviceNode });
 
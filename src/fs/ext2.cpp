@@ -17,12 +17,17 @@
  *************************************************************************/
 
 #include "fs/ext2.h"
+#include "fs/superblock.h"
+#include "fs/usedblocksmap.h"
 
 #include "util/externalcommand.h"
 #include "util/capacity.h"
+#include "util/progressparser.h"
 
+#include <QFile>
 #include <QRegularExpression>
 #include <QString>
+#include <QtEndian>
 
 namespace FS
 {
@@ -46,7 +51,7 @@ ext2::ext2(qint64 firstsector, qint64 lastsector, qint64 sectorsused, const QStr
 
 void ext2::init()
 {
-    m_GetUsed = findExternal(QStringLiteral("dumpe2fs")) ? cmdSupportFileSystem : cmdSupportNone;
+    m_GetUsed = cmdSupportFileSystem;
     m_GetLabel = cmdSupportCore;
     m_SetLabel = findExternal(QStringLiteral("e2label")) ? cmdSupportFileSystem : cmdSupportNone;
     m_Create = findExternal(QStringLiteral("mkfs.ext2")) ? cmdSupportFileSystem : cmdSupportNone;
@@ -94,6 +99,11 @@ qint64 ext2::maxLabelLength() const
 
 qint64 ext2::readUsedCapacity(const QString& deviceNode) const
 {
+    const Superblock superblock = Superblock::read(deviceNode, type());
+
+    if (superblock.hasUsage())
+        return superblock.usedBytes();
+
     ExternalCommand cmd(QStringLiteral("dumpe2fs"), { QStringLiteral("-h"), deviceNode });
 
     if (cmd.run()) {
@@ -125,9 +135,107 @@ qint64 ext2::readUsedCapacity(const QString& deviceNode) const
     return -1;
 }
 
+/** Reads the used blocks from the block bitmaps of all block groups.
+
+    Block groups whose bitmap was never initialized (BLOCK_UNINIT) only contain metadata, which is
+    marked as used from the group descriptors instead. Nothing is read if the journal needs to be
+    recovered or the file system was not cleanly unmounted, since the bitmaps are not to be trusted then.
+*/
+bool ext2::readUsedBlocks(const QString& deviceNode, UsedBlocksMap& usedBlocks, qint64 offset) const
+{
+    QFile device(deviceNode);
+    if (!device.open(QIODevice::ReadOnly))
+        return false;
+
+    const QByteArray sb = UsedBlocksMap::readBytes(device, offset + 1024, 1024);
+    if (sb.isEmpty())
+        return false;
+
+    const uchar* s = reinterpret_cast<const uchar*>(sb.constData());
+
+    if (qFromLittleEndian<quint16>(s + 0x38) != 0xef53)
+        return false;
+
+    const quint32 incompat = qFromLittleEndian<quint32>(s + 0x60);
+    const quint32 roCompat = qFromLittleEndian<quint32>(s + 0x64);
+
+    // with the journal still to be replayed or the file system not cleanly unmounted, blocks in use may be free in the bitmaps
+    if ((incompat & 0x04) || !(qFromLittleEndian<quint16>(s + 0x3a) & 0x01))
+        return false;
+
+    // meta_bg scatters the group descriptors, bigalloc makes bitmap bits stand for clusters: not handled
+    if ((incompat & 0x10) || (roCompat & 0x200))
+        return false;
+
+    const bool is64Bit = incompat & 0x80;
+    const bool groupFlagsValid = roCompat & (0x10 | 0x400); // gdt_csum or metadata_csum
+    const qint64 blockSize = Q_INT64_C(1024) << qFromLittleEndian<quint32>(s + 0x18);
+    const qint64 blocksCount = qFromLittleEndian<quint32>(s + 0x04) | (is64Bit ? static_cast<qint64>(qFromLittleEndian<quint32>(s + 0x150)) << 32 : 0);
+    const qint64 firstDataBlock = qFromLittleEndian<quint32>(s + 0x14);
+    const qint64 blocksPerGroup = qFromLittleEndian<quint32>(s + 0x20);
+    const qint64 inodesPerGroup = qFromLittleEndian<quint32>(s + 0x28);
+    const qint64 inodeSize = qFromLittleEndian<quint32>(s + 0x4c) > 0 ? qFromLittleEndian<quint16>(s + 0x58) : 128;
+    const qint64 descSize = is64Bit ? qMax<qint64>(qFromLittleEndian<quint16>(s + 0xfe), 32) : 32;
+    const qint64 reservedGdtBlocks = qFromLittleEndian<quint16>(s + 0xce);
+
+    if (blockSize > 65536 || blocksPerGroup == 0 || blocksCount <= firstDataBlock || blocksCount * blockSize > length() * usedBlocks.sectorSize())
+        return false;
+
+    const qint64 groupCount = (blocksCount - firstDataBlock + blocksPerGroup - 1) / blocksPerGroup;
+    const qint64 gdtBlocks = (groupCount * descSize + blockSize - 1) / blockSize;
+    const qint64 inodeTableBlocks = (inodesPerGroup * inodeSize + blockSize - 1) / blockSize;
+
+    const QByteArray gdt = UsedBlocksMap::readBytes(device, offset + (firstDataBlock + 1) * blockSize, gdtBlocks * blockSize);
+    if (gdt.isEmpty())
+        return false;
+
+    for (qint64 group = 0; group < groupCount; group++) {
+        const uchar* d = reinterpret_cast<const uchar*>(gdt.constData()) + group * descSize;
+        const qint64 groupStart = firstDataBlock + group * blocksPerGroup;
+        const qint64 groupBlocks = qMin(blocksPerGroup, blocksCount - groupStart);
+
+        const auto location = [d, descSize](int lo, int hi) {
+            return qFromLittleEndian<quint32>(d + lo) | (descSize >= 64 ? static_cast<qint64>(qFromLittleEndian<quint32>(d + hi)) << 32 : 0);
+        };
+
+        const qint64 blockBitmap = location(0x00, 0x20);
+        const qint64 inodeBitmap = location(0x04, 0x24);
+        const qint64 inodeTable = location(0x08, 0x28);
+
+        usedBlocks.addUsedBytes(blockBitmap * blockSize, blockSize);
+        usedBlocks.addUsedBytes(inodeBitmap * blockSize, blockSize);
+        usedBlocks.addUsedBytes(inodeTable * blockSize, inodeTableBlocks * blockSize);
+
+        if (groupFlagsValid && (qFromLittleEndian<quint16>(d + 0x12) & 0x02)) {
+            // BLOCK_UNINIT: at most a superblock and group descriptor backup at the start of the group
+            usedBlocks.addUsedBytes(groupStart * blockSize, (1 + gdtBlocks + reservedGdtBlocks) * blockSize);
+            continue;
+        }
+
+        const QByteArray bitmap = UsedBlocksMap::readBytes(device, offset + blockBitmap * blockSize, blockSize);
+        if (bitmap.isEmpty())
+            return false;
+
+        usedBlocks.addBitmap(bitmap, groupBlocks, groupStart * blockSize, blockSize);
+    }
+
+    // the boot block, superblock and group descriptors are not always covered by a bitmap
+    usedBlocks.addUsedBytes(0, (firstDataBlock + 1 + gdtBlocks + reservedGdtBlocks) * blockSize);
+    usedBlocks.finish(length());
+
+    return true;
+}
+
 bool ext2::check(Report& report, const QString& deviceNode) const
 {
-    ExternalCommand cmd(report, QStringLiteral("e2fsck"), { QStringLiteral("-f"), QStringLiteral("-y"), QStringLiteral("-v"), deviceNode });
+    ExternalCommand cmd(report, QStringLiteral("e2fsck"), { QStringLiteral("-f"), QStringLiteral("-y"), QStringLiteral("-v"), QStringLiteral("-C"), QStringLiteral("1"), deviceNode });
+    const ProgressParser::ParseFunction parse = ProgressParser::e2fsck();
+    ProgressParser progress(report, parse);
+    cmd.setProgressParser(&progress);
+
+    // -C 1 writes a completion line for every block group and directory block; those are only progress
+    cmd.setLineHandler([parse] (const QString& line) { return parse(line) >= 0; });
+    cmd.setOutputLimit(64 * 1024);
     return cmd.run(-1) && (cmd.exitCode() == 0 || cmd.exitCode() == 1 || cmd.exitCode() == 2 || cmd.exitCode() == 256);
 }
 
@@ -141,7 +249,9 @@ bool ext2::resize(Report& report, const QString& deviceNode, qint64 length) cons
 {
     const QString len = QString::number(length / 512) + QStringLiteral("s");
 
-    ExternalCommand cmd(report, QStringLiteral("resize2fs"), { deviceNode, len });
+    ExternalCommand cmd(report, QStringLiteral("resize2fs"), { QStringLiteral("-p"), deviceNode, len });
+    ProgressParser progress(report, ProgressParser::resize2fs());
+    cmd.setProgressParser(&progress);
     return cmd.run(-1) && cmd.exitCode() == 0;
 }
 
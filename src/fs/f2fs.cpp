@@ -16,6 +16,7 @@
  *************************************************************************/
 
 #include "fs/f2fs.h"
+#include "fs/superblock.h"
 
 #include "util/externalcommand.h"
 #include "util/capacity.h"
@@ -59,7 +60,7 @@ void f2fs::init()
 //     m_UpdateUUID = findExternal(QStringLiteral("nilfs-tune")) ? cmdSupportFileSystem : cmdSupportNone;
 
 //     m_Grow = (m_Check != cmdSupportNone && findExternal(QStringLiteral("nilfs-resize"))) ? cmdSupportFileSystem : cmdSupportNone;
-//     m_GetUsed = findExternal(QStringLiteral("nilfs-tune")) ? cmdSupportFileSystem : cmdSupportNone;
+    m_GetUsed = cmdSupportFileSystem;
 //     m_Shrink = (m_Grow != cmdSupportNone && m_GetUsed != cmdSupportNone) ? cmdSupportFileSystem : cmdSupportNone;
 
     m_Copy = (m_Check != cmdSupportNone) ? cmdSupportCore : cmdSupportNone;
@@ -73,7 +74,7 @@ void f2fs::init()
 bool f2fs::supportToolFound() const
 {
     return
-//         m_GetUsed != cmdSupportNone &&
+        m_GetUsed != cmdSupportNone &&
         m_GetLabel != cmdSupportNone &&
 //         m_SetLabel != cmdSupportNone &&
         m_Create != cmdSupportNone &&
@@ -107,6 +108,13 @@ qint64 f2fs::maxLabelLength() const
     return 80;
 }
 
+qint64 f2fs::readUsedCapacity(const QString& deviceNode) const
+{
+    const Superblock superblock = Superblock::read(deviceNode, type());
+
+    return superblock.hasUsage() ? superblock.usedBytes() : -1;
+}
+
 bool f2fs::check(Report& report, const QString& deviceNode) const
 {
     ExternalCommand cmd(report, QStringLiteral("fsck.f2fs"), { deviceNode });
@@ -17,6 +17,8 @@
  *************************************************************************/
 
 #include "fs/fat16.h"
+#include "fs/superblock.h"
+#include "fs/usedblocksmap.h"
 
 #include "util/externalcommand.h"
 #include "util/capacity.h"
@@ -24,9 +26,11 @@
 
 #include <KLocalizedString>
 
+#include <QFile>
 #include <QRegularExpression>
 #include <QString>
 #include <QStringList>
+#include <QtEndian>
 
 #include <ctime>
 
@@ -52,7 +56,8 @@ fat16::fat16(qint64 firstsector, qint64 lastsector, qint64 sectorsused, const QS
 
 void fat16::init()
 {
-    m_Create = m_GetUsed = m_Check = findExternal(QStringLiteral("mkfs.fat"), {}, 1) ? cmdSupportFileSystem : cmdSupportNone;
+    m_Create = m_Check = findExternal(QStringLiteral("mkfs.fat"), {}, 1) ? cmdSupportFileSystem : cmdSupportNone;
+    m_GetUsed = cmdSupportFileSystem;
     m_GetLabel = cmdSupportCore;
     m_SetLabel = findExternal(QStringLiteral("fatlabel")) ? cmdSupportFileSystem : cmdSupportNone;
     m_Move = cmdSupportCore;
@@ -103,6 +108,11 @@ qint64 fat16::maxLabelLength() const
 
 qint64 fat16::readUsedCapacity(const QString& deviceNode) const
 {
+    const Superblock superblock = Superblock::read(deviceNode, type());
+
+    if (superblock.hasUsage())
+        return superblock.usedBytes();
+
     ExternalCommand cmd(QStringLiteral("fsck.fat"), { QStringLiteral("-n"), QStringLiteral("-v"), deviceNode });
 
     // Exit code 1 is returned when FAT dirty bit is set
@@ -129,6 +139,86 @@ qint64 fat16::readUsedCapacity(const QString& deviceNode) const
     return -1;
 }
 
+/** Reads the used clusters from the first file allocation table.
+
+    Handles FAT12, FAT16 and FAT32, so fat32 uses this too. Everything in front of the data area,
+    i.e. reserved sectors, the FATs and the FAT12/16 root directory, always counts as used.
+*/
+bool fat16::readUsedBlocks(const QString& deviceNode, UsedBlocksMap& usedBlocks, qint64 offset) const
+{
+    QFile device(deviceNode);
+    if (!device.open(QIODevice::ReadOnly))
+        return false;
+
+    const QByteArray bs = UsedBlocksMap::readBytes(device, offset, 512);
+    if (bs.isEmpty())
+        return false;
+
+    const uchar* b = reinterpret_cast<const uchar*>(bs.constData());
+
+    const qint64 bytesPerSector = qFromLittleEndian<quint16>(b + 11);
+    const qint64 sectorsPerCluster = b[13];
+    const qint64 reservedSectors = qFromLittleEndian<quint16>(b + 14);
+    const qint64 numFats = b[16];
+    const qint64 rootEntries = qFromLittleEndian<quint16>(b + 17);
+    const qint64 totalSectors = qFromLittleEndian<quint16>(b + 19) ? qFromLittleEndian<quint16>(b + 19) : qFromLittleEndian<quint32>(b + 32);
+    const qint64 fatSize = qFromLittleEndian<quint16>(b + 22) ? qFromLittleEndian<quint16>(b + 22) : qFromLittleEndian<quint32>(b + 36);
+
+    if (bytesPerSector < 512 || bytesPerSector > 4096 || sectorsPerCluster == 0 || numFats == 0 || fatSize == 0)
+        return false;
+
+    const qint64 rootDirSectors = (rootEntries * 32 + bytesPerSector - 1) / bytesPerSector;
+    const qint64 firstDataSector = reservedSectors + numFats * fatSize + rootDirSectors;
+
+    if (totalSectors <= firstDataSector || totalSectors * bytesPerSector > length() * usedBlocks.sectorSize())
+        return false;
+
+    const qint64 clusters = (totalSectors - firstDataSector) / sectorsPerCluster;
+    const qint64 clusterSize = sectorsPerCluster * bytesPerSector;
+    const int entryBits = clusters < 4085 ? 12 : clusters < 65525 ? 16 : 32;
+
+    usedBlocks.addUsedBytes(0, firstDataSector * bytesPerSector);
+
+    // the FAT of a large FAT32 can be hundreds of MiB, so read it in chunks of whole entries
+    const qint64 chunkEntries = 256 * 1024;
+    const qint64 fatOffset = reservedSectors * bytesPerSector;
+
+    for (qint64 first = 0; first < clusters + 2; first += chunkEntries) {
+        const qint64 numEntries = qMin(chunkEntries, clusters + 2 - first);
+        const qint64 chunkOffset = first * entryBits / 8;
+        const QByteArray fat = UsedBlocksMap::readBytes(device, offset + fatOffset + chunkOffset, (numEntries * entryBits + 7) / 8 + 1);
+
+        if (fat.size() < (numEntries * entryBits + 7) / 8)
+            return false;
+
+        const uchar* f = reinterpret_cast<const uchar*>(fat.constData());
+
+        for (qint64 i = 0; i < numEntries; i++) {
+            const qint64 cluster = first + i;
+
+            // entries 0 and 1 are reserved and do not stand for clusters
+            if (cluster < 2)
+                continue;
+
+            quint32 entry;
+            if (entryBits == 12) {
+                const quint16 pair = qFromLittleEndian<quint16>(f + (cluster * 3 / 2) - chunkOffset);
+                entry = cluster % 2 ? pair >> 4 : pair & 0x0fff;
+            } else if (entryBits == 16)
+                entry = qFromLittleEndian<quint16>(f + i * 2);
+            else
+                entry = qFromLittleEndian<quint32>(f + i * 4) & 0x0fffffff;
+
+            if (entry != 0)
+                usedBlocks.addUsedBytes(firstDataSector * bytesPerSector + (cluster - 2) * clusterSize, clusterSize);
+        }
+    }
+
+    usedBlocks.finish(length());
+
+    return true;
+}
+
 bool fat16::writeLabel(Report& report, const QString& deviceNode, const QString& newLabel)
 {
     report.line() << xi18nc("@info:progress", "Setting label for partition <filename>%1</filename> to %2", deviceNode, newLabel);
@@ -140,6 +230,7 @@ bool fat16::writeLabel(Report& report, const QString& deviceNode, const QString&
 bool fat16::check(Report& report, const QString& deviceNode) const
 {
     ExternalCommand cmd(report, QStringLiteral("fsck.fat"), { QStringLiteral("-a"), QStringLiteral("-w"), QStringLiteral("-v"), deviceNode });
+    cmd.setOutputLimit(64 * 1024);
     return cmd.run(-1) && cmd.exitCode() == 0;
 }
 
@@ -18,21 +18,28 @@
  *************************************************************************/
 
 #include "fs/filesystem.h"
+#include "fs/filesystemfactory.h"
 #include "fs/lvm2_pv.h"
 
 #include "backend/corebackend.h"
 #include "backend/corebackendmanager.h"
 
+#include "core/mounttable.h"
+
+#include "util/blkidprobe.h"
 #include "util/externalcommand.h"
 #include "util/capacity.h"
 #include "util/helpers.h"
 
-#include <blkid/blkid.h>
-
 #include <KMountPoint>
 #include <KLocalizedString>
 
 #include <QDebug>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QScopedPointer>
+#include <QThreadPool>
 
 const std::array< QColor, FileSystem::__lastType > FileSystem::defaultColorCode =
 {
@@ -80,8 +87,259 @@ FileSystem::FileSystem(qint64 firstsector, qint64 lastsector, qint64 sectorsused
     m_LastSector(lastsector),
     m_SectorsUsed(sectorsused),
     m_Label(l),
-    m_UUID()
+    m_UUID(),
+    m_Lazy(),
+    m_Pending(LazyNone)
+{
+}
+
+/** What a FileSystem reads only when it is first asked for.
+
+    This is shared between the FileSystem and the threads prefetching for it, so prefetching
+    never touches a FileSystem that may be gone by the time it runs. Reading is done with a
+    FileSystem of the same type that only this object knows about.
+
+    Its mutex also guards the attributes the FileSystem has not taken yet and taking them, so a
+    FileSystem can be asked for them from more than one thread.
+*/
+class FileSystem::LazyState
+{
+public:
+    LazyState(FileSystem* reader, const QString& deviceNode, qint64 sectorSize, bool roundUp) :
+        m_Mutex(),
+        m_Reader(reader),
+        m_DeviceNode(deviceNode),
+        m_SectorSize(sectorSize),
+        m_RoundUp(roundUp),
+        m_Loaded(LazyNone),
+        m_SectorsUsed(-1),
+        m_Label(),
+        m_UUID()
+    {
+    }
+
+    QMutex& mutex() {
+        return m_Mutex;
+    }
+
+    void load(LazyAttributes attributes) {
+        QMutexLocker locker(&m_Mutex);
+        read(attributes);
+    }
+    void read(LazyAttributes attributes);
+
+    // the following need m_Mutex to be locked
+    void reset(LazyAttributes attributes) {
+        m_Loaded &= ~attributes;
+    }
+
+    qint64 sectorsUsed() const {
+        return m_SectorsUsed;
+    }
+    const QString& label() const {
+        return m_Label;
+    }
+    const QString& uuid() const {
+        return m_UUID;
+    }
+
+private:
+    QMutex m_Mutex;
+    QScopedPointer<FileSystem> m_Reader;
+    const QString m_DeviceNode;
+    const qint64 m_SectorSize;
+    const bool m_RoundUp;
+    LazyAttributes m_Loaded;
+    qint64 m_SectorsUsed;
+    QString m_Label;
+    QString m_UUID;
+};
+
+/** Reads the given attributes unless they have been read already. m_Mutex must be locked.
+
+    The lock is held while reading, so an attribute that is being prefetched is not read a second
+    time by a FileSystem asking for it at the same moment; that one waits instead.
+
+    @param attributes the attributes to read
+*/
+void FileSystem::LazyState::read(LazyAttributes attributes)
+{
+    const LazyAttributes missing = attributes & ~m_Loaded;
+
+    if (missing & LazyUsed) {
+        const qint64 bytes = m_Reader->readUsedCapacity(m_DeviceNode);
+
+        if (bytes < 0 || m_SectorSize <= 0)
+            m_SectorsUsed = -1;
+        else
+            m_SectorsUsed = m_RoundUp ? (bytes + m_SectorSize - 1) / m_SectorSize : bytes / m_SectorSize;
+    }
+
+    if (missing & LazyLabel)
+        m_Label = m_Reader->readLabel(m_DeviceNode);
+
+    if (missing & LazyUUID)
+        m_UUID = m_Reader->readUUID(m_DeviceNode);
+
+    m_Loaded |= missing;
+}
+
+/** Reads the pending attributes of a FileSystem on a worker thread. */
+class PrefetchTask : public QRunnable
+{
+public:
+    PrefetchTask(const QSharedPointer<FileSystem::LazyState>& state, FileSystem::LazyAttributes attributes) :
+        m_State(state),
+        m_Attributes(attributes)
+    {
+    }
+
+    void run() override {
+        m_State->load(m_Attributes);
+    }
+
+private:
+    QSharedPointer<FileSystem::LazyState> m_State;
+    const FileSystem::LazyAttributes m_Attributes;
+};
+
+/** @return the thread pool prefetching runs on; it waits for the disks, not the CPU */
+static QThreadPool& prefetchPool()
+{
+    static QThreadPool* pool = createThreadPool(2, 8);
+
+    return *pool;
+}
+
+/** Leaves attributes that need tools to be read until they are first asked for.
+
+    Scanning calls this instead of reading the used capacity, label and UUID of each file system
+    right away, so that those only interested in the layout of a disk do not have to wait for
+    dumpe2fs, xfs_db, ntfsresize and friends. An attribute set explicitly is never read.
+
+    @param deviceNode the device node for the Partition the FileSystem is on
+    @param sectorSize the logical sector size of the Device, for converting the used capacity
+    @param attributes the attributes to read when they are first asked for
+    @param roundUp true to round the used capacity up to whole sectors instead of down
+*/
+void FileSystem::setLazy(const QString& deviceNode, qint64 sectorSize, LazyAttributes attributes, bool roundUp)
+{
+    if (attributes == LazyNone) {
+        m_Lazy.reset();
+        m_Pending = LazyNone;
+        return;
+    }
+
+    m_Lazy.reset(new LazyState(FileSystemFactory::create(type(), firstSector(), lastSector()), deviceNode, sectorSize, roundUp));
+    m_Pending = attributes;
+}
+
+/** Makes attributes be read again when they are next asked for.
+
+    Jobs that change what is on the FileSystem call this. Nothing happens for a FileSystem that
+    was not set up with setLazy().
+
+    @param attributes the attributes to read again
+*/
+void FileSystem::invalidate(LazyAttributes attributes)
+{
+    if (!m_Lazy)
+        return;
+
+    QMutexLocker locker(&m_Lazy->mutex());
+
+    m_Lazy->reset(attributes);
+    m_Pending |= attributes;
+}
+
+/** Starts reading the attributes that have not been read yet in the background.
+
+    Asking for one of them before that is done waits for it instead of reading it again.
+*/
+void FileSystem::prefetch() const
 {
+    const LazyAttributes attributes = pending();
+
+    if (attributes != LazyNone)
+        prefetchPool().start(new PrefetchTask(m_Lazy, attributes));
+}
+
+/** Drops prefetching that has not started yet and waits for what is running.
+
+    Called before operations are applied, so no tool reads a file system while it is changed.
+*/
+void FileSystem::cancelPrefetch()
+{
+    prefetchPool().clear();
+    prefetchPool().waitForDone();
+}
+
+/** @return the attributes that have not been read yet */
+FileSystem::LazyAttributes FileSystem::pending() const
+{
+    QMutexLocker locker(lazyMutex());
+    return m_Pending;
+}
+
+/** @param s the new value for sectors in use */
+void FileSystem::setSectorsUsed(qint64 s)
+{
+    QMutexLocker locker(lazyMutex());
+    m_SectorsUsed = s;
+    m_Pending &= ~LazyUsed;
+}
+
+/** @param s the new label */
+void FileSystem::setLabel(const QString& s)
+{
+    QMutexLocker locker(lazyMutex());
+    m_Label = s;
+    m_Pending &= ~LazyLabel;
+}
+
+/** @param s the new UUID */
+void FileSystem::setUUID(const QString& s)
+{
+    QMutexLocker locker(lazyMutex());
+    m_UUID = s;
+    m_Pending &= ~LazyUUID;
+}
+
+/** @return the mutex guarding the lazily read attributes or nullptr if there are none */
+QMutex* FileSystem::lazyMutex() const
+{
+    return m_Lazy ? &m_Lazy->mutex() : nullptr;
+}
+
+/** Takes an attribute from the LazyState, reading it first if that has not been done yet.
+    @param attribute the attribute to take
+*/
+void FileSystem::load(LazyAttribute attribute) const
+{
+    QMutexLocker locker(&m_Lazy->mutex());
+
+    if (!(m_Pending & attribute))
+        return;
+
+    m_Pending &= ~attribute;
+    m_Lazy->read(attribute);
+
+    switch (attribute) {
+    case LazyUsed:
+        m_SectorsUsed = m_Lazy->sectorsUsed();
+        break;
+
+    case LazyLabel:
+        m_Label = m_Lazy->label();
+        break;
+
+    case LazyUUID:
+        m_UUID = m_Lazy->uuid();
+        break;
+
+    default:
+        break;
+    }
 }
 
 /** Reads the capacity in use on this FileSystem
@@ -95,25 +353,23 @@ qint64 FileSystem::readUsedCapacity(const QString& deviceNode) const
     return -1;
 }
 
-static QString readBlkIdValue(const QString& deviceNode, const QString& tag)
-{
-    blkid_cache cache;
-    QString rval;
+/** Reads which sectors this FileSystem actually uses
 
-    if (blkid_get_cache(&cache, nullptr) == 0) {
-        blkid_dev dev;
+    File systems that can tell allocated from free space implement this so copying, moving and
+    backing up can skip unused sectors.
 
-        char* label = nullptr;
-        if ((dev = blkid_get_dev(cache, deviceNode.toLocal8Bit().constData(), BLKID_DEV_NORMAL)) != nullptr &&
-                (label = blkid_get_tag_value(cache, tag.toLocal8Bit().constData(), deviceNode.toLocal8Bit().constData()))) {
-            rval = QString::fromUtf8(label);
-            free(label);
-        }
-
-        blkid_put_cache(cache);
-    }
+    @param deviceNode the device node for the Partition the FileSystem is on
+    @param usedBlocks the map to fill in; it is only valid if true is returned
+    @param offset byte offset of the FileSystem in @p deviceNode, for reading it through the whole disk
+    @return true if the map could be filled in, false if not supported or in case of an error
+*/
+bool FileSystem::readUsedBlocks(const QString& deviceNode, UsedBlocksMap& usedBlocks, qint64 offset) const
+{
+    Q_UNUSED(deviceNode);
+    Q_UNUSED(usedBlocks);
+    Q_UNUSED(offset);
 
-    return rval;
+    return false;
 }
 
 FileSystem::Type FileSystem::detectFileSystem(const QString& partitionPath)
@@ -125,12 +381,14 @@ QString FileSystem::detectMountPoint(FileSystem* fs, const QString& partitionPat
 {
     QString mountPoint = QString();
 
-    KMountPoint::List mountPoints = KMountPoint::currentMountPoints(KMountPoint::NeedRealDeviceName);
-    mountPoints.append(KMountPoint::possibleMountPoints(KMountPoint::NeedRealDeviceName));
-
     if (fs->type() == FileSystem::Lvm2_PV) {
         mountPoint = FS::lvm2_pv::getVGName(partitionPath);
+    } else if (const MountTable* mountTable = MountTable::current()) {
+        mountPoint = mountTable->mountPoint(partitionPath);
     } else {
+        KMountPoint::List mountPoints = KMountPoint::currentMountPoints(KMountPoint::NeedRealDeviceName);
+        mountPoints.append(KMountPoint::possibleMountPoints(KMountPoint::NeedRealDeviceName));
+
         mountPoint = mountPoints.findByDevice(partitionPath) ?
                      mountPoints.findByDevice(partitionPath)->mountPoint() :
                      QString();
@@ -143,7 +401,7 @@ bool FileSystem::detectMountStatus(FileSystem* fs, const QString& partitionPath)
     bool mounted = false;
 
     if (fs->type() == FileSystem::Lvm2_PV) {
-        mounted = FS::lvm2_pv::getVGName(partitionPath) != QString(); // FIXME: VG name is scanned twice
+        mounted = FS::lvm2_pv::getVGName(partitionPath) != QString(); // answered from the LvmInventory while scanning
     } else {
         mounted = isMounted(partitionPath);
     }
@@ -156,7 +414,7 @@ bool FileSystem::detectMountStatus(FileSystem* fs, const QString& partitionPath)
 */
 QString FileSystem::readLabel(const QString& deviceNode) const
 {
-    return readBlkIdValue(deviceNode, QStringLiteral("LABEL"));
+    return BlkidProbe::probe(deviceNode).label;
 }
 
 /** Creates a new FileSystem
@@ -319,7 +577,7 @@ bool FileSystem::updateUUID(Report& report, const QString& deviceNode) const
  */
 QString FileSystem::readUUID(const QString& deviceNode) const
 {
-    return readBlkIdValue(deviceNode, QStringLiteral("UUID"));
+    return BlkidProbe::probe(deviceNode).uuid;
 }
 
 /** Give implementations of FileSystem a chance to update the boot sector after the
@@ -24,6 +24,7 @@
 
 #include <QColor>
 #include <QList>
+#include <QSharedPointer>
 #include <QStringList>
 #include <QString>
 #include <QtGlobal>
@@ -31,8 +32,11 @@
 
 #include <array>
 
+class QMutex;
+
 class Device;
 class Report;
+class UsedBlocksMap;
 
 /** Base class for all FileSystems.
 
@@ -96,9 +100,18 @@ public:
         cmdSupportBackend = 4           /**< supported by the backend */
     };
 
+    /** Attributes that can be read when they are first asked for instead of while scanning */
+    enum LazyAttribute {
+        LazyNone = 0,                   /**< nothing */
+        LazyUsed = 1,                   /**< the sectors in use */
+        LazyLabel = 2,                  /**< the label */
+        LazyUUID = 4                    /**< the UUID */
+    };
+
     static const std::array< QColor, __lastType > defaultColorCode;
 
     Q_DECLARE_FLAGS(CommandSupportTypes, CommandSupportType)
+    Q_DECLARE_FLAGS(LazyAttributes, LazyAttribute)
 
 protected:
     FileSystem(qint64 firstsector, qint64 lastsector, qint64 sectorsused, const QString& label, FileSystem::Type t);
@@ -110,6 +123,7 @@ public:
     virtual void init() {};
     virtual void scan(const QString& deviceNode);
     virtual qint64 readUsedCapacity(const QString& deviceNode) const;
+    virtual bool readUsedBlocks(const QString& deviceNode, UsedBlocksMap& usedBlocks, qint64 offset = 0) const;
     virtual QString readLabel(const QString& deviceNode) const;
     virtual bool create(Report& report, const QString& deviceNode);
     virtual bool resize(Report& report, const QString& deviceNode, qint64 newLength) const;
@@ -224,37 +238,56 @@ public:
     void move(qint64 newStartSector);
 
     const QString& label() const {
+        fetch(LazyLabel);
         return m_Label;    /**< @return the FileSystem's label */
     }
     qint64 sectorsUsed() const {
+        fetch(LazyUsed);
         return m_SectorsUsed;    /**< @return the sectors in use on the FileSystem */
     }
     const QString& uuid() const {
+        fetch(LazyUUID);
         return m_UUID;    /**< @return the FileSystem's UUID */
     }
 
-    void setSectorsUsed(qint64 s) {
-        m_SectorsUsed = s;    /**< @param s the new value for sectors in use */
-    }
-    void setLabel(const QString& s) {
-        m_Label = s;    /**< @param s the new label */
-    }
-    void setUUID(const QString& s) {
-        m_UUID = s;    /**< @param s the new UUID */
-    }
+    void setSectorsUsed(qint64 s);
+    void setLabel(const QString& s);
+    void setUUID(const QString& s);
+
+    void setLazy(const QString& deviceNode, qint64 sectorSize, LazyAttributes attributes, bool roundUp = false);
+    void invalidate(LazyAttributes attributes);
+    void prefetch() const;
+    static void cancelPrefetch();
+    LazyAttributes pending() const;
 
 protected:
     static bool findExternal(const QString& cmdName, const QStringList& args = QStringList(), int exptectedCode = 1);
 
+private:
+    class LazyState;
+    friend class PrefetchTask;
+
+    void fetch(LazyAttribute attribute) const {
+        if (m_Lazy)
+            load(attribute);
+    }
+    void load(LazyAttribute attribute) const;
+    QMutex* lazyMutex() const;
+
 protected:
     FileSystem::Type m_Type;
     qint64 m_FirstSector;
     qint64 m_LastSector;
-    qint64 m_SectorsUsed;
-    QString m_Label;
-    QString m_UUID;
+    mutable qint64 m_SectorsUsed;
+    mutable QString m_Label;
+    mutable QString m_UUID;
+
+private:
+    QSharedPointer<LazyState> m_Lazy;
+    mutable LazyAttributes m_Pending; // guarded by the LazyState's mutex
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(FileSystem::CommandSupportTypes)
+Q_DECLARE_OPERATORS_FOR_FLAGS(FileSystem::LazyAttributes)
 
 #endif
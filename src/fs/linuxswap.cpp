@@ -17,6 +17,7 @@
  *************************************************************************/
 
 #include "fs/linuxswap.h"
+#include "fs/superblock.h"
 
 #include "util/externalcommand.h"
 
@@ -185,6 +186,11 @@ qint64 linuxswap::readUsedCapacity(const QString& deviceNode) const
                 return line[3].toLongLong() * 1024;
         }
     }
+
+    // swap space that is not active does not use anything
+    if (Superblock::read(deviceNode, type()).isValid())
+        return 0;
+
     return -1;
 }
 }
@@ -21,6 +21,7 @@
 #include "fs/lvm2_pv.h"
 
 #include "fs/filesystemfactory.h"
+#include "fs/usedblocksmap.h"
 
 #include "util/externalcommand.h"
 #include "util/capacity.h"
@@ -29,9 +30,15 @@
 
 #include <QDebug>
 #include <QDialog>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QPointer>
 #include <QRegularExpression>
 #include <QString>
+#include <QtEndian>
 #include <QtMath>
 #include <QUuid>
 
@@ -39,6 +46,143 @@
 #include <KLocalizedString>
 #include <KPasswordDialog>
 
+/** What the header of a LUKS1 or LUKS2 volume says about it */
+struct LuksHeader
+{
+    QString uuid;
+    QString cipherName;
+    QString cipherMode;
+    QString hashName;
+    qint64 keySize;         // in bits
+    qint64 payloadOffset;   // in bytes
+};
+
+static QString headerString(const QByteArray& b, qint32 offset, qint32 size)
+{
+    QByteArray s = b.mid(offset, size);
+
+    if (s.indexOf('\0') >= 0)
+        s.truncate(s.indexOf('\0'));
+
+    return QString::fromLatin1(s);
+}
+
+/** Reads the header of a LUKS volume without running cryptsetup.
+
+    LUKS1 has all of it in the binary header. LUKS2 only has the UUID there; the rest is in the
+    JSON area following the binary header: the cipher of the first data segment, the key size of
+    its key slots and the hash of its digest.
+
+    @param deviceNode the device node of the LUKS volume
+    @param header set to what the header says
+    @return true if a valid LUKS1 or LUKS2 header was found
+*/
+static bool readLuksHeader(const QString& deviceNode, LuksHeader& header)
+{
+    QFile device(deviceNode);
+
+    if (!device.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+        return false;
+
+    // 16 KiB hold the binary header and the JSON area of a LUKS2 header with the default size
+    QByteArray data = UsedBlocksMap::readBytes(device, 0, 16384);
+
+    if (data.size() < 4096 || !data.startsWith(QByteArray("LUKS\xba\xbe", 6)))
+        return false;
+
+    const uchar* b = reinterpret_cast<const uchar*>(data.constData());
+    const quint16 version = qFromBigEndian<quint16>(b + 6);
+
+    header.uuid = headerString(data, 168, 40);
+
+    if (version == 1) {
+        header.cipherName = headerString(data, 8, 32);
+        header.cipherMode = headerString(data, 40, 32);
+        header.hashName = headerString(data, 72, 32);
+        header.payloadOffset = static_cast<qint64>(qFromBigEndian<quint32>(b + 104)) * 512;
+        header.keySize = static_cast<qint64>(qFromBigEndian<quint32>(b + 108)) * 8;
+
+        return true;
+    }
+
+    if (version != 2)
+        return false;
+
+    const qint64 headerSize = qFromBigEndian<quint64>(b + 8);
+
+    if (headerSize <= 4096 || headerSize > 4 * 1024 * 1024)
+        return false;
+
+    if (headerSize > data.size()) {
+        data = UsedBlocksMap::readBytes(device, 0, headerSize);
+
+        if (data.isEmpty())
+            return false;
+    }
+
+    const QByteArray json = data.mid(4096, headerSize - 4096);
+    const QJsonObject metadata = QJsonDocument::fromJson(json.left(json.indexOf('\0'))).object();
+
+    // a LUKS2 volume has a single crypt segment unless it is being reencrypted
+    const QJsonObject segment = metadata.value(QStringLiteral("segments")).toObject().value(QStringLiteral("0")).toObject();
+
+    if (segment.isEmpty())
+        return false;
+
+    const QString encryption = segment.value(QStringLiteral("encryption")).toString();
+    header.cipherName = encryption.section(QLatin1Char('-'), 0, 0);
+    header.cipherMode = encryption.section(QLatin1Char('-'), 1);
+    header.payloadOffset = segment.value(QStringLiteral("offset")).toString().toLongLong();
+
+    header.keySize = -1;
+    const QJsonObject keyslots = metadata.value(QStringLiteral("keyslots")).toObject();
+    for (auto it = keyslots.constBegin(); it != keyslots.constEnd() && header.keySize < 0; ++it)
+        if (it.value().toObject().contains(QStringLiteral("key_size")))
+            header.keySize = it.value().toObject().value(QStringLiteral("key_size")).toInt() * 8;
+
+    header.hashName = QString();
+    const QJsonObject digests = metadata.value(QStringLiteral("digests")).toObject();
+    for (auto it = digests.constBegin(); it != digests.constEnd() && header.hashName.isEmpty(); ++it)
+        header.hashName = it.value().toObject().value(QStringLiteral("hash")).toString();
+
+    return true;
+}
+
+/** Finds the dm-crypt mapping of a LUKS volume in sysfs.
+
+    The mapping is one of the device's holders; dm-crypt mappings made by cryptsetup have a
+    device mapper UUID starting with "CRYPT-".
+
+    @param deviceNode the device node of the LUKS volume
+    @param mapperName set to the mapper device node, e.g. /dev/mapper/luks-..., or an empty string if it is not open
+    @return true if sysfs could be used
+*/
+static bool findMapperName(const QString& deviceNode, QString& mapperName)
+{
+    const QString name = QFileInfo(QFileInfo(deviceNode).canonicalFilePath()).fileName();
+    const QDir holders(QStringLiteral("/sys/class/block/") + name + QStringLiteral("/holders"));
+
+    if (name.isEmpty() || !holders.exists())
+        return false;
+
+    mapperName = QString();
+
+    for (const QString& holder : holders.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        QFile uuid(QStringLiteral("/sys/block/") + holder + QStringLiteral("/dm/uuid"));
+        QFile dmName(QStringLiteral("/sys/block/") + holder + QStringLiteral("/dm/name"));
+
+        if (!uuid.open(QIODevice::ReadOnly) || !uuid.readAll().startsWith("CRYPT-"))
+            continue;
+
+        if (dmName.open(QIODevice::ReadOnly)) {
+            mapperName = QStringLiteral("/dev/mapper/") + QString::fromLocal8Bit(dmName.readAll()).trimmed();
+            break;
+        }
+    }
+
+    return true;
+}
+
 namespace FS
 {
 FileSystem::CommandSupportType luks::m_GetUsed = FileSystem::cmdSupportNone;
@@ -526,6 +670,12 @@ QString luks::readOuterUUID(const QString &deviceNode) const
     if ( deviceNode.isEmpty() )
         return QString();
 
+    LuksHeader header;
+    if (readLuksHeader(deviceNode, header) && !header.uuid.isEmpty()) {
+        const_cast< QString& >( m_outerUuid ) = header.uuid;
+        return header.uuid;
+    }
+
     ExternalCommand cmd(QStringLiteral("cryptsetup"),
                         { QStringLiteral("luksUUID"), deviceNode });
     if (cmd.run()) {
@@ -558,6 +708,9 @@ bool luks::updateUUID(Report& report, const QString& deviceNode) const
 
 void luks::getMapperName(const QString& deviceNode)
 {
+    if (findMapperName(deviceNode, m_MapperName))
+        return;
+
     ExternalCommand cmd(QStringLiteral("lsblk"),
                         { QStringLiteral("--list"),
                           QStringLiteral("--noheadings"),
@@ -575,6 +728,17 @@ void luks::getMapperName(const QString& deviceNode)
 
 void luks::getLuksInfo(const QString& deviceNode)
 {
+    LuksHeader header;
+    if (readLuksHeader(deviceNode, header)) {
+        m_CipherName = header.cipherName.isEmpty() ? QStringLiteral("---") : header.cipherName;
+        m_CipherMode = header.cipherMode.isEmpty() ? QStringLiteral("---") : header.cipherMode;
+        m_HashName = header.hashName.isEmpty() ? QStringLiteral("---") : header.hashName;
+        m_KeySize = header.keySize;
+        m_PayloadOffset = header.payloadOffset;
+        m_outerUuid = header.uuid;
+        return;
+    }
+
     ExternalCommand cmd(QStringLiteral("cryptsetup"),
                         { QStringLiteral("luksDump"), deviceNode });
     if (cmd.run(-1) && cmd.exitCode() == 0) {
@@ -18,9 +18,11 @@
 
 #include "fs/lvm2_pv.h"
 #include "core/device.h"
+#include "core/lvminventory.h"
 
 #include "util/externalcommand.h"
 #include "util/capacity.h"
+#include "util/progressparser.h"
 
 #include <QString>
 
@@ -141,11 +143,16 @@ bool lvm2_pv::resize(Report& report, const QString& deviceNode, qint64 length) c
             ExternalCommand moveCmd(report,
                                     QStringLiteral("lvm"), {
                                     QStringLiteral("pvmove"),
+                                    QStringLiteral("--interval"),
+                                    QStringLiteral("2"),
                                     QStringLiteral("--alloc"),
                                     QStringLiteral("anywhere"),
                                     deviceNode + QStringLiteral(":") + QString::number(firstMovedPE) + QStringLiteral("-") + QString::number(lastPE),
                                     deviceNode + QStringLiteral(":") + QStringLiteral("0-") + QString::number(firstMovedPE - 1)
                                     });
+            ProgressParser progress(report, ProgressParser::pvmove());
+            moveCmd.setProgressParser(&progress);
+            moveCmd.setOutputLimit(64 * 1024);
             rval = moveCmd.run(-1) && (moveCmd.exitCode() == 0 || moveCmd.exitCode() == 5); // FIXME: exit code 5: NO data to move
         }
     }
@@ -223,6 +230,8 @@ void lvm2_pv::getPESize(const QString& deviceNode)
 }
 
 /** Get pvs command output with field name
+ *
+ *  During a scan the field is looked up in the LvmInventory instead of running pvs.
  *
  *  @param fieldName LVM field name
  *  @param deviceNode path to PV
@@ -230,6 +239,10 @@ void lvm2_pv::getPESize(const QString& deviceNode)
  */
 QString  lvm2_pv::getpvField(const QString& fieldName, const QString& deviceNode)
 {
+    QString value;
+    if (LvmInventory::pvField(fieldName, deviceNode, value))
+        return value;
+
     QStringList args = { QStringLiteral("pvs"),
                     QStringLiteral("--foreign"),
                     QStringLiteral("--readonly"),
@@ -17,9 +17,11 @@
  *************************************************************************/
 
 #include "fs/ntfs.h"
+#include "fs/usedblocksmap.h"
 
 #include "util/externalcommand.h"
 #include "util/capacity.h"
+#include "util/progressparser.h"
 #include "util/report.h"
 #include "util/globallog.h"
 
@@ -30,6 +32,7 @@
 #include <QStringList>
 #include <QFile>
 #include <QUuid>
+#include <QtEndian>
 
 #include <algorithm>
 #include <ctime>
@@ -56,7 +59,8 @@ ntfs::ntfs(qint64 firstsector, qint64 lastsector, qint64 sectorsused, const QStr
 
 void ntfs::init()
 {
-    m_Shrink = m_Grow = m_Check = m_GetUsed = findExternal(QStringLiteral("ntfsresize")) ? cmdSupportFileSystem : cmdSupportNone;
+    m_Shrink = m_Grow = m_Check = findExternal(QStringLiteral("ntfsresize")) ? cmdSupportFileSystem : cmdSupportNone;
+    m_GetUsed = cmdSupportFileSystem;
     m_GetLabel = cmdSupportCore;
     m_SetLabel = findExternal(QStringLiteral("ntfslabel")) ? cmdSupportFileSystem : cmdSupportNone;
     m_Create = findExternal(QStringLiteral("mkfs.ntfs")) ? cmdSupportFileSystem : cmdSupportNone;
@@ -106,6 +110,11 @@ qint64 ntfs::maxLabelLength() const
 
 qint64 ntfs::readUsedCapacity(const QString& deviceNode) const
 {
+    UsedBlocksMap usedBlocks;
+
+    if (readUsedBlocks(deviceNode, usedBlocks) && usedBlocks.isValid())
+        return usedBlocks.usedSectors() * usedBlocks.sectorSize();
+
     ExternalCommand cmd(QStringLiteral("ntfsresize"), { QStringLiteral("--info"), QStringLiteral("--force"), QStringLiteral("--no-progress-bar"), deviceNode });
 
     if (cmd.run(-1) && cmd.exitCode() == 0) {
@@ -149,6 +158,9 @@ bool ntfs::create(Report& report, const QString& deviceNode)
 bool ntfs::copy(Report& report, const QString& targetDeviceNode, const QString& sourceDeviceNode) const
 {
     ExternalCommand cmd(report, QStringLiteral("ntfsclone"), { QStringLiteral("--force"), QStringLiteral("--overwrite"), targetDeviceNode, sourceDeviceNode });
+    ProgressParser progress(report, ProgressParser::ntfsclone());
+    cmd.setProgressParser(&progress);
+    cmd.setOutputLimit(64 * 1024);
 
     return cmd.run(-1) && cmd.exitCode() == 0;
 }
@@ -177,6 +189,173 @@ bool ntfs::updateUUID(Report& report, const QString& deviceNode) const
     return cmd.run(-1) && cmd.exitCode() == 0;
 }
 
+/** Reads an MFT record and undoes the update sequence fixups at the end of each 512 byte stride.
+    @return the record or an empty QByteArray if it cannot be read or is broken
+*/
+static QByteArray readMftRecord(QFile& device, qint64 offset, qint64 recordSize)
+{
+    QByteArray record = UsedBlocksMap::readBytes(device, offset, recordSize);
+    if (record.isEmpty() || !record.startsWith("FILE"))
+        return QByteArray();
+
+    uchar* r = reinterpret_cast<uchar*>(record.data());
+    const qint64 usaOffset = qFromLittleEndian<quint16>(r + 4);
+    const qint64 usaCount = qFromLittleEndian<quint16>(r + 6);
+
+    if (usaOffset + usaCount * 2 > recordSize || (usaCount - 1) * 512 > recordSize)
+        return QByteArray();
+
+    for (qint64 i = 1; i < usaCount; i++) {
+        r[i * 512 - 2] = r[usaOffset + i * 2];
+        r[i * 512 - 1] = r[usaOffset + i * 2 + 1];
+    }
+
+    return record;
+}
+
+/** @return true if the $VOLUME_INFORMATION in the given $Volume record does not have the dirty flag set */
+static bool isCleanVolume(const QByteArray& record)
+{
+    const uchar* r = reinterpret_cast<const uchar*>(record.constData());
+    const qint64 recordSize = record.size();
+    qint64 attrOffset = recordSize > 0x16 ? qFromLittleEndian<quint16>(r + 0x14) : recordSize;
+
+    while (attrOffset + 0x18 <= recordSize) {
+        const uchar* a = r + attrOffset;
+        const quint32 attrType = qFromLittleEndian<quint32>(a);
+        const qint64 attrLength = qFromLittleEndian<quint32>(a + 4);
+
+        if (attrType == 0xffffffff || attrLength <= 0 || attrOffset + attrLength > recordSize)
+            break;
+
+        if (attrType == 0x70 && a[8] == 0) {
+            const qint64 valueLength = qFromLittleEndian<quint32>(a + 0x10);
+            const qint64 valueOffset = qFromLittleEndian<quint16>(a + 0x14);
+
+            if (valueLength < 12 || valueOffset + valueLength > attrLength)
+                return false;
+
+            return !(qFromLittleEndian<quint16>(a + valueOffset + 0x0a) & 0x0001);
+        }
+
+        attrOffset += attrLength;
+    }
+
+    return false;
+}
+
+/** Reads the used clusters from the $Bitmap metafile.
+
+    $Bitmap is MFT record 6; its non-resident $DATA attribute holds one bit per cluster. Nothing is
+    read if the volume is marked dirty in $Volume, MFT record 3.
+*/
+bool ntfs::readUsedBlocks(const QString& deviceNode, UsedBlocksMap& usedBlocks, qint64 offset) const
+{
+    QFile device(deviceNode);
+    if (!device.open(QIODevice::ReadOnly))
+        return false;
+
+    const QByteArray bs = UsedBlocksMap::readBytes(device, offset, 512);
+    if (bs.isEmpty() || bs.mid(3, 8) != "NTFS    ")
+        return false;
+
+    const uchar* b = reinterpret_cast<const uchar*>(bs.constData());
+
+    const qint64 bytesPerSector = qFromLittleEndian<quint16>(b + 0x0b);
+    const qint64 sectorsPerCluster = b[0x0d] > 0x80 ? Q_INT64_C(1) << (256 - b[0x0d]) : b[0x0d];
+    const qint64 totalSectors = qFromLittleEndian<qint64>(b + 0x28);
+    const qint64 mftCluster = qFromLittleEndian<qint64>(b + 0x30);
+    const qint8 clustersPerRecord = static_cast<qint8>(b[0x40]);
+
+    if (bytesPerSector < 256 || sectorsPerCluster == 0 || totalSectors <= 0 || totalSectors * bytesPerSector > length() * usedBlocks.sectorSize())
+        return false;
+
+    const qint64 clusterSize = bytesPerSector * sectorsPerCluster;
+    const qint64 recordSize = clustersPerRecord < 0 ? Q_INT64_C(1) << -clustersPerRecord : clustersPerRecord * clusterSize;
+    const qint64 clusters = totalSectors / sectorsPerCluster;
+
+    if (recordSize < 512 || recordSize > 65536)
+        return false;
+
+    const qint64 mftOffset = offset + mftCluster * clusterSize;
+
+    // changes Windows has only written to $LogFile yet are not in $Bitmap either
+    if (!isCleanVolume(readMftRecord(device, mftOffset + 3 * recordSize, recordSize)))
+        return false;
+
+    QByteArray record = readMftRecord(device, mftOffset + 6 * recordSize, recordSize);
+    if (record.isEmpty())
+        return false;
+
+    uchar* r = reinterpret_cast<uchar*>(record.data());
+
+    // find the unnamed $DATA attribute and decode its run list
+    QByteArray bitmap;
+    qint64 attrOffset = qFromLittleEndian<quint16>(r + 0x14);
+
+    while (attrOffset + 0x40 <= recordSize) {
+        const uchar* a = r + attrOffset;
+        const quint32 attrType = qFromLittleEndian<quint32>(a);
+        const qint64 attrLength = qFromLittleEndian<quint32>(a + 4);
+
+        if (attrType == 0xffffffff || attrLength <= 0 || attrOffset + attrLength > recordSize)
+            break;
+
+        if (attrType == 0x80 && a[8] == 1 && a[9] == 0) {
+            const qint64 dataSize = qFromLittleEndian<qint64>(a + 0x30);
+            qint64 runOffset = qFromLittleEndian<quint16>(a + 0x20);
+            qint64 lcn = 0;
+
+            while (runOffset < attrLength && a[runOffset] != 0 && bitmap.size() < dataSize) {
+                const int lengthBytes = a[runOffset] & 0x0f;
+                const int offsetBytes = a[runOffset] >> 4;
+
+                if (lengthBytes == 0 || lengthBytes > 8 || offsetBytes > 8 || runOffset + 1 + lengthBytes + offsetBytes > attrLength)
+                    return false;
+
+                qint64 runLength = 0;
+                for (int i = lengthBytes - 1; i >= 0; i--)
+                    runLength = (runLength << 8) | a[runOffset + 1 + i];
+
+                qint64 delta = 0;
+                for (int i = offsetBytes - 1; i >= 0; i--)
+                    delta = (delta << 8) | a[runOffset + 1 + lengthBytes + i];
+                if (offsetBytes > 0 && offsetBytes < 8 && (a[runOffset + lengthBytes + offsetBytes] & 0x80))
+                    delta -= Q_INT64_C(1) << (offsetBytes * 8); // sign extend
+
+                const qint64 bytes = qMin(runLength * clusterSize, dataSize - bitmap.size());
+
+                if (offsetBytes == 0)
+                    bitmap.append(QByteArray(bytes, '\0')); // sparse run
+                else {
+                    lcn += delta;
+                    const QByteArray run = UsedBlocksMap::readBytes(device, offset + lcn * clusterSize, bytes);
+                    if (run.isEmpty())
+                        return false;
+                    bitmap.append(run);
+                }
+
+                runOffset += 1 + lengthBytes + offsetBytes;
+            }
+
+            break;
+        }
+
+        attrOffset += attrLength;
+    }
+
+    if (bitmap.size() * 8 < clusters)
+        return false;
+
+    usedBlocks.addBitmap(bitmap, clusters, 0, clusterSize);
+
+    // the backup boot sector sits in the sector behind the last one counted, after the last cluster
+    usedBlocks.addUsedBytes(clusters * clusterSize, (totalSectors + 1) * bytesPerSector - clusters * clusterSize);
+    usedBlocks.finish(length());
+
+    return true;
+}
+
 bool ntfs::updateBootSector(Report& report, const QString& deviceNode) const
 {
     report.line() << xi18nc("@info:progress", "Updating boot sector for NTFS file system on partition <filename>%1</filename>.", deviceNode);
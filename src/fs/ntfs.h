@@ -43,6 +43,7 @@ public:
     void init() override;
 
     qint64 readUsedCapacity(const QString& deviceNode) const override;
+    bool readUsedBlocks(const QString& deviceNode, UsedBlocksMap& usedBlocks, qint64 offset = 0) const override;
     bool check(Report& report, const QString& deviceNode) const override;
     bool create(Report& report, const QString& deviceNode) override;
     bool copy(Report& report, const QString& targetDeviceNode, const QString& sourceDeviceNode) const override;
@@ -0,0 +1,412 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "fs/superblock.h"
+#include "fs/usedblocksmap.h"
+
+#include "util/crc32.h"
+
+#include <QFile>
+#include <QUuid>
+#include <QtEndian>
+
+static quint16 le16(const QByteArray& b, qint32 offset)
+{
+    return qFromLittleEndian<quint16>(reinterpret_cast<const uchar*>(b.constData()) + offset);
+}
+
+static quint32 le32(const QByteArray& b, qint32 offset)
+{
+    return qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(b.constData()) + offset);
+}
+
+static quint64 le64(const QByteArray& b, qint32 offset)
+{
+    return qFromLittleEndian<quint64>(reinterpret_cast<const uchar*>(b.constData()) + offset);
+}
+
+static quint32 be32(const QByteArray& b, qint32 offset)
+{
+    return qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(b.constData()) + offset);
+}
+
+static quint64 be64(const QByteArray& b, qint32 offset)
+{
+    return qFromBigEndian<quint64>(reinterpret_cast<const uchar*>(b.constData()) + offset);
+}
+
+/** @return a null terminated or padded string from a superblock, without trailing blanks */
+static QString fixedString(const QByteArray& b, qint32 offset, qint32 size)
+{
+    QByteArray s = b.mid(offset, size);
+
+    if (s.indexOf('\0') >= 0)
+        s.truncate(s.indexOf('\0'));
+
+    return QString::fromUtf8(s).trimmed();
+}
+
+static QString uuidString(const QByteArray& b, qint32 offset)
+{
+    const QByteArray bytes = b.mid(offset, 16);
+
+    if (bytes.size() != 16 || bytes == QByteArray(16, '\0'))
+        return QString();
+
+    return QUuid::fromRfc4122(bytes).toString().mid(1, 36);
+}
+
+/** Reads an f2fs checkpoint block and checks its CRC.
+
+    f2fs seeds its CRC-32 with the superblock magic and does not invert the result.
+
+    @return the checkpoint block, or an empty QByteArray if it could not be read or is damaged
+*/
+static QByteArray readF2fsCheckpointBlock(QFile& device, qint64 offset, qint64 blockSize)
+{
+    const QByteArray cp = UsedBlocksMap::readBytes(device, offset, blockSize);
+
+    if (cp.size() != blockSize)
+        return QByteArray();
+
+    // the checksum follows the version bitmaps, which start at byte 192
+    const quint32 crcOffset = le32(cp, 164);
+
+    if (crcOffset < 192 || crcOffset > blockSize - 4)
+        return QByteArray();
+
+    if (le32(cp, crcOffset) != ~checksumCrc32(cp.constData(), crcOffset, ~0xf2f52010u))
+        return QByteArray();
+
+    return cp;
+}
+
+Superblock::Superblock() :
+    m_Valid(false),
+    m_BlockSize(-1),
+    m_TotalBlocks(-1),
+    m_FreeBlocks(-1),
+    m_Label(),
+    m_UUID()
+{
+}
+
+/** Reads the superblock of a FileSystem.
+    @param deviceNode the device node the FileSystem is on
+    @param type the type of the FileSystem
+    @return the Superblock; invalid if the type is not supported or no valid superblock was found
+*/
+Superblock Superblock::read(const QString& deviceNode, FileSystem::Type type)
+{
+    Superblock rval;
+
+    QFile device(deviceNode);
+
+    if (!device.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+        return rval;
+
+    switch (type) {
+    case FileSystem::Ext2:
+    case FileSystem::Ext3:
+    case FileSystem::Ext4:
+        rval.m_Valid = rval.readExt(device);
+        break;
+
+    case FileSystem::Xfs:
+        rval.m_Valid = rval.readXfs(device);
+        break;
+
+    case FileSystem::Btrfs:
+        rval.m_Valid = rval.readBtrfs(device);
+        break;
+
+    case FileSystem::Fat16:
+    case FileSystem::Fat32:
+        rval.m_Valid = rval.readFat(device);
+        break;
+
+    case FileSystem::Ntfs:
+        rval.m_Valid = rval.readNtfs(device);
+        break;
+
+    case FileSystem::F2fs:
+        rval.m_Valid = rval.readF2fs(device);
+        break;
+
+    case FileSystem::LinuxSwap:
+        rval.m_Valid = rval.readSwap(device);
+        break;
+
+    default:
+        break;
+    }
+
+    return rval;
+}
+
+bool Superblock::readExt(QFile& device)
+{
+    const QByteArray sb = UsedBlocksMap::readBytes(device, 1024, 1024);
+
+    if (sb.isEmpty() || le16(sb, 56) != 0xef53)
+        return false;
+
+    const quint32 logBlockSize = le32(sb, 24);
+
+    if (logBlockSize > 6)
+        return false;
+
+    m_BlockSize = 1024 << logBlockSize;
+    m_TotalBlocks = le32(sb, 4);
+    m_FreeBlocks = le32(sb, 12);
+
+    // 64bit feature: the high halves of the block counts are used
+    if (le32(sb, 96) & 0x80) {
+        m_TotalBlocks |= static_cast<qint64>(le32(sb, 0x150)) << 32;
+        m_FreeBlocks |= static_cast<qint64>(le32(sb, 0x158)) << 32;
+    }
+
+    m_UUID = uuidString(sb, 104);
+    m_Label = fixedString(sb, 120, 16);
+
+    return true;
+}
+
+bool Superblock::readXfs(QFile& device)
+{
+    // XFS is big endian on disk
+    const QByteArray sb = UsedBlocksMap::readBytes(device, 0, 512);
+
+    if (sb.isEmpty() || !sb.startsWith("XFSB"))
+        return false;
+
+    m_BlockSize = be32(sb, 4);
+    m_TotalBlocks = be64(sb, 8);
+    m_FreeBlocks = be64(sb, 144);
+    m_UUID = uuidString(sb, 32);
+    m_Label = fixedString(sb, 108, 12);
+
+    return true;
+}
+
+bool Superblock::readBtrfs(QFile& device)
+{
+    const QByteArray sb = UsedBlocksMap::readBytes(device, 0x10000, 4096);
+
+    if (sb.isEmpty() || sb.mid(0x40, 8) != "_BHRfS_M")
+        return false;
+
+    // the numbers of the device item describe this device, which is what "btrfs filesystem show" lists per device
+    const qint64 deviceTotal = le64(sb, 0xc9 + 8);
+    const qint64 deviceUsed = le64(sb, 0xc9 + 16);
+
+    m_BlockSize = 1;
+    m_TotalBlocks = deviceTotal;
+    m_FreeBlocks = deviceTotal - deviceUsed;
+    m_UUID = uuidString(sb, 0x20);
+    m_Label = fixedString(sb, 0x12b, 256);
+
+    return true;
+}
+
+bool Superblock::readFat(QFile& device)
+{
+    const QByteArray bs = UsedBlocksMap::readBytes(device, 0, 512);
+
+    if (bs.isEmpty() || le16(bs, 510) != 0xaa55)
+        return false;
+
+    const qint64 bytesPerSector = le16(bs, 11);
+    const qint64 sectorsPerCluster = static_cast<uchar>(bs[13]);
+    const qint64 reservedSectors = le16(bs, 14);
+    const qint64 numFats = static_cast<uchar>(bs[16]);
+    const qint64 rootEntries = le16(bs, 17);
+    const qint64 totalSectors = le16(bs, 19) != 0 ? le16(bs, 19) : le32(bs, 32);
+    const qint64 fatSectors = le16(bs, 22) != 0 ? le16(bs, 22) : le32(bs, 36);
+
+    if (bytesPerSector < 512 || sectorsPerCluster == 0 || numFats == 0 || fatSectors == 0)
+        return false;
+
+    const qint64 rootDirSectors = (rootEntries * 32 + bytesPerSector - 1) / bytesPerSector;
+    const qint64 firstDataSector = reservedSectors + numFats * fatSectors + rootDirSectors;
+
+    if (totalSectors <= firstDataSector)
+        return false;
+
+    const qint64 clusters = (totalSectors - firstDataSector) / sectorsPerCluster;
+    const qint32 fatBits = clusters < 4085 ? 12 : clusters < 65525 ? 16 : 32;
+    const qint32 extended = fatBits == 32 ? 64 : 36; // offset of the extended boot record
+
+    m_BlockSize = bytesPerSector * sectorsPerCluster;
+    m_TotalBlocks = clusters;
+
+    if (static_cast<uchar>(bs[extended + 2]) == 0x29) {
+        m_UUID = QStringLiteral("%1-%2").arg(le16(bs, extended + 5), 4, 16, QLatin1Char('0')).arg(le16(bs, extended + 3), 4, 16, QLatin1Char('0')).toUpper();
+        m_Label = fixedString(bs, extended + 7, 11);
+        if (m_Label == QStringLiteral("NO NAME"))
+            m_Label.clear();
+    }
+
+    // FAT32 may keep the number of free clusters in the FSInfo sector
+    if (fatBits == 32) {
+        const QByteArray fsInfo = UsedBlocksMap::readBytes(device, le16(bs, 48) * bytesPerSector, 512);
+
+        if (!fsInfo.isEmpty() && le32(fsInfo, 0) == 0x41615252 && le32(fsInfo, 484) == 0x61417272 && le32(fsInfo, 488) <= clusters) {
+            m_FreeBlocks = le32(fsInfo, 488);
+            return true;
+        }
+    }
+
+    // otherwise count the free entries in the first FAT, in chunks
+    const qint64 fatOffset = reservedSectors * bytesPerSector;
+    const qint64 fatBytes = (clusters + 2) * fatBits / 8 + 2;
+    const qint64 chunkSize = 1024 * 1024 / 12 * 12; // a multiple of the 1.5 byte FAT12 entries and of 2 and 4 bytes
+    qint64 freeClusters = 0;
+    qint64 cluster = 0;
+
+    for (qint64 pos = 0; pos < fatBytes && cluster < clusters + 2; pos += chunkSize) {
+        const QByteArray fat = UsedBlocksMap::readBytes(device, fatOffset + pos, qMin(chunkSize, fatBytes - pos));
+
+        if (fat.isEmpty())
+            return true; // usage stays unknown
+
+        const qint64 first = pos * 8 / fatBits;
+
+        for (cluster = first; cluster < clusters + 2; cluster++) {
+            const qint64 byte = cluster * fatBits / 8 - pos;
+            quint32 entry;
+
+            if (fatBits == 12) {
+                if (byte + 1 >= fat.size())
+                    break;
+                entry = le16(fat, byte);
+                entry = cluster & 1 ? entry >> 4 : entry & 0xfff;
+            } else if (fatBits == 16) {
+                if (byte + 1 >= fat.size())
+                    break;
+                entry = le16(fat, byte);
+            } else {
+                if (byte + 3 >= fat.size())
+                    break;
+                entry = le32(fat, byte) & 0x0fffffff;
+            }
+
+            if (cluster >= 2 && entry == 0)
+                freeClusters++;
+        }
+    }
+
+    m_FreeBlocks = freeClusters;
+
+    return true;
+}
+
+bool Superblock::readNtfs(QFile& device)
+{
+    const QByteArray bs = UsedBlocksMap::readBytes(device, 0, 512);
+
+    if (bs.isEmpty() || bs.mid(3, 8) != "NTFS    ")
+        return false;
+
+    const qint64 bytesPerSector = le16(bs, 11);
+    const qint64 sectorsPerCluster = static_cast<uchar>(bs[13]);
+
+    if (bytesPerSector < 256 || sectorsPerCluster == 0)
+        return false;
+
+    // the boot sector has no usage information; ntfs::readUsedCapacity() reads $Bitmap for that
+    m_BlockSize = bytesPerSector * (sectorsPerCluster > 0x80 ? Q_INT64_C(1) << (256 - sectorsPerCluster) : sectorsPerCluster);
+    m_TotalBlocks = static_cast<qint64>(le64(bs, 40)) * bytesPerSector / m_BlockSize;
+    m_UUID = QStringLiteral("%1").arg(le64(bs, 72), 16, 16, QLatin1Char('0')).toUpper();
+
+    return true;
+}
+
+bool Superblock::readF2fs(QFile& device)
+{
+    const QByteArray sb = UsedBlocksMap::readBytes(device, 1024, 3072);
+
+    if (sb.isEmpty() || le32(sb, 0) != 0xf2f52010)
+        return false;
+
+    const quint32 logBlockSize = le32(sb, 16);
+
+    if (logBlockSize < 9 || logBlockSize > 16)
+        return false;
+
+    m_BlockSize = 1 << logBlockSize;
+    m_TotalBlocks = le64(sb, 36);
+    m_UUID = uuidString(sb, 108);
+
+    // the volume name is in little endian UTF-16
+    for (qint32 i = 0; i < 512 && le16(sb, 124 + i * 2) != 0; i++)
+        m_Label += QChar(le16(sb, 124 + i * 2));
+
+    // the number of valid blocks is in the newer of the two checkpoint packs; a pack is only
+    // complete if its first and last blocks are intact and carry the same version
+    const qint64 checkpoint = static_cast<qint64>(le32(sb, 76)) * m_BlockSize;
+    const qint64 blocksPerSegment = 1 << le32(sb, 20);
+    quint64 version = 0;
+
+    for (const qint64 offset : { checkpoint, checkpoint + blocksPerSegment * m_BlockSize }) {
+        const QByteArray cp = readF2fsCheckpointBlock(device, offset, m_BlockSize);
+
+        if (cp.isEmpty())
+            continue;
+
+        const qint64 packBlocks = le32(cp, 136);
+
+        if (packBlocks < 2 || packBlocks > blocksPerSegment)
+            continue;
+
+        const QByteArray last = readF2fsCheckpointBlock(device, offset + (packBlocks - 1) * m_BlockSize, m_BlockSize);
+
+        if (last.isEmpty() || le64(last, 0) != le64(cp, 0))
+            continue;
+
+        if (le64(cp, 0) >= version && le64(cp, 16) <= static_cast<quint64>(m_TotalBlocks)) {
+            version = le64(cp, 0);
+            m_FreeBlocks = m_TotalBlocks - static_cast<qint64>(le64(cp, 16));
+        }
+    }
+
+    return true;
+}
+
+bool Superblock::readSwap(QFile& device)
+{
+    // the signature is at the end of the first page, whatever the page size was when it was made
+    for (const qint64 pageSize : { 4096, 8192, 16384, 65536 }) {
+        const QByteArray page = UsedBlocksMap::readBytes(device, 0, pageSize);
+
+        if (page.isEmpty())
+            break;
+
+        if (page.mid(pageSize - 10) != "SWAPSPACE2" && page.mid(pageSize - 10) != "SWAP-SPACE")
+            continue;
+
+        // swap space has no usage information on disk; linuxswap::readUsedCapacity() uses /proc/swaps
+        m_BlockSize = pageSize;
+        m_TotalBlocks = le32(page, 1028) + 1;
+        m_UUID = uuidString(page, 1036);
+        m_Label = fixedString(page, 1052, 16);
+
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,93 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(SUPERBLOCK__H)
+
+#define SUPERBLOCK__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include "fs/filesystem.h"
+
+#include <QString>
+#include <QtGlobal>
+
+class QFile;
+
+/** What a FileSystem's superblock says about its size, usage, label and UUID.
+
+    Reading the used capacity used to mean running a tool like dumpe2fs, xfs_db or fsck.fat for
+    every partition and picking the numbers out of its output. The readers here read the few KiB
+    of the superblock (and for some file systems a bit more, like the FAT or the F2FS checkpoint)
+    directly and decode them. File systems use them first and fall back to the external tools if
+    they fail.
+
+    Supported are ext2/3/4, XFS, btrfs, FAT12/16/32, NTFS, F2FS and Linux swap. For NTFS and
+    swap the superblock has no usage information, so hasUsage() is false for them.
+*/
+class LIBKPMCORE_EXPORT Superblock
+{
+public:
+    Superblock();
+
+public:
+    static Superblock read(const QString& deviceNode, FileSystem::Type type);
+
+    bool isValid() const {
+        return m_Valid;    /**< @return true if a superblock of the asked for type was found */
+    }
+    bool hasUsage() const {
+        return m_Valid && m_BlockSize > 0 && m_TotalBlocks >= 0 && m_FreeBlocks >= 0 && m_FreeBlocks <= m_TotalBlocks;    /**< @return true if the used capacity is known */
+    }
+    qint64 blockSize() const {
+        return m_BlockSize;    /**< @return the size of a block (or cluster) in bytes */
+    }
+    qint64 totalBlocks() const {
+        return m_TotalBlocks;    /**< @return the number of blocks in the file system, -1 if unknown */
+    }
+    qint64 freeBlocks() const {
+        return m_FreeBlocks;    /**< @return the number of free blocks, -1 if unknown */
+    }
+    qint64 usedBytes() const {
+        return hasUsage() ? (m_TotalBlocks - m_FreeBlocks) * m_BlockSize : -1;    /**< @return the used capacity in bytes, -1 if unknown */
+    }
+    const QString& label() const {
+        return m_Label;    /**< @return the file system label */
+    }
+    const QString& uuid() const {
+        return m_UUID;    /**< @return the file system UUID or serial number */
+    }
+
+private:
+    bool readExt(QFile& device);
+    bool readXfs(QFile& device);
+    bool readBtrfs(QFile& device);
+    bool readFat(QFile& device);
+    bool readNtfs(QFile& device);
+    bool readF2fs(QFile& device);
+    bool readSwap(QFile& device);
+
+private:
+    bool m_Valid;
+    qint64 m_BlockSize;
+    qint64 m_TotalBlocks;
+    qint64 m_FreeBlocks;
+    QString m_Label;
+    QString m_UUID;
+};
+
+#endif
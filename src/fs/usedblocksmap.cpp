@@ -0,0 +1,145 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "fs/usedblocksmap.h"
+
+#include <QFile>
+
+#include <algorithm>
+
+/** Creates a new, invalid UsedBlocksMap.
+    @param sectorSize the size of a sector in bytes
+*/
+UsedBlocksMap::UsedBlocksMap(qint32 sectorSize) :
+    m_SectorSize(sectorSize),
+    m_Valid(false)
+{
+}
+
+/** Marks a range of bytes as used.
+
+    Sectors only partially covered by the range count as used as a whole.
+
+    @param offset byte offset of the range from the start of the FileSystem
+    @param length length of the range in bytes
+*/
+void UsedBlocksMap::addUsedBytes(qint64 offset, qint64 length)
+{
+    if (length <= 0)
+        return;
+
+    const qint64 first = offset / sectorSize();
+    const qint64 last = (offset + length - 1) / sectorSize();
+
+    // allocation structures are mostly walked front to back, so try to extend the last run first
+    if (!m_Extents.isEmpty() && m_Extents.last().first + m_Extents.last().length >= first && m_Extents.last().first <= first) {
+        Extent& e = m_Extents.last();
+        e.length = qMax(e.length, last - e.first + 1);
+        return;
+    }
+
+    m_Extents.append({ first, last - first + 1 });
+}
+
+/** Marks the allocation units whose bit is set in a bitmap as used.
+
+    Bits are counted from the least significant bit of each byte, as ext2/3/4 and NTFS store them.
+
+    @param bitmap the bitmap
+    @param numBits the number of bits in the bitmap that are valid
+    @param offset byte offset from the start of the FileSystem the first bit stands for
+    @param bytesPerBit the number of bytes each bit stands for
+*/
+void UsedBlocksMap::addBitmap(const QByteArray& bitmap, qint64 numBits, qint64 offset, qint64 bytesPerBit)
+{
+    numBits = qMin(numBits, static_cast<qint64>(bitmap.size()) * 8);
+
+    const uchar* bits = reinterpret_cast<const uchar*>(bitmap.constData());
+    qint64 runStart = -1;
+
+    for (qint64 i = 0; i < numBits; i++) {
+        // skip over whole bytes that do not change the state of the current run
+        if (i % 8 == 0 && i + 8 <= numBits && bits[i / 8] == (runStart < 0 ? 0x00 : 0xff)) {
+            i += 7;
+            continue;
+        }
+
+        const bool used = bits[i / 8] & (1 << (i % 8));
+
+        if (used && runStart < 0)
+            runStart = i;
+        else if (!used && runStart >= 0) {
+            addUsedBytes(offset + runStart * bytesPerBit, (i - runStart) * bytesPerBit);
+            runStart = -1;
+        }
+    }
+
+    if (runStart >= 0)
+        addUsedBytes(offset + runStart * bytesPerBit, (numBits - runStart) * bytesPerBit);
+}
+
+/** Sorts and merges the runs, clips them to the FileSystem and marks the map as valid.
+    @param length the FileSystem's length in sectors
+*/
+void UsedBlocksMap::finish(qint64 length)
+{
+    std::sort(m_Extents.begin(), m_Extents.end(), [](const Extent& a, const Extent& b) { return a.first < b.first; });
+
+    QList<Extent> merged;
+
+    for (const Extent& e : m_Extents) {
+        if (e.first >= length)
+            break;
+
+        const qint64 end = qMin(e.first + e.length, length);
+
+        if (!merged.isEmpty() && merged.last().first + merged.last().length >= e.first)
+            merged.last().length = qMax(merged.last().length, end - merged.last().first);
+        else
+            merged.append({ e.first, end - e.first });
+    }
+
+    m_Extents = merged;
+    m_Valid = true;
+}
+
+/** @return the number of used sectors */
+qint64 UsedBlocksMap::usedSectors() const
+{
+    qint64 rval = 0;
+
+    for (const Extent& e : extents())
+        rval += e.length;
+
+    return rval;
+}
+
+/** Reads raw bytes from a device, e.g. to parse a FileSystem's allocation structures.
+    @param device the opened device to read from
+    @param offset byte offset to start reading at
+    @param length number of bytes to read
+    @return the bytes read or an empty QByteArray if not all of them could be read
+*/
+QByteArray UsedBlocksMap::readBytes(QFile& device, qint64 offset, qint64 length)
+{
+    if (length < 0 || !device.seek(offset))
+        return QByteArray();
+
+    QByteArray rval = device.read(length);
+
+    return rval.size() == length ? rval : QByteArray();
+}
@@ -0,0 +1,76 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(USEDBLOCKSMAP__H)
+
+#define USEDBLOCKSMAP__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QtGlobal>
+
+class QFile;
+
+/** Map of the sectors a FileSystem actually uses.
+
+    File systems fill this from their own allocation structures, like block bitmaps or free space
+    trees, so copying can skip everything that is not allocated. Sectors are relative to the
+    FileSystem's first sector.
+
+    A default constructed map is invalid, meaning nothing is known and all sectors count as used.
+
+    @see FileSystem::readUsedBlocks()
+*/
+class LIBKPMCORE_EXPORT UsedBlocksMap
+{
+public:
+    /** A run of used sectors */
+    struct Extent {
+        qint64 first;   /**< first sector of the run */
+        qint64 length;  /**< number of sectors in the run */
+    };
+
+public:
+    explicit UsedBlocksMap(qint32 sectorSize = 512);
+
+public:
+    void addUsedBytes(qint64 offset, qint64 length);
+    void addBitmap(const QByteArray& bitmap, qint64 numBits, qint64 offset, qint64 bytesPerBit);
+    void finish(qint64 length);
+
+    bool isValid() const {
+        return m_Valid;    /**< @return true if the map is complete and may be used for copying */
+    }
+    qint32 sectorSize() const {
+        return m_SectorSize;    /**< @return the sector size the map uses */
+    }
+    const QList<Extent>& extents() const {
+        return m_Extents;    /**< @return the runs of used sectors, sorted and not overlapping */
+    }
+    qint64 usedSectors() const;
+
+    static QByteArray readBytes(QFile& device, qint64 offset, qint64 length);
+
+private:
+    qint32 m_SectorSize;
+    QList<Extent> m_Extents;
+    bool m_Valid;
+};
+
+#endif
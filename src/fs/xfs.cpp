@@ -17,15 +17,20 @@
  *************************************************************************/
 
 #include "fs/xfs.h"
+#include "fs/superblock.h"
+#include "fs/usedblocksmap.h"
 
 #include "util/externalcommand.h"
 #include "util/capacity.h"
+#include "util/progressparser.h"
 #include "util/report.h"
 
+#include <QFile>
 #include <QRegularExpression>
 #include <QString>
 #include <QStringList>
 #include <QTemporaryDir>
+#include <QtEndian>
 
 #include <KLocalizedString>
 
@@ -49,7 +54,8 @@ xfs::xfs(qint64 firstsector, qint64 lastsector, qint64 sectorsused, const QStrin
 void xfs::init()
 {
     m_GetLabel = cmdSupportCore;
-    m_SetLabel = m_GetUsed = findExternal(QStringLiteral("xfs_db")) ? cmdSupportFileSystem : cmdSupportNone;
+    m_SetLabel = findExternal(QStringLiteral("xfs_db")) ? cmdSupportFileSystem : cmdSupportNone;
+    m_GetUsed = cmdSupportFileSystem;
     m_Create = findExternal(QStringLiteral("mkfs.xfs")) ? cmdSupportFileSystem : cmdSupportNone;
 
     m_Check = findExternal(QStringLiteral("xfs_repair")) ? cmdSupportFileSystem : cmdSupportNone;
@@ -98,6 +104,11 @@ qint64 xfs::maxLabelLength() const
 
 qint64 xfs::readUsedCapacity(const QString& deviceNode) const
 {
+    const Superblock superblock = Superblock::read(deviceNode, type());
+
+    if (superblock.hasUsage())
+        return superblock.usedBytes();
+
     ExternalCommand cmd(QStringLiteral("xfs_db"), { QStringLiteral("-c"), QStringLiteral("sb 0"), QStringLiteral("-c"), QStringLiteral("print"), deviceNode });
 
     if (cmd.run(-1) && cmd.exitCode() == 0) {
@@ -129,6 +140,189 @@ qint64 xfs::readUsedCapacity(const QString& deviceNode) const
     return -1;
 }
 
+/** @return the cycle number of a basic block of an XFS log or -1 if it cannot be read */
+static qint64 logCycle(QFile& device, qint64 logOffset, qint64 block)
+{
+    const QByteArray data = UsedBlocksMap::readBytes(device, logOffset + block * 512, 8);
+    if (data.isEmpty())
+        return -1;
+
+    const uchar* d = reinterpret_cast<const uchar*>(data.constData());
+
+    // record headers have their magic number where all other blocks have the cycle number
+    return qFromBigEndian<quint32>(d) == 0xfeedbabe ? qFromBigEndian<quint32>(d + 4) : qFromBigEndian<quint32>(d);
+}
+
+/** Tells whether the internal log of an XFS was left clean.
+
+    The log is written in a circle and each basic block carries the cycle it was written in, so the
+    head is where the cycle number drops. A file system that was unmounted cleanly has an unmount
+    record as the last record before the head.
+
+    @param device the device the file system is on
+    @param offset byte offset of the file system in @p device
+    @param sb the superblock
+    @return true if the log has nothing in it that still needs to be replayed
+*/
+static bool isLogClean(QFile& device, qint64 offset, const uchar* sb)
+{
+    const qint64 blockSize = qFromBigEndian<quint32>(sb + 4);
+    const quint64 logStart = qFromBigEndian<quint64>(sb + 48);
+    const qint64 agBlocks = qFromBigEndian<quint32>(sb + 84);
+    const qint64 logBlocks = qFromBigEndian<quint32>(sb + 96);
+    const int agBlockLog = sb[124];
+
+    // an external log is on another device
+    if (logStart == 0 || logBlocks == 0 || agBlockLog >= 32)
+        return false;
+
+    const qint64 logOffset = offset + (static_cast<qint64>(logStart >> agBlockLog) * agBlocks + static_cast<qint64>(logStart & ((Q_UINT64_C(1) << agBlockLog) - 1))) * blockSize;
+    const qint64 logBasicBlocks = logBlocks * blockSize / 512;
+
+    const qint64 firstCycle = logCycle(device, logOffset, 0);
+    const qint64 lastCycle = logCycle(device, logOffset, logBasicBlocks - 1);
+
+    if (firstCycle < 0 || lastCycle < 0)
+        return false;
+
+    qint64 head = 0;
+
+    if (firstCycle != lastCycle) {
+        qint64 lo = 0;
+        qint64 hi = logBasicBlocks - 1;
+
+        while (hi - lo > 1) {
+            const qint64 mid = lo + (hi - lo) / 2;
+            const qint64 cycle = logCycle(device, logOffset, mid);
+
+            if (cycle < 0)
+                return false;
+
+            if (cycle == firstCycle)
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        head = hi;
+    }
+
+    // a log record is at most 256 KiB plus its headers
+    for (qint64 i = 1; i <= qMin<qint64>(1024, logBasicBlocks); i++) {
+        const qint64 block = (head - i + logBasicBlocks) % logBasicBlocks;
+        const QByteArray header = UsedBlocksMap::readBytes(device, logOffset + block * 512, 512);
+
+        if (header.isEmpty())
+            return false;
+
+        const uchar* h = reinterpret_cast<const uchar*>(header.constData());
+
+        if (qFromBigEndian<quint32>(h) != 0xfeedbabe)
+            continue;
+
+        const quint32 version = qFromBigEndian<quint32>(h + 8);
+        const qint64 numLogOps = qFromBigEndian<quint32>(h + 40);
+        const qint64 headerSize = qFromBigEndian<quint32>(h + 320);
+        const qint64 headerBlocks = (version & 2) && headerSize > 32768 ? (headerSize + 32767) / 32768 : 1;
+
+        const QByteArray op = UsedBlocksMap::readBytes(device, logOffset + (block + headerBlocks) % logBasicBlocks * 512, 12);
+
+        // XLOG_UNMOUNT_TRANS in the flags of the one operation the record has
+        return numLogOps == 1 && !op.isEmpty() && (static_cast<uchar>(op[9]) & 0x20);
+    }
+
+    return false;
+}
+
+/** Reads the used blocks from the free space btrees of all allocation groups.
+
+    Each allocation group's AGF points to a btree of free extents sorted by block number; everything
+    in the allocation group that is not in there, including the free list, counts as used. Nothing is
+    read if the log was not left clean, since the btrees may then miss allocations only in the log.
+*/
+bool xfs::readUsedBlocks(const QString& deviceNode, UsedBlocksMap& usedBlocks, qint64 offset) const
+{
+    QFile device(deviceNode);
+    if (!device.open(QIODevice::ReadOnly))
+        return false;
+
+    const QByteArray sb = UsedBlocksMap::readBytes(device, offset, 512);
+    if (sb.isEmpty() || !sb.startsWith("XFSB"))
+        return false;
+
+    const uchar* s = reinterpret_cast<const uchar*>(sb.constData());
+
+    const qint64 blockSize = qFromBigEndian<quint32>(s + 4);
+    const qint64 dataBlocks = qFromBigEndian<qint64>(s + 8);
+    const qint64 agBlocks = qFromBigEndian<quint32>(s + 84);
+    const qint64 agCount = qFromBigEndian<quint32>(s + 88);
+    const qint64 sectSize = qFromBigEndian<quint16>(s + 102);
+    const bool hasCrc = (qFromBigEndian<quint16>(s + 100) & 0x0f) == 5;
+
+    if (blockSize < 512 || blockSize > 65536 || agBlocks == 0 || sectSize < 512 || dataBlocks * blockSize > length() * usedBlocks.sectorSize())
+        return false;
+
+    if (!isLogClean(device, offset, s))
+        return false;
+
+    const qint64 headerSize = hasCrc ? 56 : 16; // short form btree block header
+    const qint64 maxRecs = (blockSize - headerSize) / 12; // keys are 8 bytes, pointers 4 bytes in internal nodes
+    const quint32 nullBlock = 0xffffffff;
+
+    for (qint64 ag = 0; ag < agCount; ag++) {
+        const qint64 agStart = ag * agBlocks * blockSize;
+
+        const QByteArray agf = UsedBlocksMap::readBytes(device, offset + agStart + sectSize, 64);
+        if (agf.isEmpty() || !agf.startsWith("XAGF"))
+            return false;
+
+        const uchar* a = reinterpret_cast<const uchar*>(agf.constData());
+        const qint64 agLength = qFromBigEndian<quint32>(a + 12);
+        quint32 bno = qFromBigEndian<quint32>(a + 16);
+        const qint64 levels = qFromBigEndian<quint32>(a + 28);
+
+        qint64 cursor = 0;
+
+        // walk down the leftmost path to the first leaf, then along the leaves from left to right
+        for (qint64 steps = 0; bno != nullBlock; steps++) {
+            if (bno >= agLength || steps > agLength)
+                return false;
+
+            const QByteArray block = UsedBlocksMap::readBytes(device, offset + agStart + bno * blockSize, blockSize);
+            if (block.isEmpty())
+                return false;
+
+            const uchar* b = reinterpret_cast<const uchar*>(block.constData());
+            const qint64 level = qFromBigEndian<quint16>(b + 4);
+            const qint64 numRecs = qFromBigEndian<quint16>(b + 6);
+
+            if (level >= levels || numRecs > maxRecs)
+                return false;
+
+            if (level > 0) {
+                bno = qFromBigEndian<quint32>(b + headerSize + maxRecs * 8);
+                continue;
+            }
+
+            for (qint64 i = 0; i < numRecs; i++) {
+                const qint64 start = qFromBigEndian<quint32>(b + headerSize + i * 8);
+                const qint64 count = qFromBigEndian<quint32>(b + headerSize + i * 8 + 4);
+
+                usedBlocks.addUsedBytes(agStart + cursor * blockSize, (start - cursor) * blockSize);
+                cursor = start + count;
+            }
+
+            bno = qFromBigEndian<quint32>(b + 12);
+        }
+
+        usedBlocks.addUsedBytes(agStart + cursor * blockSize, (agLength - cursor) * blockSize);
+    }
+
+    usedBlocks.finish(length());
+
+    return true;
+}
+
 bool xfs::writeLabel(Report& report, const QString& deviceNode, const QString& newLabel)
 {
     ExternalCommand cmd(report, QStringLiteral("xfs_db"), { QStringLiteral("-x"), QStringLiteral("-c"), QStringLiteral("sb 0"), QStringLiteral("-c"), QStringLiteral("label ") + newLabel, deviceNode });
@@ -138,6 +332,7 @@ bool xfs::writeLabel(Report& report, const QString& deviceNode, const QString& n
 bool xfs::check(Report& report, const QString& deviceNode) const
 {
     ExternalCommand cmd(report, QStringLiteral("xfs_repair"), { QStringLiteral("-v"), deviceNode });
+    cmd.setOutputLimit(64 * 1024);
     return cmd.run(-1) && cmd.exitCode() == 0;
 }
 
@@ -150,6 +345,8 @@ bool xfs::create(Report& report, const QString& deviceNode)
 bool xfs::copy(Report& report, const QString& targetDeviceNode, const QString& sourceDeviceNode) const
 {
     ExternalCommand cmd(report, QStringLiteral("xfs_copy"), { sourceDeviceNode, targetDeviceNode });
+    ProgressParser progress(report, ProgressParser::xfsCopy());
+    cmd.setProgressParser(&progress);
 
     // xfs_copy behaves a little strangely. It apparently kills itself at the end of main, causing QProcess
     // to report that it crashed.
@@ -20,15 +20,23 @@
 
 #include "core/partition.h"
 #include "core/device.h"
+#include "core/blockdigests.h"
 #include "core/copysourcedevice.h"
+#include "core/copysourcefile.h"
+#include "core/copysourceimage.h"
 #include "core/copytargetfile.h"
+#include "core/copytargetimage.h"
 
 #include "fs/filesystem.h"
 
 #include "util/report.h"
 
+#include <QFile>
+
 #include <KLocalizedString>
 
+QAtomicInt BackupFileSystemJob::s_RawImages(1);
+
 /** Creates a new BackupFileSystemJob
     @param sourcedevice the device the FileSystem to back up is on
     @param sourcepartition the Partition the FileSystem to back up is on
@@ -38,7 +46,8 @@ BackupFileSystemJob::BackupFileSystemJob(Device& sourcedevice, Partition& source
     Job(),
     m_SourceDevice(sourcedevice),
     m_SourcePartition(sourcepartition),
-    m_FileName(filename)
+    m_FileName(filename),
+    m_RawImages(s_RawImages.load() != 0)
 {
 }
 
@@ -53,18 +62,39 @@ bool BackupFileSystemJob::run(Report& parent)
 
     Report* report = jobStarted(parent);
 
+    // digests left from an earlier backup to the same file would make restoring it fail to verify
+    const QString manifest = BlockDigests::manifestName(fileName());
+    if (QFile::exists(manifest) && !QFile::remove(manifest)) {
+        report->line() << xi18nc("@info:progress", "Could not remove the digests of an earlier backup <filename>%1</filename>.", manifest);
+        jobFinished(*report, false);
+        return false;
+    }
+
     if (sourcePartition().fileSystem().supportBackup() == FileSystem::cmdSupportFileSystem)
         rval = sourcePartition().fileSystem().backup(*report, sourceDevice(), sourcePartition().deviceNode(), fileName());
     else if (sourcePartition().fileSystem().supportBackup() == FileSystem::cmdSupportCore) {
         CopySourceDevice copySource(sourceDevice(), sourcePartition().fileSystem().firstSector(), sourcePartition().fileSystem().lastSector());
-        CopyTargetFile copyTarget(fileName(), sourceDevice().logicalSize());
-
-        if (!copySource.open())
-            report->line() << xi18nc("@info:progress", "Could not open file system on source partition <filename>%1</filename> for backup.", sourcePartition().deviceNode());
-        else if (!copyTarget.open())
-            report->line() << xi18nc("@info:progress", "Could not create backup file <filename>%1</filename>.", fileName());
-        else
-            rval = copyBlocks(*report, copyTarget, copySource);
+
+        UsedBlocksMap usedBlocks(sourceDevice().logicalSize());
+        if (sourcePartition().fileSystem().readUsedBlocks(sourcePartition().deviceNode(), usedBlocks))
+            copySource.setUsedBlocks(usedBlocks);
+
+        BlockDigests digests(sourceDevice().logicalSize());
+
+        if (rawImages()) {
+            CopyTargetFile copyTarget(fileName(), sourceDevice().logicalSize());
+            rval = copyToTarget(*report, copySource, copyTarget, verify() ? &digests : nullptr);
+        } else {
+            CopyTargetImage copyTarget(fileName(), sourceDevice().logicalSize());
+            copyTarget.setFileSystem(sourcePartition().fileSystem());
+            rval = copyToTarget(*report, copySource, copyTarget, verify() ? &digests : nullptr);
+
+            if (rval && !(rval = copyTarget.close()))
+                report->line() << xi18nc("@info:progress", "Could not finish writing backup file <filename>%1</filename>.", fileName());
+        }
+
+        if (rval && verify())
+            rval = verifyBackup(*report, digests);
     }
 
     jobFinished(*report, rval);
@@ -72,6 +102,49 @@ bool BackupFileSystemJob::run(Report& parent)
     return rval;
 }
 
+/** Opens source and target and copies the file system.
+    @param report the Report to write information to
+    @param copySource the file system to back up
+    @param copyTarget the backup file
+    @return true on success
+*/
+bool BackupFileSystemJob::copyToTarget(Report& report, CopySource& copySource, CopyTarget& copyTarget, BlockDigests* digests)
+{
+    if (!copySource.open())
+        report.line() << xi18nc("@info:progress", "Could not open file system on source partition <filename>%1</filename> for backup.", sourcePartition().deviceNode());
+    else if (!copyTarget.open())
+        report.line() << xi18nc("@info:progress", "Could not create backup file <filename>%1</filename>.", fileName());
+    else
+        return copyBlocks(report, copyTarget, copySource, digests);
+
+    return false;
+}
+
+/** Reads the backup file back, compares it with the digests and saves them next to it.
+    @param report the Report to write information to
+    @param digests the digests taken while backing up
+    @return true if the backup file matches the file system
+*/
+bool BackupFileSystemJob::verifyBackup(Report& report, const BlockDigests& digests)
+{
+    bool rval = false;
+
+    if (rawImages()) {
+        CopySourceFile readBack(fileName(), sourceDevice().logicalSize());
+        rval = readBack.open() && verifyBlocks(report, readBack, digests);
+    } else {
+        CopySourceImage readBack(fileName(), sourceDevice().logicalSize());
+        rval = readBack.open() && verifyBlocks(report, readBack, digests);
+    }
+
+    if (!rval)
+        report.line() << xi18nc("@info:progress", "Verifying backup file <filename>%1</filename> failed.", fileName());
+    else if (!digests.save(BlockDigests::manifestName(fileName())))
+        report.line() << xi18nc("@info:progress", "Could not save the digests of backup file <filename>%1</filename>. Restoring it cannot be verified against the original.", fileName());
+
+    return rval;
+}
+
 QString BackupFileSystemJob::description() const
 {
     return xi18nc("@info:progress", "Back up file system on partition <filename>%1</filename> to <filename>%2</filename>", sourcePartition().deviceNode(), fileName());
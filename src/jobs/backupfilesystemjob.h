@@ -26,11 +26,16 @@
 class Partition;
 class Device;
 class Report;
+class BlockDigests;
+class CopySource;
+class CopyTarget;
 
 /** Back up a FileSystem.
 
     Backs up a FileSystem from a given Device and Partition to a file with the given filename.
 
+    By default the file is a plain sector dump. With setRawImages(false) it is a compressed BackupImage instead.
+
     @author Volker Lanz <vl@fidra.de>
 */
 class BackupFileSystemJob : public Job
@@ -43,7 +48,17 @@ public:
     qint32 numSteps() const override;
     QString description() const override;
 
+    bool rawImages() const {
+        return m_RawImages;    /**< @return true if this Job writes a plain sector dump instead of a compressed image */
+    }
+    static void setRawImages(bool b) {
+        s_RawImages.store(b);    /**< @param b true to write plain sector dumps instead of compressed images in Jobs created from now on */
+    }
+
 protected:
+    bool copyToTarget(Report& report, CopySource& copySource, CopyTarget& copyTarget, BlockDigests* digests);
+    bool verifyBackup(Report& report, const BlockDigests& digests);
+
     Partition& sourcePartition() {
         return m_SourcePartition;
     }
@@ -66,6 +81,9 @@ private:
     Device& m_SourceDevice;
     Partition& m_SourcePartition;
     QString m_FileName;
+    const bool m_RawImages;
+
+    static QAtomicInt s_RawImages;
 };
 
 #endif
@@ -35,6 +35,11 @@ CheckFileSystemJob::CheckFileSystemJob(Partition& p) :
 {
 }
 
+qint32 CheckFileSystemJob::numSteps() const
+{
+    return 100;
+}
+
 bool CheckFileSystemJob::run(Report& parent)
 {
     Report* report = jobStarted(parent);
@@ -42,9 +47,13 @@ bool CheckFileSystemJob::run(Report& parent)
     // if we cannot check, assume everything is fine
     bool rval = true;
 
-    if (partition().fileSystem().supportCheck() == FileSystem::cmdSupportFileSystem)
+    if (partition().fileSystem().supportCheck() == FileSystem::cmdSupportFileSystem) {
         rval = partition().fileSystem().check(*report, partition().deviceNode());
 
+        // repairing may have freed blocks
+        partition().fileSystem().invalidate(FileSystem::LazyUsed);
+    }
+
     jobFinished(*report, rval);
 
     return rval;
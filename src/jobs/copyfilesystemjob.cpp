@@ -20,6 +20,7 @@
 
 #include "core/partition.h"
 #include "core/device.h"
+#include "core/blockdigests.h"
 #include "core/copysourcedevice.h"
 #include "core/copytargetdevice.h"
 
@@ -60,16 +61,34 @@ bool CopyFileSystemJob::run(Report& parent)
     else if (sourcePartition().fileSystem().supportCopy() == FileSystem::cmdSupportFileSystem)
         rval = sourcePartition().fileSystem().copy(*report, targetPartition().deviceNode(), sourcePartition().deviceNode());
     else if (sourcePartition().fileSystem().supportCopy() == FileSystem::cmdSupportCore) {
-        CopySourceDevice copySource(sourceDevice(), sourcePartition().fileSystem().firstSector(), sourcePartition().fileSystem().lastSector());
-        CopyTargetDevice copyTarget(targetDevice(), targetPartition().fileSystem().firstSector(), targetPartition().fileSystem().lastSector());
-
-        if (!copySource.open())
-            report->line() << xi18nc("@info:progress", "Could not open file system on source partition <filename>%1</filename> for copying.", sourcePartition().deviceNode());
-        else if (!copyTarget.open())
-            report->line() << xi18nc("@info:progress", "Could not open file system on target partition <filename>%1</filename> for copying.", targetPartition().deviceNode());
-        else {
-            rval = copyBlocks(*report, copyTarget, copySource);
-            report->line() << xi18nc("@info:progress", "Closing device. This may take a while, especially on slow devices like Memory Sticks.");
+        BlockDigests digests(sourceDevice().logicalSize());
+
+        // a scope for copySource and copyTarget, so the target is closed before it is read back
+        {
+            CopySourceDevice copySource(sourceDevice(), sourcePartition().fileSystem().firstSector(), sourcePartition().fileSystem().lastSector());
+            CopyTargetDevice copyTarget(targetDevice(), targetPartition().fileSystem().firstSector(), targetPartition().fileSystem().lastSector());
+
+            UsedBlocksMap usedBlocks(sourceDevice().logicalSize());
+            if (sourcePartition().fileSystem().readUsedBlocks(sourcePartition().deviceNode(), usedBlocks))
+                copySource.setUsedBlocks(usedBlocks);
+
+            if (!copySource.open())
+                report->line() << xi18nc("@info:progress", "Could not open file system on source partition <filename>%1</filename> for copying.", sourcePartition().deviceNode());
+            else if (!copyTarget.open())
+                report->line() << xi18nc("@info:progress", "Could not open file system on target partition <filename>%1</filename> for copying.", targetPartition().deviceNode());
+            else {
+                rval = copyBlocks(*report, copyTarget, copySource, verify() ? &digests : nullptr);
+                report->line() << xi18nc("@info:progress", "Closing device. This may take a while, especially on slow devices like Memory Sticks.");
+            }
+        }
+
+        if (rval && verify()) {
+            CopySourceDevice readBack(targetDevice(), targetPartition().fileSystem().firstSector(), targetPartition().fileSystem().firstSector() + sourcePartition().fileSystem().length() - 1);
+
+            rval = readBack.open() && verifyBlocks(*report, readBack, digests);
+
+            if (!rval)
+                report->line() << xi18nc("@info:progress", "Verifying the copy on target partition <filename>%1</filename> failed.", targetPartition().deviceNode());
         }
     }
 
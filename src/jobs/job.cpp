@@ -18,27 +18,358 @@
 
 #include "jobs/job.h"
 
+#include "core/blockdigests.h"
 #include "core/device.h"
 #include "core/copysource.h"
 #include "core/copytarget.h"
 #include "core/copysourcedevice.h"
 #include "core/copytargetdevice.h"
 
+#include "util/capacity.h"
 #include "util/report.h"
 
+#include <QAtomicInt>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QIcon>
+#include <QList>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
 #include <QTime>
 
+#include <algorithm>
+
 #include <KIconLoader>
 #include <KLocalizedString>
 
+QAtomicInt Job::s_DirectIO(0);
+QAtomicInt Job::s_Verify(0);
+QAtomicInteger<qint64> Job::s_CopyMemoryBudget(64 * 1024 * 1024);
+
+/** Creates a new Job with the settings that are current now, so changing them does not affect Jobs that already exist. */
 Job::Job() :
-    m_Status(Pending)
+    m_Status(Pending),
+    m_DirectIO(s_DirectIO.load() != 0),
+    m_Verify(s_Verify.load() != 0),
+    m_CopyMemoryBudget(s_CopyMemoryBudget.load())
 {
 }
 
-bool Job::copyBlocks(Report& report, CopyTarget& target, CopySource& source)
+/** A run of sectors copyBlocks() reads from one offset on the CopySource and writes to another on the CopyTarget. */
+struct CopyBlock
+{
+    qint64 readOffset;
+    qint64 writeOffset;
+    qint64 numSectors;
+    bool hole; // unused by the source: nothing is read and the target only skips the sectors
+};
+
+/** A run of sectors relative to the start of the CopySource that is either used or not. */
+struct CopySegment
+{
+    qint64 offset;
+    qint64 length;
+    bool used;
+};
+
+/** Computes the BlockDigests digest of a buffer on a thread pool. */
+class DigestTask : public QRunnable
+{
+public:
+    DigestTask(const void* buffer, qint64 size, quint64& digest, QSemaphore& done) :
+        m_Buffer(buffer),
+        m_Size(size),
+        m_Digest(digest),
+        m_Done(done)
+    {
+    }
+
+    void run() override {
+        m_Digest = BlockDigests::digest(m_Buffer, m_Size);
+        m_Done.release();
+    }
+
+private:
+    const void* m_Buffer;
+    const qint64 m_Size;
+    quint64& m_Digest;
+    QSemaphore& m_Done;
+};
+
+/** A ring of reusable, aligned buffers shared by the reader and the writer in copyBlocks().
+
+    The reader fills free buffers in order and hands them to the writer; the writer hands them back
+    once their content is on the target. Two semaphores count the free and the filled buffers. Each
+    buffer also remembers the CopyBlock it currently holds and, when verifying, its digest.
+*/
+class CopyBuffers
+{
+    Q_DISABLE_COPY(CopyBuffers)
+
+public:
+    CopyBuffers(qint32 count, qint64 bufferSize, qint32 alignment, qint32 sectorSize) :
+        m_Free(count),
+        m_Filled(0),
+        m_SectorSize(sectorSize)
+    {
+        for (qint32 i = 0; i < count; i++) {
+            m_Buffers.append(qMallocAligned(bufferSize, alignment));
+            m_Blocks.append(CopyBlock());
+            m_Digests.append(0);
+            m_Digested.append(new QSemaphore(0));
+        }
+    }
+
+    ~CopyBuffers() {
+        for (void* buffer : m_Buffers)
+            qFreeAligned(buffer);
+
+        qDeleteAll(m_Digested);
+    }
+
+    /** Starts computing the digest of a block's buffer on the given thread pool.
+        @param pool the thread pool to use
+        @param block the block index
+        @see waitForDigest()
+    */
+    void startDigest(QThreadPool& pool, qint64 block) {
+        const qint32 i = block % count();
+        pool.start(new DigestTask(m_Buffers[i], m_Blocks[i].numSectors * m_SectorSize, m_Digests[i], *m_Digested[i]));
+    }
+
+    /** @return the digest of a block's buffer once startDigest() has computed it */
+    quint64 waitForDigest(qint64 block) {
+        m_Digested[block % count()]->acquire();
+        return m_Digests[block % count()];
+    }
+
+    bool isValid() const {
+        return !m_Buffers.contains(nullptr);
+    }
+    qint32 count() const {
+        return m_Buffers.size();
+    }
+    void* buffer(qint64 block) {
+        return m_Buffers[block % count()];    /**< @return the buffer used for the given block index */
+    }
+    const CopyBlock& block(qint64 block) const {
+        return m_Blocks[block % count()];    /**< @return the CopyBlock held by the buffer for the given block index */
+    }
+    void setBlock(qint64 block, const CopyBlock& b) {
+        m_Blocks[block % count()] = b;
+    }
+    QSemaphore& freeBuffers() {
+        return m_Free;
+    }
+    QSemaphore& filledBuffers() {
+        return m_Filled;
+    }
+
+private:
+    QList<void*> m_Buffers;
+    QList<CopyBlock> m_Blocks;
+    QList<quint64> m_Digests;
+    QList<QSemaphore*> m_Digested;
+    QSemaphore m_Free;
+    QSemaphore m_Filled;
+    const qint32 m_SectorSize;
+};
+
+/** Picks the number of sectors per block while copyBlocks() is running.
+
+    Starts with the initial size and doubles it every few blocks as long as the throughput the writer
+    measures keeps improving noticeably, then settles on the fastest size seen. The block size never
+    exceeds the maximum size, which is what the memory budget allows for each buffer.
+
+    The reader only calls blockSize(); everything else is called by the writer.
+*/
+class CopyBlockSizer
+{
+    Q_DISABLE_COPY(CopyBlockSizer)
+
+public:
+    CopyBlockSizer(qint64 initialSize, qint64 maxSize) :
+        m_BlockSize(initialSize),
+        m_MaxSize(maxSize),
+        m_BestSize(initialSize),
+        m_BestThroughput(0),
+        m_ProbeBlocks(0),
+        m_ProbeSectors(0),
+        m_ProbeNsecs(0),
+        m_Settled(initialSize >= maxSize)
+    {
+    }
+
+    qint64 blockSize() const {
+        return m_BlockSize.loadAcquire();    /**< @return the number of sectors the reader should put in its next block */
+    }
+    bool isSettled() const {
+        return m_Settled;    /**< @return true if the block size will not change anymore */
+    }
+
+    /** Records how long it took to get a block onto the target.
+        @param numSectors number of sectors in the block
+        @param nsecs nanoseconds since the previous block was written
+        @return true if this settled the block size
+    */
+    bool blockWritten(qint64 numSectors, qint64 nsecs) {
+        // blocks the reader queued before the last change, and the short last block, say nothing about the current size
+        if (m_Settled || numSectors != blockSize())
+            return false;
+
+        m_ProbeSectors += numSectors;
+        m_ProbeNsecs += nsecs;
+
+        if (++m_ProbeBlocks < probeBlocks)
+            return false;
+
+        const double throughput = static_cast<double>(m_ProbeSectors) / qMax(m_ProbeNsecs, Q_INT64_C(1));
+
+        m_ProbeBlocks = 0;
+        m_ProbeSectors = 0;
+        m_ProbeNsecs = 0;
+
+        if (throughput > m_BestThroughput * minImprovement) {
+            m_BestThroughput = throughput;
+            m_BestSize = blockSize();
+
+            if (m_BestSize * 2 <= m_MaxSize) {
+                m_BlockSize.storeRelease(m_BestSize * 2);
+                return false;
+            }
+        }
+
+        m_BlockSize.storeRelease(m_BestSize);
+        m_Settled = true;
+
+        return true;
+    }
+
+private:
+    static const qint32 probeBlocks = 4; // number of blocks to measure for each block size
+    static constexpr double minImprovement = 1.05; // a larger block size must be at least this much faster
+
+    QAtomicInteger<qint64> m_BlockSize;
+    const qint64 m_MaxSize;
+    qint64 m_BestSize;
+    double m_BestThroughput;
+    qint32 m_ProbeBlocks;
+    qint64 m_ProbeSectors;
+    qint64 m_ProbeNsecs;
+    bool m_Settled;
+};
+
+/** Thread reading blocks from a CopySource into CopyBuffers ahead of the writer.
+
+    The reader cuts the used segments into blocks as it goes, asking the CopyBlockSizer for the size
+    of each one. When copying backward the blocks are cut from the end, so a short last block ends
+    up at the front. Unused segments are passed on to the writer as a single hole without reading.
+
+    Reading ahead is safe for overlapping copies: the blocks are queued in copy direction, so the
+    reader only ever touches source sectors that the writer has not overwritten yet.
+*/
+class CopyBlocksReader : public QThread
+{
+public:
+    CopyBlocksReader(CopySource& source, qint64 targetFirstSector, const QList<CopySegment>& segments, qint32 copyDir, CopyBlockSizer& sizer, CopyBuffers& buffers, QThreadPool* digestPool) :
+        QThread(),
+        m_Source(source),
+        m_TargetFirstSector(targetFirstSector),
+        m_Segments(segments),
+        m_CopyDir(copyDir),
+        m_Sizer(sizer),
+        m_Buffers(buffers),
+        m_DigestPool(digestPool),
+        m_BlocksRead(0),
+        m_Cancelled(0)
+    {
+    }
+
+    /** @return the number of blocks successfully read so far */
+    qint64 blocksRead() const {
+        return m_BlocksRead.loadAcquire();
+    }
+
+    /** Stops the reader after the block it is currently reading, e.g. because writing failed. */
+    void cancel() {
+        m_Cancelled.storeRelease(1);
+        m_Buffers.freeBuffers().release();
+    }
+
+protected:
+    void run() override {
+        qint64 i = 0;
+
+        for (const CopySegment& segment : m_Segments) {
+            for (qint64 sectorsRead = 0; sectorsRead < segment.length; i++) {
+                m_Buffers.freeBuffers().acquire();
+
+                if (m_Cancelled.loadAcquire())
+                    return;
+
+                const qint64 numSectors = segment.used ? qMin(m_Sizer.blockSize(), segment.length - sectorsRead) : segment.length;
+                const qint64 offset = segment.offset + (m_CopyDir > 0 ? sectorsRead : segment.length - sectorsRead - numSectors);
+                const CopyBlock block = { m_Source.firstSector() + offset, m_TargetFirstSector + offset, numSectors, !segment.used };
+
+                m_Buffers.setBlock(i, block);
+
+                const bool ok = block.hole || m_Source.readSectors(m_Buffers.buffer(i), block.readOffset, block.numSectors);
+
+                if (ok && !block.hole && m_DigestPool)
+                    m_Buffers.startDigest(*m_DigestPool, i);
+
+                if (ok)
+                    m_BlocksRead.ref();
+
+                // wake up the writer either way, it checks blocksRead() to find out if reading failed
+                m_Buffers.filledBuffers().release();
+
+                if (!ok)
+                    return;
+
+                sectorsRead += numSectors;
+            }
+        }
+    }
+
+private:
+    CopySource& m_Source;
+    const qint64 m_TargetFirstSector;
+    const QList<CopySegment>& m_Segments;
+    const qint32 m_CopyDir;
+    CopyBlockSizer& m_Sizer;
+    CopyBuffers& m_Buffers;
+    QThreadPool* m_DigestPool;
+    QAtomicInteger<qint64> m_BlocksRead;
+    QAtomicInt m_Cancelled;
+};
+
+/** Copies all sectors from a CopySource to a CopyTarget.
+
+    Reading and writing are pipelined: a CopyBlocksReader thread reads ahead into a ring of buffers
+    while the calling thread writes the blocks already read, so neither device sits idle waiting for
+    the other.
+
+    The block size starts at the devices' optimal I/O size and is tuned by a CopyBlockSizer during the
+    first blocks; all buffers together stay within copyMemoryBudget().
+
+    If the source has a valid UsedBlocksMap, only the used sectors are copied and the target is told
+    to skip the others.
+
+    If the target lies behind the source on the same device, blocks are copied from back to front.
+
+    If digests are requested, each block is hashed on a thread pool while it is being written; see
+    verifyBlocks().
+
+    @param report the Report to write information to
+    @param target the CopyTarget to write to
+    @param source the CopySource to read from
+    @param digests if not nullptr, the digests of all blocks copied are appended to it
+    @return true on success
+*/
+bool Job::copyBlocks(Report& report, CopyTarget& target, CopySource& source, BlockDigests* digests)
 {
     /** @todo copyBlocks() assumes that source.sectorSize() == target.sectorSize(). */
 
@@ -48,40 +379,134 @@ bool Job::copyBlocks(Report& report, CopyTarget& target, CopySource& source)
     }
 
     bool rval = true;
-    const qint64 blockSize = 16065 * 8; // number of sectors per block to copy
-    const qint64 blocksToCopy = source.length() / blockSize;
+    const qint32 bufferCount = 4; // number of blocks the reader may be ahead of the writer
+    const qint32 sectorSize = source.sectorSize();
 
-    qint64 readOffset = source.firstSector();
-    qint64 writeOffset = target.firstSector();
     qint32 copyDir = 1;
 
-    if (target.firstSector() > source.firstSector()) {
-        readOffset = source.firstSector() + source.length() - blockSize;
-        writeOffset = target.firstSector() + source.length() - blockSize;
+    if (target.firstSector() > source.firstSector())
         copyDir = -1;
+
+    report.line() << xi18nc("@info:progress", "Copying %1 sectors from %2 to %3, direction: %4.", source.length(), source.firstSector(), target.firstSector(), copyDir);
+
+    QList<CopySegment> segments;
+    qint64 sectorsToCopy = source.length();
+
+    if (source.usedBlocks().isValid()) {
+        qint64 pos = 0;
+        sectorsToCopy = 0;
+
+        for (const UsedBlocksMap::Extent& e : source.usedBlocks().extents()) {
+            const qint64 first = qMin(e.first, source.length());
+            const qint64 end = qMin(e.first + e.length, source.length());
+
+            if (first > pos)
+                segments.append({ pos, first - pos, false });
+            if (end > first)
+                segments.append({ first, end - first, true });
+
+            sectorsToCopy += end - first;
+            pos = qMax(pos, end);
+        }
+
+        if (pos < source.length())
+            segments.append({ pos, source.length() - pos, false });
+
+        report.line() << xi18nc("@info:progress", "Copying only the %1 sectors in use, skipping %2 unused sectors.", sectorsToCopy, source.length() - sectorsToCopy);
+    } else
+        segments.append({ 0, source.length(), true });
+
+    if (copyDir < 0)
+        std::reverse(segments.begin(), segments.end());
+
+    if (directIO()) {
+        if (!source.setDirectIO(true))
+            report.line() << xi18nc("@info:progress", "Direct I/O is not available for the copy source, reading through the page cache.");
+        if (!target.setDirectIO(true))
+            report.line() << xi18nc("@info:progress", "Direct I/O is not available for the copy target, writing through the page cache.");
     }
 
-    report.line() << xi18nc("@info:progress", "Copying %1 blocks (%2 sectors) from %3 to %4, direction: %5.", blocksToCopy, source.length(), readOffset, writeOffset, copyDir);
+    // direct I/O needs buffers aligned to the physical sector size; page alignment does not hurt otherwise
+    const qint32 alignment = qMax(qMax(source.alignment(), target.alignment()), 4096);
 
-    qint64 blocksCopied = 0;
+    // block sizes are kept a multiple of the alignment so direct I/O never has to fall back except for the last block
+    const qint64 granularity = qMax(alignment / sectorSize, 1);
+    const auto roundUp = [granularity](qint64 sectors) {
+        return (sectors + granularity - 1) / granularity * granularity;
+    };
+
+    // no point in buffers larger than what there is to copy
+    const qint64 maxBlockSize = qMax(qMin(copyMemoryBudget() / bufferCount / sectorSize / granularity * granularity, roundUp(sectorsToCopy)), granularity);
+
+    const qint64 optimalIOSize = qMax(source.optimalIOSize(), target.optimalIOSize());
+    const qint64 initialBlockSize = qBound(granularity, roundUp((optimalIOSize > 0 ? optimalIOSize : 1024 * 1024) / sectorSize), maxBlockSize);
+
+    report.line() << xi18nc("@info:progress", "Starting with a block size of %1.", Capacity::formatByteSize(initialBlockSize * sectorSize));
+
+    CopyBuffers buffers(bufferCount, maxBlockSize * sectorSize, alignment, sectorSize);
+
+    if (!buffers.isValid()) {
+        report.line() << xi18nc("@info:progress", "Could not allocate memory for copying.");
+        return false;
+    }
+
+    // declared after the buffers, so it waits for digests still being computed before they are freed
+    QThreadPool digestPool;
+
+    CopyBlockSizer sizer(initialBlockSize, maxBlockSize);
+    CopyBlocksReader reader(source, target.firstSector(), segments, copyDir, sizer, buffers, digests ? &digestPool : nullptr);
+    reader.start();
 
-    void* buffer = malloc(blockSize * source.sectorSize());
+    qint64 blocksCopied = 0;
+    qint64 sectorsCopied = 0;
+    qint64 sectorsDone = 0; // copied or skipped
     int percent = 0;
     QTime t;
     t.start();
+    QElapsedTimer blockTimer;
+
+    for (qint64 i = 0; sectorsDone < source.length(); i++) {
+        buffers.filledBuffers().acquire();
 
-    while (blocksCopied < blocksToCopy) {
-        if (!(rval = source.readSectors(buffer, readOffset + blockSize * blocksCopied * copyDir, blockSize)))
+        if (i >= reader.blocksRead()) {
+            rval = false;
             break;
+        }
+
+        const CopyBlock block = buffers.block(i);
+
+        if (block.hole)
+            rval = target.skipSectors(block.writeOffset, block.numSectors);
+        else
+            rval = target.writeSectors(buffers.buffer(i), block.writeOffset, block.numSectors);
 
-        if (!(rval = target.writeSectors(buffer, writeOffset + blockSize * blocksCopied * copyDir, blockSize)))
+        if (!rval)
             break;
 
-        if (++blocksCopied * 100 / blocksToCopy != percent) {
-            percent = blocksCopied * 100 / blocksToCopy;
+        // the buffer may only be reused once its digest is done
+        if (digests && !block.hole)
+            digests->append({ block.readOffset - source.firstSector(), block.numSectors, buffers.waitForDigest(i) });
+
+        buffers.freeBuffers().release();
+
+        sectorsDone += block.numSectors;
+
+        if (block.hole)
+            continue;
+
+        // the first block includes filling the pipeline, so only time the ones after it
+        if (blockTimer.isValid() && sizer.blockWritten(block.numSectors, blockTimer.nsecsElapsed()))
+            report.line() << xi18nc("@info:progress", "Using a block size of %1 for copying.", Capacity::formatByteSize(sizer.blockSize() * sectorSize));
+        blockTimer.start();
+
+        sectorsCopied += block.numSectors;
+        blocksCopied++;
+
+        if (sectorsCopied * 100 / sectorsToCopy != percent) {
+            percent = sectorsCopied * 100 / sectorsToCopy;
 
             if (percent % 5 == 0 && t.elapsed() > 1000) {
-                const qint64 mibsPerSec = (blocksCopied * blockSize * source.sectorSize() / 1024 / 1024) / (t.elapsed() / 1000);
+                const qint64 mibsPerSec = (sectorsCopied * source.sectorSize() / 1024 / 1024) / (t.elapsed() / 1000);
                 const qint64 estSecsLeft = (100 - percent) * t.elapsed() / percent / 1000;
                 report.line() << xi18nc("@info:progress", "Copying %1 MiB/second, estimated time left: %2", mibsPerSec, QTime(0, 0).addSecs(estSecsLeft).toString());
             }
@@ -89,29 +514,124 @@ bool Job::copyBlocks(Report& report, CopyTarget& target, CopySource& source)
         }
     }
 
-    const qint64 lastBlock = source.length() % blockSize;
+    if (!rval)
+        reader.cancel();
 
-    // copy the remainder
-    if (rval && lastBlock > 0) {
-        Q_ASSERT(lastBlock < blockSize);
+    reader.wait();
 
-        const qint64 lastBlockReadOffset = copyDir > 0 ? readOffset + blockSize * blocksCopied : source.firstSector();
-        const qint64 lastBlockWriteOffset = copyDir > 0 ? writeOffset + blockSize * blocksCopied : target.firstSector();
+    report.line() << xi18ncp("@info:progress argument 2 is a string such as 7 sectors (localized accordingly)", "Copying 1 block (%2) finished.", "Copying %1 blocks (%2) finished.", blocksCopied, i18np("1 sector", "%1 sectors", target.sectorsWritten()));
 
-        report.line() << xi18nc("@info:progress", "Copying remainder of block size %1 from %2 to %3.", lastBlock, lastBlockReadOffset, lastBlockWriteOffset);
+    return rval;
+}
 
-        rval = source.readSectors(buffer, lastBlockReadOffset, lastBlock);
+/** Reads back what copyBlocks() copied and compares it with the digests taken while copying.
 
-        if (rval)
-            rval = target.writeSectors(buffer, lastBlockWriteOffset, lastBlock);
+    Uses the same read ahead as copyBlocks(), hashing on a thread pool. Direct I/O is turned on for
+    the source if possible, so the data really comes from the disk and not from the page cache.
 
-        if (rval)
-            emit progress(100);
+    @param report the Report to write information to
+    @param source where the data was copied to, opened for reading
+    @param digests the digests copyBlocks() or a saved manifest recorded
+    @return true if all blocks match
+*/
+bool Job::verifyBlocks(Report& report, CopySource& source, const BlockDigests& digests)
+{
+    if (source.sectorSize() != digests.sectorSize()) {
+        report.line() << xi18nc("@info:progress", "Cannot verify: The digests were computed with a different sector size.");
+        return false;
     }
 
-    free(buffer);
+    BlockDigests sorted = digests;
+    sorted.sort();
 
-    report.line() << xi18ncp("@info:progress argument 2 is a string such as 7 sectors (localized accordingly)", "Copying 1 block (%2) finished.", "Copying %1 blocks (%2) finished.", blocksCopied, i18np("1 sector", "%1 sectors", target.sectorsWritten()));
+    QList<CopySegment> segments;
+    qint64 pos = 0;
+    qint64 maxBlockSize = 1;
+    qint64 sectorsToVerify = 0;
+
+    for (const BlockDigests::Entry& e : sorted.entries()) {
+        if (e.offset < pos || e.offset + e.numSectors > source.length()) {
+            report.line() << xi18nc("@info:progress", "Cannot verify: The digests do not match the size of what was copied.");
+            return false;
+        }
+
+        if (e.offset > pos)
+            segments.append({ pos, e.offset - pos, false });
+        segments.append({ e.offset, e.numSectors, true });
+
+        pos = e.offset + e.numSectors;
+        maxBlockSize = qMax(maxBlockSize, e.numSectors);
+        sectorsToVerify += e.numSectors;
+    }
+
+    report.line() << xi18nc("@info:progress", "Verifying %1 sectors.", sectorsToVerify);
+
+    source.setDirectIO(true);
+
+    const qint32 bufferCount = 4;
+    const qint32 alignment = qMax(source.alignment(), 4096);
+
+    CopyBuffers buffers(bufferCount, maxBlockSize * source.sectorSize(), alignment, source.sectorSize());
+
+    if (!buffers.isValid()) {
+        report.line() << xi18nc("@info:progress", "Could not allocate memory for verifying.");
+        return false;
+    }
+
+    QThreadPool digestPool;
+
+    // every block is no larger than the buffers, so each used segment is read as exactly one block
+    CopyBlockSizer sizer(maxBlockSize, maxBlockSize);
+    CopyBlocksReader reader(source, 0, segments, 1, sizer, buffers, &digestPool);
+    reader.start();
+
+    bool rval = true;
+    qint32 entry = 0;
+    qint64 sectorsVerified = 0;
+    int percent = 0;
+
+    for (qint64 i = 0; entry < sorted.entries().size(); i++) {
+        buffers.filledBuffers().acquire();
+
+        if (i >= reader.blocksRead()) {
+            report.line() << xi18nc("@info:progress", "Verifying failed: Could not read back the copied data.");
+            rval = false;
+            break;
+        }
+
+        const CopyBlock block = buffers.block(i);
+
+        if (block.hole) {
+            buffers.freeBuffers().release();
+            continue;
+        }
+
+        const quint64 digest = buffers.waitForDigest(i);
+        buffers.freeBuffers().release();
+
+        const BlockDigests::Entry& e = sorted.entries()[entry++];
+
+        if (digest != e.digest) {
+            report.line() << xi18nc("@info:progress", "Verifying failed: The %1 sectors starting at sector %2 differ from what was copied.", e.numSectors, e.offset);
+            rval = false;
+            break;
+        }
+
+        sectorsVerified += e.numSectors;
+
+        if (sectorsVerified * 100 / qMax(sectorsToVerify, Q_INT64_C(1)) != percent) {
+            percent = sectorsVerified * 100 / qMax(sectorsToVerify, Q_INT64_C(1));
+            emit progress(percent);
+        }
+    }
+
+    if (!rval)
+        reader.cancel();
+
+    reader.wait();
+
+    if (rval)
+        report.line() << xi18nc("@info:progress", "Verifying %1 sectors finished successfully.", sectorsVerified);
 
     return rval;
 }
@@ -175,7 +695,12 @@ Report* Job::jobStarted(Report& parent)
 {
     emit started();
 
-    return parent.newChild(xi18nc("@info:progress", "Job: %1", description()));
+    Report* report = parent.newChild(xi18nc("@info:progress", "Job: %1", description()));
+
+    // external tools that report their progress do so in percent
+    connect(report, &Report::progressChanged, this, [this] (int percent) { emitProgress(percent * numSteps() / 100); });
+
+    return report;
 }
 
 void Job::jobFinished(Report& report, bool b)
@@ -23,12 +23,14 @@
 
 #include "util/libpartitionmanagerexport.h"
 
+#include <QAtomicInt>
 #include <QObject>
 #include <QtGlobal>
 
 class QString;
 class QIcon;
 
+class BlockDigests;
 class CopySource;
 class CopyTarget;
 class Report;
@@ -82,8 +84,28 @@ public:
 
     void emitProgress(int i);
 
+    bool directIO() const {
+        return m_DirectIO;    /**< @return true if this Job's copying bypasses the page cache where possible */
+    }
+    static void setDirectIO(bool b) {
+        s_DirectIO.store(b);    /**< @param b true to bypass the page cache when moving, copying, backing up, restoring and shredding in Jobs created from now on */
+    }
+    bool verify() const {
+        return m_Verify;    /**< @return true if this Job reads back and compares copied data after copying */
+    }
+    static void setVerify(bool b) {
+        s_Verify.store(b);    /**< @param b true to read back and compare copied data after moving, copying, backing up and restoring in Jobs created from now on */
+    }
+    qint64 copyMemoryBudget() const {
+        return m_CopyMemoryBudget;    /**< @return the number of bytes this Job's copying may use for its buffers */
+    }
+    static void setCopyMemoryBudget(qint64 bytes) {
+        s_CopyMemoryBudget.store(bytes);    /**< @param bytes the number of bytes copying may use for its buffers in Jobs created from now on; this limits the block size */
+    }
+
 protected:
-    bool copyBlocks(Report& report, CopyTarget& target, CopySource& source);
+    bool copyBlocks(Report& report, CopyTarget& target, CopySource& source, BlockDigests* digests = nullptr);
+    bool verifyBlocks(Report& report, CopySource& source, const BlockDigests& digests);
     bool rollbackCopyBlocks(Report& report, CopyTarget& origTarget, CopySource& origSource);
 
     Report* jobStarted(Report& parent);
@@ -95,6 +117,13 @@ protected:
 
 private:
     JobStatus m_Status;
+    const bool m_DirectIO;
+    const bool m_Verify;
+    const qint64 m_CopyMemoryBudget;
+
+    static QAtomicInt s_DirectIO;
+    static QAtomicInt s_Verify;
+    static QAtomicInteger<qint64> s_CopyMemoryBudget;
 };
 
 #endif
@@ -20,9 +20,12 @@
 
 #include "core/partition.h"
 #include "core/device.h"
+#include "core/blockdigests.h"
 #include "core/copysourcedevice.h"
 #include "core/copytargetdevice.h"
 
+#include "fs/filesystem.h"
+
 #include "util/report.h"
 
 #include <KLocalizedString>
@@ -51,6 +54,8 @@ bool MoveFileSystemJob::run(Report& parent)
 
     Report* report = jobStarted(parent);
 
+    BlockDigests digests(device().logicalSize());
+
     // A scope for moveSource and moveTarget, so CopyTargetDevice's dtor runs before we
     // say we're finished: The CopyTargetDevice dtor asks the backend to close the device
     // and that may take a while.
@@ -58,12 +63,19 @@ bool MoveFileSystemJob::run(Report& parent)
         CopySourceDevice moveSource(device(), partition().fileSystem().firstSector(), partition().fileSystem().lastSector());
         CopyTargetDevice moveTarget(device(), newStart(), newStart() + partition().fileSystem().length());
 
+        // the partition already has its new geometry, so its device node no longer shows the
+        // file system where it is now: read the map through the disk at the old location
+        UsedBlocksMap usedBlocks(device().logicalSize());
+        if (device().type() == Device::Disk_Device &&
+                partition().fileSystem().readUsedBlocks(device().deviceNode(), usedBlocks, partition().fileSystem().firstSector() * device().logicalSize()))
+            moveSource.setUsedBlocks(usedBlocks);
+
         if (!moveSource.open())
             report->line() << xi18nc("@info:progress", "Could not open file system on partition <filename>%1</filename> for moving.", partition().deviceNode());
         else if (!moveTarget.open())
             report->line() << xi18nc("@info:progress", "Could not create target for moving file system on partition <filename>%1</filename>.", partition().deviceNode());
         else {
-            rval = copyBlocks(*report, moveTarget, moveSource);
+            rval = copyBlocks(*report, moveTarget, moveSource, verify() ? &digests : nullptr);
 
             if (rval) {
                 const qint64 savedLength = partition().fileSystem().length() - 1;
@@ -76,6 +88,15 @@ bool MoveFileSystemJob::run(Report& parent)
         }
     }
 
+    if (rval && verify()) {
+        CopySourceDevice readBack(device(), partition().fileSystem().firstSector(), partition().fileSystem().lastSector());
+
+        rval = readBack.open() && verifyBlocks(*report, readBack, digests);
+
+        if (!rval)
+            report->line() << xi18nc("@info:progress", "Verifying the moved file system on partition <filename>%1</filename> failed.", partition().deviceNode());
+    }
+
     if (rval)
         rval = partition().fileSystem().updateBootSector(*report, partition().deviceNode());
 
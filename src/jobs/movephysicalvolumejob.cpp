@@ -34,6 +34,11 @@ MovePhysicalVolumeJob::MovePhysicalVolumeJob(LvmDevice& d, const QList <const Pa
 {
 }
 
+qint32 MovePhysicalVolumeJob::numSteps() const
+{
+    return 100;
+}
+
 bool MovePhysicalVolumeJob::run(Report& parent)
 {
     bool rval = false;
@@ -34,6 +34,7 @@ public:
 
 public:
     bool run(Report& parent) override;
+    qint32 numSteps() const override;
     QString description() const override;
 
 
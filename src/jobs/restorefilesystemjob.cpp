@@ -25,7 +25,11 @@
 
 #include "core/partition.h"
 #include "core/device.h"
+#include "core/backupimage.h"
+#include "core/blockdigests.h"
 #include "core/copysourcefile.h"
+#include "core/copysourceimage.h"
+#include "core/copysourcedevice.h"
 #include "core/copytargetdevice.h"
 
 #include "fs/filesystem.h"
@@ -55,31 +59,98 @@ qint32 RestoreFileSystemJob::numSteps() const
 
 bool RestoreFileSystemJob::run(Report& parent)
 {
-    // Restoring is file system independent because we currently have no way of
-    // detecting the file system in a given image file. We cannot even find out if the
-    // file the user gave us is a valid image file or just some junk.
+    // Images written by BackupFileSystemJob describe the file system they contain and are checked
+    // before anything is written. Plain sector dumps are restored blindly and the file system is
+    // detected on the target afterwards.
 
     bool rval = false;
 
     Report* report = jobStarted(parent);
 
+    BlockDigests digests(targetDevice().logicalSize());
+
     // Again, a scope for copyTarget and copySource. See MoveFileSystemJob::run()
     {
         // FileSystems are restored to _partitions_, so don't use first and last sector of file system here
         CopyTargetDevice copyTarget(targetDevice(), targetPartition().firstSector(), targetPartition().lastSector());
-        CopySourceFile copySource(fileName(), copyTarget.sectorSize());
 
-        if (!copySource.open())
-            report->line() << xi18nc("@info:progress", "Could not open backup file <filename>%1</filename> to restore from.", fileName());
-        else if (!copyTarget.open())
-            report->line() << xi18nc("@info:progress", "Could not open target partition <filename>%1</filename> to restore to.", targetPartition().deviceNode());
-        else {
-            rval = copyBlocks(*report, copyTarget, copySource);
+        if (BackupImage::isImage(fileName())) {
+            CopySourceImage copySource(fileName(), copyTarget.sectorSize());
+            rval = restoreFrom(*report, copyTarget, copySource, &copySource.header(), verify() ? &digests : nullptr);
+        } else {
+            CopySourceFile copySource(fileName(), copyTarget.sectorSize());
+            rval = restoreFrom(*report, copyTarget, copySource, nullptr, verify() ? &digests : nullptr);
+        }
+    }
+
+    if (rval && verify())
+        rval = verifyRestore(*report, digests);
+
+    jobFinished(*report, rval);
+
+    return rval;
+}
+
+/** Reads the restored partition back and compares it with the backup.
+
+    If the digests saved when the backup was made are next to the backup file, those are used, so
+    damage to the backup file since then is found too. Otherwise the digests taken while restoring
+    are used.
+
+    @param report the Report to write information to
+    @param digests the digests taken while restoring
+    @return true if the partition matches
+*/
+bool RestoreFileSystemJob::verifyRestore(Report& report, const BlockDigests& digests)
+{
+    BlockDigests manifest;
+    const bool haveManifest = manifest.load(BlockDigests::manifestName(fileName()));
 
-            if (rval) {
-                // create a new file system for what was restored with the length of the image file
-                const qint64 newLastSector = targetPartition().firstSector() + copySource.length() - 1;
+    if (haveManifest)
+        report.line() << xi18nc("@info:progress", "Verifying against the digests saved with backup file <filename>%1</filename>.", fileName());
 
+    CopySourceDevice readBack(targetDevice(), targetPartition().firstSector(), targetPartition().lastSector());
+    const bool rval = readBack.open() && verifyBlocks(report, readBack, haveManifest ? manifest : digests);
+
+    if (!rval)
+        report.line() << xi18nc("@info:progress", "Verifying the restored file system on partition <filename>%1</filename> failed.", targetPartition().deviceNode());
+
+    return rval;
+}
+
+/** Opens source and target, copies the image and sets up the restored file system.
+    @param report the Report to write information to
+    @param copyTarget the Partition to restore to
+    @param copySource the backup file
+    @param header the header of a BackupImage or nullptr for a plain sector dump
+    @param digests if not nullptr, the digests of all blocks restored are appended to it
+    @return true on success
+*/
+bool RestoreFileSystemJob::restoreFrom(Report& report, CopyTargetDevice& copyTarget, CopySource& copySource, const BackupImage::Header* header, BlockDigests* digests)
+{
+    bool rval = false;
+
+    if (!copySource.open()) {
+        if (header)
+            report.line() << xi18nc("@info:progress", "Backup file <filename>%1</filename> is damaged, incomplete or was made for a different sector size.", fileName());
+        else
+            report.line() << xi18nc("@info:progress", "Could not open backup file <filename>%1</filename> to restore from.", fileName());
+    } else if (copySource.length() > targetPartition().length())
+        report.line() << xi18nc("@info:progress", "Backup file <filename>%1</filename> does not fit on partition <filename>%2</filename>.", fileName(), targetPartition().deviceNode());
+    else if (!copyTarget.open())
+        report.line() << xi18nc("@info:progress", "Could not open target partition <filename>%1</filename> to restore to.", targetPartition().deviceNode());
+    else {
+        rval = copyBlocks(report, copyTarget, copySource, digests);
+
+        if (rval) {
+            // create a new file system for what was restored with the length of the image file
+            const qint64 newLastSector = targetPartition().firstSector() + copySource.length() - 1;
+
+            FileSystem* fs = nullptr;
+
+            if (header && header->fileSystemType > FileSystem::Unknown && header->fileSystemType < FileSystem::__lastType)
+                fs = FileSystemFactory::create(static_cast<FileSystem::Type>(header->fileSystemType), targetPartition().firstSector(), newLastSector, header->sectorsUsed, header->label, header->uuid);
+            else {
                 CoreBackendDevice* backendDevice = CoreBackendManager::self()->backend()->openDevice(targetDevice().deviceNode());
 
                 FileSystem::Type t = FileSystem::Unknown;
@@ -88,20 +159,18 @@ bool RestoreFileSystemJob::run(Report& parent)
                     CoreBackendPartitionTable* backendPartitionTable = backendDevice->openPartitionTable();
 
                     if (backendPartitionTable)
-                        t = backendPartitionTable->detectFileSystemBySector(*report, targetDevice(), targetPartition().firstSector());
+                        t = backendPartitionTable->detectFileSystemBySector(report, targetDevice(), targetPartition().firstSector());
                 }
 
-                FileSystem* fs = FileSystemFactory::create(t, targetPartition().firstSector(), newLastSector);
-
-                targetPartition().deleteFileSystem();
-                targetPartition().setFileSystem(fs);
+                fs = FileSystemFactory::create(t, targetPartition().firstSector(), newLastSector);
             }
 
-            report->line() << xi18nc("@info:progress", "Closing device. This may take a few seconds.");
+            targetPartition().deleteFileSystem();
+            targetPartition().setFileSystem(fs);
         }
-    }
 
-    jobFinished(*report, rval);
+        report.line() << xi18nc("@info:progress", "Closing device. This may take a few seconds.");
+    }
 
     return rval;
 }
@@ -21,15 +21,21 @@
 
 #include "jobs/job.h"
 
+#include "core/backupimage.h"
+
 #include <QString>
 
 class Partition;
 class Device;
 class Report;
+class BlockDigests;
+class CopySource;
+class CopyTargetDevice;
 
 /** Restore a FileSystem.
 
-    Restores a FileSystem from a file to a given Partition on a given Device.
+    Restores a FileSystem from a file to a given Partition on a given Device. The file may be a
+    compressed BackupImage or a plain sector dump.
 
     @author Volker Lanz <vl@fidra.de>
 */
@@ -44,6 +50,9 @@ public:
     QString description() const override;
 
 protected:
+    bool restoreFrom(Report& report, CopyTargetDevice& copyTarget, CopySource& copySource, const BackupImage::Header* header, BlockDigests* digests);
+    bool verifyRestore(Report& report, const BlockDigests& digests);
+
     Partition& targetPartition() {
         return m_TargetPartition;
     }
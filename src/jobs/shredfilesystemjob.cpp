@@ -72,7 +72,8 @@ bool ShredFileSystemJob::run(Report& parent)
         else if (!copyTarget.open())
             report->line() << xi18nc("@info:progress", "Could not open target partition <filename>%1</filename> to restore to.", partition().deviceNode());
         else {
-            rval = copyBlocks(*report, copyTarget, copySource);
+            if (m_RandomShred || !zeroSectors(*report, copyTarget, copySource.length(), rval))
+                rval = copyBlocks(*report, copyTarget, copySource);
             report->line() << i18nc("@info:progress", "Closing device. This may take a few seconds.");
         }
     }
@@ -82,6 +83,43 @@ bool ShredFileSystemJob::run(Report& parent)
     return rval;
 }
 
+/** Overwrites the FileSystem with zeros without sending any zeros to the Device.
+
+    The Device is asked to zero the sectors itself in chunks of 256 MiB, so progress can be
+    shown. If it cannot do that at all, nothing has been written and the zeros are copied as usual.
+
+    @param report the Report to write information to
+    @param target the CopyTargetDevice to zero
+    @param length the number of sectors to zero
+    @param rval set to true if zeroing succeeded
+    @return false if the Device does not support zeroing
+*/
+bool ShredFileSystemJob::zeroSectors(Report& report, CopyTargetDevice& target, qint64 length, bool& rval)
+{
+    const qint64 chunk = 256 * 1024 * 1024 / target.sectorSize();
+
+    for (qint64 sectorsZeroed = 0; sectorsZeroed < length; ) {
+        const qint64 numSectors = qMin(chunk, length - sectorsZeroed);
+
+        if (!target.zeroSectors(target.firstSector() + sectorsZeroed, numSectors)) {
+            if (sectorsZeroed == 0)
+                return false;
+
+            report.line() << xi18nc("@info:progress", "Zeroing %1 sectors at sector %2 failed.", numSectors, target.firstSector() + sectorsZeroed);
+            rval = false;
+            return true;
+        }
+
+        sectorsZeroed += numSectors;
+        emitProgress(sectorsZeroed * 100 / length);
+    }
+
+    report.line() << xi18nc("@info:progress", "The device zeroed %1 sectors itself.", length);
+    rval = true;
+
+    return true;
+}
+
 QString ShredFileSystemJob::description() const
 {
     return xi18nc("@info:progress", "Shred the file system on <filename>%1</filename>", partition().deviceNode());
@@ -23,6 +23,7 @@
 
 #include <QString>
 
+class CopyTargetDevice;
 class Partition;
 class Device;
 class Report;
@@ -44,6 +45,8 @@ public:
     QString description() const override;
 
 protected:
+    bool zeroSectors(Report& report, CopyTargetDevice& target, qint64 length, bool& rval);
+
     Partition& partition() {
         return m_Partition;
     }
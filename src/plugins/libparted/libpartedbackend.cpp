@@ -24,10 +24,14 @@
 #include "plugins/libparted/libparteddevice.h"
 #include "plugins/libparted/pedflags.h"
 
+#include "core/blockdeviceinfo.h"
 #include "core/diskdevice.h"
+#include "core/lvminventory.h"
+#include "core/mounttable.h"
 #include "core/partition.h"
 #include "core/partitiontable.h"
 #include "core/partitionalignment.h"
+#include "core/scancache.h"
 
 #include "fs/filesystem.h"
 #include "fs/filesystemfactory.h"
@@ -38,15 +42,24 @@
 #include "fs/luks.h"
 #include "fs/lvm2_pv.h"
 
+#include "util/blkidprobe.h"
+#include "util/crc32.h"
 #include "util/globallog.h"
-#include "util/externalcommand.h"
 #include "util/helpers.h"
 
-#include <blkid/blkid.h>
-
+#include <QAtomicInt>
 #include <QDebug>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QScopedPointer>
+#include <QSemaphore>
 #include <QString>
 #include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+#include <QtEndian>
 
 #include <KLocalizedString>
 #include <KDiskFreeSpaceInfo>
@@ -58,6 +71,13 @@ K_PLUGIN_FACTORY_WITH_JSON(LibPartedBackendFactory, "pmlibpartedbackendplugin.js
 
 static QString s_lastPartedExceptionMessage;
 
+/** libparted keeps global state (the list of known devices, the exception handler and its
+    message) and is not thread safe. Devices are scanned concurrently, so all libparted calls made
+    while scanning hold this lock. Everything else, in particular running external tools, happens
+    without it.
+*/
+static QMutex s_PedMutex;
+
 /** Callback to handle exceptions from libparted
     @param e the libparted exception to handle
 */
@@ -70,89 +90,65 @@ static PedExceptionOption pedExceptionHandler(PedException* e)
 
 // --------------------------------------------------------------------------
 
-// The following structs and the typedef come from libparted's internal gpt sources.
-// It's very unfortunate there is no public API to get at the first and last usable
-// sector for GPT a partition table, so this is the only (libparted) way to get that
-// information (another way would be to read the GPT header and parse the
-// information ourselves; if the libparted devs begin changing these internal
-// structs for each point release and break our code, we'll have to do just that).
-
-typedef struct {
-    uint32_t time_low;
-    uint16_t time_mid;
-    uint16_t time_hi_and_version;
-    uint8_t  clock_seq_hi_and_reserved;
-    uint8_t  clock_seq_low;
-    uint8_t  node[6];
-} /* __attribute__ ((packed)) */ efi_guid_t;
-
-
-struct __attribute__((packed)) _GPTDiskData {
-    PedGeometry data_area;
-    int     entry_count;
-    efi_guid_t  uuid;
-};
+/** Reads the first and last usable sector from a GPT header.
 
-typedef struct _GPTDiskData GPTDiskData;
+    libparted has no public API for these, so the GPT header is read directly: the primary
+    header in the second sector and, if that is damaged, the backup header in the last sector.
 
-// --------------------------------------------------------------------------
-
-/** Get the first sector a Partition may cover on a given Device
-    @param d the Device in question
-    @return the first sector usable by a Partition
+    @param deviceNode the device to read from
+    @param sectorSize the device's logical sector size
+    @param length the device's length in sectors
+    @param firstUsable set to the first usable sector on success
+    @param lastUsable set to the last usable sector on success
+    @return true if a valid GPT header was found
 */
-static quint64 firstUsableSector(const Device& d)
+static bool readGptUsableSectors(const QString& deviceNode, qint32 sectorSize, qint64 length, qint64& firstUsable, qint64& lastUsable)
 {
-    PedDevice* pedDevice = ped_device_get(d.deviceNode().toLatin1().constData());
-    PedDisk* pedDisk = pedDevice ? ped_disk_new(pedDevice) : nullptr;
+    QFile device(deviceNode);
 
-    quint64 rval = 0;
-    if (pedDisk)
-        rval = pedDisk->dev->bios_geom.sectors;
+    if (!device.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+        return false;
 
-    if (pedDisk && strcmp(pedDisk->type->name, "gpt") == 0) {
-        GPTDiskData* gpt_disk_data = reinterpret_cast<GPTDiskData*>(pedDisk->disk_specific);
-        PedGeometry* geom = reinterpret_cast<PedGeometry*>(&gpt_disk_data->data_area);
+    const auto le32 = [](const QByteArray& b, qint32 offset) {
+        return qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(b.constData()) + offset);
+    };
+    const auto le64 = [](const QByteArray& b, qint32 offset) {
+        return qFromLittleEndian<quint64>(reinterpret_cast<const uchar*>(b.constData()) + offset);
+    };
 
-        if (geom)
-            rval = geom->start;
-        else
-            rval += 32;
-    }
+    for (const qint64 lba : { qint64(1), length - 1 }) {
+        if (!device.seek(lba * sectorSize))
+            continue;
 
-    ped_disk_destroy(pedDisk);
+        QByteArray header = device.read(sectorSize);
 
-    return rval;
-}
+        if (header.size() < 92 || !header.startsWith("EFI PART"))
+            continue;
 
-/** Get the last sector a Partition may cover on a given Device
-    @param d the Device in question
-    @return the last sector usable by a Partition
-*/
-static quint64 lastUsableSector(const Device& d)
-{
-    PedDevice* pedDevice = ped_device_get(d.deviceNode().toLatin1().constData());
-    PedDisk* pedDisk = pedDevice ? ped_disk_new(pedDevice) : nullptr;
+        const quint32 headerSize = le32(header, 12);
+        const quint32 headerCrc = le32(header, 16);
 
-    quint64 rval = 0;
-    if (pedDisk)
-        rval = static_cast< quint64 >( pedDisk->dev->bios_geom.sectors ) *
-               pedDisk->dev->bios_geom.heads *
-               pedDisk->dev->bios_geom.cylinders - 1;
+        if (headerSize < 92 || headerSize > static_cast<quint32>(header.size()))
+            continue;
 
-    if (pedDisk && strcmp(pedDisk->type->name, "gpt") == 0) {
-        GPTDiskData* gpt_disk_data = reinterpret_cast<GPTDiskData*>(pedDisk->disk_specific);
-        PedGeometry* geom = reinterpret_cast<PedGeometry*>(&gpt_disk_data->data_area);
+        // the checksum is computed with the checksum field set to zero
+        qToLittleEndian<quint32>(0, reinterpret_cast<uchar*>(header.data()) + 16);
 
-        if (geom)
-            rval = geom->end;
-        else
-            rval -= 32;
-    }
+        if (checksumCrc32(header.constData(), headerSize) != headerCrc || le64(header, 24) != static_cast<quint64>(lba))
+            continue;
 
-    ped_disk_destroy(pedDisk);
+        const qint64 first = le64(header, 40);
+        const qint64 last = le64(header, 48);
 
-    return rval;
+        if (first <= 0 || last < first || last >= length)
+            continue;
+
+        firstUsable = first;
+        lastUsable = last;
+        return true;
+    }
+
+    return false;
 }
 
 /** Reads sectors used on a FileSystem using libparted functions.
@@ -167,6 +163,8 @@ static qint64 readSectorsUsedLibParted(PedDisk* pedDisk, const Partition& p)
 
     qint64 rval = -1;
 
+    QMutexLocker locker(&s_PedMutex);
+
     PedPartition* pedPartition = ped_disk_get_partition_by_sector(pedDisk, p.firstSector());
 
     if (pedPartition) {
@@ -187,11 +185,16 @@ static qint64 readSectorsUsedLibParted(PedDisk* pedDisk, const Partition& p)
 #endif
 
 /** Reads the sectors used in a FileSystem and stores the result in the Partition's FileSystem object.
+
+    Reading the sectors used of an unmounted FileSystem means running a tool, so that is not done
+    here; LazyUsed is added to lazy instead and it is read when it is first asked for.
+
     @param pedDisk pointer to pedDisk  where the Partition and its FileSystem are
     @param p the Partition the FileSystem is on
     @param mountPoint mount point of the partition in question
+    @param lazy the attributes to read when they are first asked for
 */
-static void readSectorsUsed(PedDisk* pedDisk, const Device& d, Partition& p, const QString& mountPoint)
+static void readSectorsUsed(PedDisk* pedDisk, const Device& d, Partition& p, const QString& mountPoint, FileSystem::LazyAttributes& lazy)
 {
     if (!mountPoint.isEmpty() && p.fileSystem().type() != FileSystem::LinuxSwap && p.fileSystem().type() != FileSystem::Lvm2_PV) {
         const KDiskFreeSpaceInfo freeSpaceInfo = KDiskFreeSpaceInfo::freeSpaceInfo(mountPoint);
@@ -201,7 +204,7 @@ static void readSectorsUsed(PedDisk* pedDisk, const Device& d, Partition& p, con
             p.fileSystem().setSectorsUsed(freeSpaceInfo.used() / d.logicalSize());
     }
     else if (p.fileSystem().supportGetUsed() == FileSystem::cmdSupportFileSystem)
-        p.fileSystem().setSectorsUsed(p.fileSystem().readUsedCapacity(p.deviceNode()) / d.logicalSize());
+        lazy |= FileSystem::LazyUsed;
 #if defined LIBPARTED_FS_RESIZE_LIBRARY_SUPPORT
     else if (p.fileSystem().supportGetUsed() == FileSystem::cmdSupportCore)
         p.fileSystem().setSectorsUsed(readSectorsUsedLibParted(pedDisk, p));
@@ -277,11 +280,136 @@ void LibPartedBackend::initFSSupport()
 #endif
 }
 
+/** What scanning needs to know about a PedPartition, read while holding the libparted lock. */
+struct PedPartitionInfo
+{
+    PedPartitionType type;
+    qint64 first;
+    qint64 last;
+    QString node;
+    PartitionTable::Flags availableFlags;
+    PartitionTable::Flags activeFlags;
+};
+
+/** What probing a partition found, before it is put into the partition table. */
+struct PartitionProbe
+{
+    FileSystem* fs = nullptr;
+    PartitionRole::Roles roles = PartitionRole::None;
+    QString mountPoint;
+    bool mounted = false;
+    FileSystem::LazyAttributes lazy = FileSystem::LazyNone;
+};
+
+/** @return the thread pool partitions are probed on, shared by all devices scanned at once */
+static QThreadPool& partitionProbePool()
+{
+    // this caps the probes running at once for all devices together, so a JBOD with dozens of
+    // partitions per disk does not start hundreds
+    static QThreadPool* pool = createThreadPool(4, 16);
+
+    return *pool;
+}
+
+/** Probes one partition found by scanDevicePartitions() on a worker thread.
+
+    Everything done here only depends on the partition itself: its file system, LUKS mapping and
+    mount status. Building the partition table from the results is left to the caller.
+*/
+class ProbePartitionTask : public QRunnable
+{
+public:
+    ProbePartitionTask(LibPartedBackend& backend, const Device& device, const PedPartitionInfo& info, PartitionProbe& probe, QSemaphore& done) :
+        m_Backend(backend),
+        m_Device(device),
+        m_Info(info),
+        m_Probe(probe),
+        m_Done(done)
+    {
+    }
+
+    void run() override {
+        probe();
+        m_Done.release();
+    }
+
+private:
+    void probe();
+
+private:
+    LibPartedBackend& m_Backend;
+    const Device& m_Device;
+    const PedPartitionInfo& m_Info;
+    PartitionProbe& m_Probe;
+    QSemaphore& m_Done;
+};
+
+void ProbePartitionTask::probe()
+{
+    FileSystem::Type type = FileSystem::Unknown;
+
+    switch (m_Info.type) {
+    case PED_PARTITION_NORMAL:
+        m_Probe.roles = PartitionRole::Primary;
+        type = m_Backend.detectFileSystem(m_Info.node);
+        break;
+
+    case PED_PARTITION_EXTENDED:
+        m_Probe.roles = PartitionRole::Extended;
+        type = FileSystem::Extended;
+        break;
+
+    case PED_PARTITION_LOGICAL:
+        m_Probe.roles = PartitionRole::Logical;
+        type = m_Backend.detectFileSystem(m_Info.node);
+        break;
+
+    default:
+        return;
+    }
+
+    FileSystem* fs = FileSystemFactory::create(type, m_Info.first, m_Info.last);
+    fs->scan(m_Info.node);
+
+    // libparted does not handle LUKS partitions
+    if (fs->type() == FileSystem::Luks) {
+        m_Probe.roles |= PartitionRole::Luks;
+        FS::luks* luksFs = static_cast<FS::luks*>(fs);
+        luksFs->initLUKS(m_Device.logicalSize());
+        QString mapperNode = luksFs->mapperName();
+        m_Probe.mountPoint = FileSystem::detectMountPoint(fs, mapperNode);
+        m_Probe.mounted    = FileSystem::detectMountStatus(fs, mapperNode);
+    } else {
+        m_Probe.mountPoint = FileSystem::detectMountPoint(fs, m_Info.node);
+        m_Probe.mounted = FileSystem::detectMountStatus(fs, m_Info.node);
+    }
+
+    // GPT partitions support partition labels and partition UUIDs
+    const bool readLabel = fs->supportGetLabel() != FileSystem::cmdSupportNone || m_Device.partitionTable()->type() == PartitionTable::TableType::gpt;
+    const bool readUUID = fs->supportGetUUID() != FileSystem::cmdSupportNone;
+
+    // the label and UUID of LUKS come from the LUKS header read above, so there is nothing to save
+    if (fs->type() == FileSystem::Luks) {
+        if (readLabel)
+            fs->setLabel(fs->readLabel(m_Info.node));
+        if (readUUID)
+            fs->setUUID(fs->readUUID(m_Info.node));
+    } else {
+        if (readLabel)
+            m_Probe.lazy |= FileSystem::LazyLabel;
+        if (readUUID)
+            m_Probe.lazy |= FileSystem::LazyUUID;
+    }
+
+    m_Probe.fs = fs;
+}
+
 /** Scans a Device for Partitions.
 
     This method  will scan a Device for all Partitions on it, detect the FileSystem for each Partition,
     try to determine the FileSystem usage, read the FileSystem label and store it all in newly created
-    objects that are in the end added to the Device's PartitionTable.
+    objects that are in the end added to the Device's PartitionTable. Usage, label and UUID are only
+    read when first asked for if that takes running a tool (see FileSystem::setLazy()).
 
     @param d Device
     @param pedDisk libparted pointer to the partition table
@@ -291,79 +419,63 @@ void LibPartedBackend::scanDevicePartitions(Device& d, PedDisk* pedDisk)
     Q_ASSERT(pedDisk);
     Q_ASSERT(d.partitionTable());
 
-    PedPartition* pedPartition = nullptr;
+    // First read everything needed from libparted while holding its lock, then detect file systems,
+    // mount points, labels and so on without it, so other devices can be scanned in the meantime.
+    QList<PedPartitionInfo> pedPartitions;
 
-    QList<Partition*> partitions;
+    {
+        QMutexLocker locker(&s_PedMutex);
 
-    while ((pedPartition = ped_disk_next_partition(pedDisk, pedPartition))) {
-        if (pedPartition->num < 1)
-            continue;
+        PedPartition* pedPartition = nullptr;
+
+        while ((pedPartition = ped_disk_next_partition(pedDisk, pedPartition))) {
+            if (pedPartition->num < 1)
+                continue;
+
+            char* pedPath = ped_partition_get_path(pedPartition);
+            const QString partitionNode = pedPath ? QString::fromUtf8(pedPath) : QString();
+            free(pedPath);
 
-        PartitionRole::Roles r = PartitionRole::None;
+            pedPartitions.append({ pedPartition->type, pedPartition->geom.start, pedPartition->geom.end, partitionNode, availableFlags(pedPartition), activeFlags(pedPartition) });
+        }
+    }
 
-        FileSystem::Type type = FileSystem::Unknown;
-        char* pedPath = ped_partition_get_path(pedPartition);
-        const QString partitionNode = pedPath ? QString::fromUtf8(pedPath) : QString();
-        free(pedPath);
-        type = detectFileSystem(partitionNode);
+    // Probing one partition does not depend on any other, so they are probed concurrently. The
+    // partition table is built from the results afterwards, in the order libparted lists them.
+    const qint32 count = pedPartitions.size();
+    QVector<PartitionProbe> probes(count);
+    QSemaphore done;
 
-        switch (pedPartition->type) {
-        case PED_PARTITION_NORMAL:
-            r = PartitionRole::Primary;
-            break;
+    for (qint32 i = 0; i < count; ++i)
+        partitionProbePool().start(new ProbePartitionTask(*this, d, pedPartitions[i], probes[i], done));
 
-        case PED_PARTITION_EXTENDED:
-            r = PartitionRole::Extended;
-            type = FileSystem::Extended;
-            break;
+    done.acquire(count);
+
+    QList<Partition*> partitions;
 
-        case PED_PARTITION_LOGICAL:
-            r = PartitionRole::Logical;
-            break;
+    for (qint32 i = 0; i < count; ++i) {
+        const PedPartitionInfo& pedPartition = pedPartitions[i];
+        const PartitionProbe& probe = probes[i];
 
-        default:
+        if (probe.fs == nullptr)
             continue;
-        }
 
         // Find an extended partition this partition is in.
-        PartitionNode* parent = d.partitionTable()->findPartitionBySector(pedPartition->geom.start, PartitionRole(PartitionRole::Extended));
+        PartitionNode* parent = d.partitionTable()->findPartitionBySector(pedPartition.first, PartitionRole(PartitionRole::Extended));
 
         // None found, so it's a primary in the device's partition table.
         if (parent == nullptr)
             parent = d.partitionTable();
 
-        FileSystem* fs = FileSystemFactory::create(type, pedPartition->geom.start, pedPartition->geom.end);
-        fs->scan(partitionNode);
-        QString mountPoint;
-        bool mounted;
-
-        // libparted does not handle LUKS partitions
-        if (fs->type() == FileSystem::Luks) {
-            r |= PartitionRole::Luks;
-            FS::luks* luksFs = static_cast<FS::luks*>(fs);
-            luksFs->initLUKS(d.logicalSize());
-            QString mapperNode = luksFs->mapperName();
-            mountPoint = FileSystem::detectMountPoint(fs, mapperNode);
-            mounted    = FileSystem::detectMountStatus(fs, mapperNode);
-        } else {
-            mountPoint = FileSystem::detectMountPoint(fs, partitionNode);
-            mounted = FileSystem::detectMountStatus(fs, partitionNode);
-        }
+        FileSystem* fs = probe.fs;
+        Partition* part = new Partition(parent, d, PartitionRole(probe.roles), fs, pedPartition.first, pedPartition.last, pedPartition.node, pedPartition.availableFlags, probe.mountPoint, probe.mounted, pedPartition.activeFlags);
 
-        Partition* part = new Partition(parent, d, PartitionRole(r), fs, pedPartition->geom.start, pedPartition->geom.end, partitionNode, availableFlags(pedPartition), mountPoint, mounted, activeFlags(pedPartition));
+        FileSystem::LazyAttributes lazy = probe.lazy;
 
         if (!part->roles().has(PartitionRole::Luks))
-            readSectorsUsed(pedDisk, d, *part, mountPoint);
-
-        if (fs->supportGetLabel() != FileSystem::cmdSupportNone)
-            fs->setLabel(fs->readLabel(part->deviceNode()));
-
-        // GPT partitions support partition labels and partition UUIDs
-        if(d.partitionTable()->type() == PartitionTable::TableType::gpt)
-            fs->setLabel(fs->readLabel(part->deviceNode()));
+            readSectorsUsed(pedDisk, d, *part, probe.mountPoint, lazy);
 
-        if (fs->supportGetUUID() != FileSystem::cmdSupportNone)
-            fs->setUUID(fs->readUUID(part->deviceNode()));
+        fs->setLazy(part->deviceNode(), d.logicalSize(), lazy);
 
         parent->append(part);
         partitions.append(part);
@@ -384,6 +496,17 @@ void LibPartedBackend::scanDevicePartitions(Device& d, PedDisk* pedDisk)
 */
 Device* LibPartedBackend::scanDevice(const QString& deviceNode)
 {
+    ScanCache::DeviceEntry cached;
+
+    if (ScanCache::self()->lookup(deviceNode, cached)) {
+        if (Device* d = restoreDevice(cached)) {
+            Log(Log::information) << xi18nc("@info:status", "Device found: %1", d->name());
+            return d;
+        }
+    }
+
+    QMutexLocker locker(&s_PedMutex);
+
     PedDevice* pedDevice = ped_device_get(deviceNode.toLocal8Bit().constData());
 
     if (pedDevice == nullptr) {
@@ -393,59 +516,177 @@ Device* LibPartedBackend::scanDevice(const QString& deviceNode)
 
     Log(Log::information) << xi18nc("@info:status", "Device found: %1", QString::fromUtf8(pedDevice->model));
 
-    DiskDevice* d = new DiskDevice(QString::fromUtf8(pedDevice->model), QString::fromUtf8(pedDevice->path), pedDevice->bios_geom.heads, pedDevice->bios_geom.sectors, pedDevice->bios_geom.cylinders, pedDevice->sector_size);
+    // sysfs knows the sector and I/O sizes already, so the device need not be opened again for them
+    BlockDeviceInfo info;
+    DiskDevice* d = BlockDeviceInfo::read(deviceNode, info)
+        ? new DiskDevice(QString::fromUtf8(pedDevice->model), QString::fromUtf8(pedDevice->path), pedDevice->bios_geom.heads, pedDevice->bios_geom.sectors, pedDevice->bios_geom.cylinders, pedDevice->sector_size, info.physicalBlockSize, info.optimalIOSize)
+        : new DiskDevice(QString::fromUtf8(pedDevice->model), QString::fromUtf8(pedDevice->path), pedDevice->bios_geom.heads, pedDevice->bios_geom.sectors, pedDevice->bios_geom.cylinders, pedDevice->sector_size);
 
+    // the partition table is read only once; all geometry is taken from this PedDisk
     PedDisk* pedDisk = ped_disk_new(pedDevice);
 
     if (pedDisk) {
         const PartitionTable::TableType type = PartitionTable::nameToTableType(QString::fromUtf8(pedDisk->type->name));
-        CoreBackend::setPartitionTableForDevice(*d, new PartitionTable(type, firstUsableSector(*d), lastUsableSector(*d)));
-        CoreBackend::setPartitionTableMaxPrimaries(*d->partitionTable(), ped_disk_get_max_primary_partition_count(pedDisk));
+        const qint32 maxPrimaries = ped_disk_get_max_primary_partition_count(pedDisk);
+        const qint64 length = pedDevice->length;
+
+        // without a GPT, partitions start after the first track and may go up to the last full cylinder
+        qint64 firstUsable = pedDevice->bios_geom.sectors;
+        qint64 lastUsable = static_cast<qint64>(pedDevice->bios_geom.sectors) * pedDevice->bios_geom.heads * pedDevice->bios_geom.cylinders - 1;
+
+        locker.unlock();
+
+        if (type == PartitionTable::gpt && !readGptUsableSectors(d->deviceNode(), d->logicalSize(), length, firstUsable, lastUsable)) {
+            Log(Log::warning) << xi18nc("@info:status", "Could not read the GPT header on device <filename>%1</filename>.", deviceNode);
+            firstUsable += 32;
+            lastUsable -= 32;
+        }
+
+        CoreBackend::setPartitionTableForDevice(*d, new PartitionTable(type, firstUsable, lastUsable));
+        CoreBackend::setPartitionTableMaxPrimaries(*d->partitionTable(), maxPrimaries);
 
         scanDevicePartitions(*d, pedDisk);
+        locker.relock();
+
+        ped_disk_destroy(pedDisk);
     }
 
     ped_device_destroy(pedDevice);
+    locker.unlock();
+
+    ScanCache::self()->store(*d);
+
     return d;
 }
 
+/** Creates a Device from what the ScanCache has about it, without opening it with libparted.
+
+    Mount points and mount status are always detected again, and so is the used capacity of
+    mounted file systems. Attributes that had not been read when the entry was stored are read
+    when they are first asked for, as after a scan. Unmounted partitions must still start with what they started with when
+    the entry was stored, otherwise the device has to be scanned.
+
+    @param entry what the ScanCache has about the device
+    @return the created Device object or nullptr if a partition has changed. callers need to free this.
+*/
+Device* LibPartedBackend::restoreDevice(const ScanCache::DeviceEntry& entry)
+{
+    DiskDevice* d = new DiskDevice(entry.name, entry.deviceNode, entry.heads, entry.sectorsPerTrack, entry.cylinders, entry.logicalSectorSize, entry.physicalSectorSize, entry.optimalIOSize);
+
+    CoreBackend::setPartitionTableForDevice(*d, new PartitionTable(static_cast<PartitionTable::TableType>(entry.tableType), entry.firstUsable, entry.lastUsable));
+    CoreBackend::setPartitionTableMaxPrimaries(*d->partitionTable(), entry.maxPrimaries);
+
+    QList<Partition*> partitions;
+
+    for (const ScanCache::PartitionEntry& pe : entry.partitions) {
+        FileSystem* fs = FileSystemFactory::create(static_cast<FileSystem::Type>(pe.fileSystemType), pe.firstSector, pe.lastSector, pe.sectorsUsed, pe.label, pe.uuid);
+
+        const QString mountPoint = FileSystem::detectMountPoint(fs, pe.deviceNode);
+        const bool mounted = FileSystem::detectMountStatus(fs, pe.deviceNode);
+
+        if (!mounted && ScanCache::superblockDigest(pe.deviceNode) != pe.superblockDigest) {
+            delete fs;
+            delete d;
+            return nullptr;
+        }
+
+        Partition* part = new Partition(d->partitionTable(), *d, PartitionRole(PartitionRole::Roles(pe.roles)), fs, pe.firstSector, pe.lastSector, pe.deviceNode,
+                                        PartitionTable::Flags(pe.availableFlags), mountPoint, mounted, PartitionTable::Flags(pe.activeFlags));
+
+        // what was not read yet when the entry was stored is still left for later
+        FileSystem::LazyAttributes lazy = FileSystem::LazyAttributes(pe.pending);
+
+        // what a mounted file system uses changes all the time, but asking for it is cheap
+        if (mounted && !mountPoint.isEmpty()) {
+            lazy &= ~FileSystem::LazyUsed;
+            readSectorsUsed(nullptr, *d, *part, mountPoint, lazy);
+        }
+
+        fs->setLazy(pe.deviceNode, d->logicalSize(), lazy);
+
+        d->partitionTable()->append(part);
+        partitions.append(part);
+    }
+
+    d->partitionTable()->updateUnallocated(*d);
+
+    if (d->partitionTable()->isSectorBased(*d))
+        d->partitionTable()->setType(*d, PartitionTable::msdos_sectorbased);
+
+    foreach(const Partition * part, partitions)
+        PartitionAlignment::isAligned(*d, *part);
+
+    return d;
+}
+
+/** Scans one device of those found by scanDevices() on a worker thread. */
+class ScanDeviceTask : public QRunnable
+{
+public:
+    ScanDeviceTask(LibPartedBackend& backend, const QString& deviceNode, Device*& device, QAtomicInt& started, qint32 totalDevices) :
+        m_Backend(backend),
+        m_DeviceNode(deviceNode),
+        m_Device(device),
+        m_Started(started),
+        m_TotalDevices(totalDevices)
+    {
+    }
+
+    void run() override {
+        m_Backend.emitScanProgress(m_DeviceNode, m_Started.fetchAndAddOrdered(1) * 100 / m_TotalDevices);
+        m_Device = m_Backend.scanDevice(m_DeviceNode);
+    }
+
+private:
+    LibPartedBackend& m_Backend;
+    const QString m_DeviceNode;
+    Device*& m_Device;
+    QAtomicInt& m_Started;
+    const qint32 m_TotalDevices;
+};
+
+/** Scans all disk devices in the system.
+
+    Devices are scanned concurrently on a small thread pool: Most of the time goes into waiting for
+    the disks and for external tools, not into the CPU. The devices to scan are found by walking
+    sysfs once (see BlockDeviceInfo); the result is in the order they are listed in there, no
+    matter which scan finishes first.
+
+    @param excludeReadOnly true to skip read only devices
+    @return the created Device objects. callers need to free these.
+*/
 QList<Device*> LibPartedBackend::scanDevices(bool excludeReadOnly)
 {
     QList<Device*> result;
-    // linux.git/tree/Documentation/devices.txt
-    QString blockDeviceMajorNumbers = QStringLiteral(
-        "3,22,33,34,56,57,88,89,90,91,128,129,130,131,132,133,134,135," // MFM, RLL and IDE hard disk/CD-ROM interface
-        // "7," // loop devices TODO: add another bool option for loopDevices
-        "8,65,66,67,68,69,70,71," // SCSI disk devices
-        "80,81,82,83,84,85,86,87," // I2O hard disk
-        "179," // MMC block devices
-        "253," // Virtio KVM devices (e.g. /dev/vda)
-        "259" // Block Extended Major (include NVMe)
-    );
-    ExternalCommand cmd(QStringLiteral("lsblk"), {
-                          QStringLiteral("--nodeps"),
-                          QStringLiteral("--noheadings"),
-                          QStringLiteral("--output"), QString::fromLatin1("name"),
-                          QStringLiteral("--paths"),
-                          QStringLiteral("--include"), blockDeviceMajorNumbers});
-    if (cmd.run(-1) && cmd.exitCode() == 0) {
-        QStringList devices = cmd.output().split(QString::fromLatin1("\n"));
-        devices.removeLast();
-        quint32 totalDevices = devices.length();
-        for (quint32 i = 0; i < totalDevices; ++i) {
-            if (excludeReadOnly) {
-                QFile f(QStringLiteral("/sys/block/%1/ro").arg(QString(devices[i]).remove(QStringLiteral("/dev/"))));
-                if (f.open(QIODevice::ReadOnly))
-                    if (f.readLine().trimmed().toInt() == 1)
-                        continue;
-            }
 
-            emitScanProgress(devices[i], i * 100 / totalDevices);
-            Device* device = scanDevice(devices[i]);
-            if(device != nullptr) {
+    BlockDeviceInfo::Policy policy = BlockDeviceInfo::policy();
+    policy.excludeReadOnly = policy.excludeReadOnly || excludeReadOnly;
+
+    QStringList devices;
+    for (const BlockDeviceInfo& info : BlockDeviceInfo::enumerate(policy))
+        devices.append(info.deviceNode);
+
+    {
+        BlkidProbe::Scan blkidScan;
+        LvmInventory::Scan lvmScan;
+        MountTable::Scan mountScan;
+
+        const qint32 totalDevices = devices.size();
+        QVector<Device*> scanned(totalDevices, nullptr);
+        QAtomicInt started = 0;
+
+        // scanning mostly waits for the disks, so use more threads than there are cores, but
+        // not so many that dozens of devices are probed at once
+        QScopedPointer<QThreadPool> pool(createThreadPool(4, 16));
+
+        for (qint32 i = 0; i < totalDevices; ++i)
+            pool->start(new ScanDeviceTask(*this, devices[i], scanned[i], started, totalDevices));
+
+        pool->waitForDone();
+
+        for (Device* device : scanned)
+            if (device != nullptr)
                 result.append(device);
-            }
-        }
     }
 
     return result;
@@ -459,53 +700,38 @@ FileSystem::Type LibPartedBackend::detectFileSystem(const QString& partitionPath
 {
     FileSystem::Type rval = FileSystem::Unknown;
 
-    blkid_cache cache;
-    if (blkid_get_cache(&cache, nullptr) == 0) {
-        blkid_dev dev;
-
-        if ((dev = blkid_get_dev(cache,
-                                 partitionPath.toLocal8Bit().constData(),
-                                 BLKID_DEV_NORMAL)) != nullptr) {
-            char *string = blkid_get_tag_value(cache, "TYPE", partitionPath.toLocal8Bit().constData());
-            QString s = QString::fromUtf8(string);
-            free(string);
-
-            if (s == QStringLiteral("ext2")) rval = FileSystem::Ext2;
-            else if (s == QStringLiteral("ext3")) rval = FileSystem::Ext3;
-            else if (s.startsWith(QStringLiteral("ext4"))) rval = FileSystem::Ext4;
-            else if (s == QStringLiteral("swap")) rval = FileSystem::LinuxSwap;
-            else if (s == QStringLiteral("ntfs")) rval = FileSystem::Ntfs;
-            else if (s == QStringLiteral("reiserfs")) rval = FileSystem::ReiserFS;
-            else if (s == QStringLiteral("reiser4")) rval = FileSystem::Reiser4;
-            else if (s == QStringLiteral("xfs")) rval = FileSystem::Xfs;
-            else if (s == QStringLiteral("jfs")) rval = FileSystem::Jfs;
-            else if (s == QStringLiteral("hfs")) rval = FileSystem::Hfs;
-            else if (s == QStringLiteral("hfsplus")) rval = FileSystem::HfsPlus;
-            else if (s == QStringLiteral("ufs")) rval = FileSystem::Ufs;
-            else if (s == QStringLiteral("vfat")) {
-                // libblkid uses SEC_TYPE to distinguish between FAT16 and FAT32
-                string = blkid_get_tag_value(cache, "SEC_TYPE", partitionPath.toLocal8Bit().constData());
-                QString st = QString::fromUtf8(string);
-                free(string);
-                if (st == QStringLiteral("msdos"))
-                    rval = FileSystem::Fat16;
-                else
-                    rval = FileSystem::Fat32;
-            } else if (s == QStringLiteral("btrfs")) rval = FileSystem::Btrfs;
-            else if (s == QStringLiteral("ocfs2")) rval = FileSystem::Ocfs2;
-            else if (s == QStringLiteral("zfs_member")) rval = FileSystem::Zfs;
-            else if (s == QStringLiteral("hpfs")) rval = FileSystem::Hpfs;
-            else if (s == QStringLiteral("crypto_LUKS")) rval = FileSystem::Luks;
-            else if (s == QStringLiteral("exfat")) rval = FileSystem::Exfat;
-            else if (s == QStringLiteral("nilfs2")) rval = FileSystem::Nilfs2;
-            else if (s == QStringLiteral("LVM2_member")) rval = FileSystem::Lvm2_PV;
-            else if (s == QStringLiteral("f2fs")) rval = FileSystem::F2fs;
-            else
-                qWarning() << "blkid: unknown file system type " << s << " on " << partitionPath;
-        }
-
-        blkid_put_cache(cache);
-    }
+    const BlkidProbe::Result probe = BlkidProbe::probe(partitionPath);
+    const QString& s = probe.type;
+
+    if (s == QStringLiteral("ext2")) rval = FileSystem::Ext2;
+    else if (s == QStringLiteral("ext3")) rval = FileSystem::Ext3;
+    else if (s.startsWith(QStringLiteral("ext4"))) rval = FileSystem::Ext4;
+    else if (s == QStringLiteral("swap")) rval = FileSystem::LinuxSwap;
+    else if (s == QStringLiteral("ntfs")) rval = FileSystem::Ntfs;
+    else if (s == QStringLiteral("reiserfs")) rval = FileSystem::ReiserFS;
+    else if (s == QStringLiteral("reiser4")) rval = FileSystem::Reiser4;
+    else if (s == QStringLiteral("xfs")) rval = FileSystem::Xfs;
+    else if (s == QStringLiteral("jfs")) rval = FileSystem::Jfs;
+    else if (s == QStringLiteral("hfs")) rval = FileSystem::Hfs;
+    else if (s == QStringLiteral("hfsplus")) rval = FileSystem::HfsPlus;
+    else if (s == QStringLiteral("ufs")) rval = FileSystem::Ufs;
+    else if (s == QStringLiteral("vfat")) {
+        // libblkid uses SEC_TYPE to distinguish between FAT16 and FAT32
+        if (probe.secType == QStringLiteral("msdos"))
+            rval = FileSystem::Fat16;
+        else
+            rval = FileSystem::Fat32;
+    } else if (s == QStringLiteral("btrfs")) rval = FileSystem::Btrfs;
+    else if (s == QStringLiteral("ocfs2")) rval = FileSystem::Ocfs2;
+    else if (s == QStringLiteral("zfs_member")) rval = FileSystem::Zfs;
+    else if (s == QStringLiteral("hpfs")) rval = FileSystem::Hpfs;
+    else if (s == QStringLiteral("crypto_LUKS")) rval = FileSystem::Luks;
+    else if (s == QStringLiteral("exfat")) rval = FileSystem::Exfat;
+    else if (s == QStringLiteral("nilfs2")) rval = FileSystem::Nilfs2;
+    else if (s == QStringLiteral("LVM2_member")) rval = FileSystem::Lvm2_PV;
+    else if (s == QStringLiteral("f2fs")) rval = FileSystem::F2fs;
+    else if (!s.isEmpty())
+        qWarning() << "blkid: unknown file system type " << s << " on " << partitionPath;
 
     return rval;
 }
@@ -553,4 +779,10 @@ QString LibPartedBackend::lastPartedExceptionMessage()
     return s_lastPartedExceptionMessage;
 }
 
+/** @return the lock all calls into libparted from more than one thread must hold */
+QMutex& LibPartedBackend::pedMutex()
+{
+    return s_PedMutex;
+}
+
 #include "libpartedbackend.moc"
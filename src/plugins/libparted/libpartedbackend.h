@@ -23,6 +23,7 @@
 #include "backend/corebackend.h"
 
 #include "core/partitiontable.h"
+#include "core/scancache.h"
 #include "util/libpartitionmanagerexport.h"
 
 #include "fs/filesystem.h"
@@ -39,6 +40,7 @@ class LibPartedPartition;
 class OperationStack;
 
 class KPluginFactory;
+class QMutex;
 class QString;
 
 /** Backend plugin for libparted.
@@ -70,8 +72,10 @@ public:
     static QString lastPartedExceptionMessage();
 
 private:
+    static QMutex& pedMutex();
     static PedPartitionFlag getPedFlag(PartitionTable::Flag flag);
     void scanDevicePartitions(Device& d, PedDisk* pedDisk);
+    Device* restoreDevice(const ScanCache::DeviceEntry& entry);
 };
 
 #endif
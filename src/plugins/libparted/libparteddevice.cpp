@@ -16,19 +16,25 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
  *************************************************************************/
 
+#include "plugins/libparted/libpartedbackend.h"
 #include "plugins/libparted/libparteddevice.h"
 #include "plugins/libparted/libpartedpartitiontable.h"
 
 #include "core/partitiontable.h"
 
+#include "util/blockdeviceio.h"
 #include "util/globallog.h"
 #include "util/report.h"
 
+#include <QMutex>
+#include <QMutexLocker>
+
 #include <KLocalizedString>
 
 LibPartedDevice::LibPartedDevice(const QString& deviceNode) :
     CoreBackendDevice(deviceNode),
-    m_PedDevice(nullptr)
+    m_PedDevice(nullptr),
+    m_BlockIO(nullptr)
 {
 }
 
@@ -54,9 +60,18 @@ bool LibPartedDevice::openExclusive()
 {
     bool rval = open() && ped_device_open(pedDevice());
 
-    if (rval)
+    if (rval) {
         setExclusive(true);
 
+        // Bulk reads and writes bypass libparted so that several requests can be in flight at
+        // once. If the device cannot be opened for that, fall back to ped_device_read/write.
+        m_BlockIO = new BlockDeviceIO(deviceNode(), pedDevice()->sector_size);
+        if (!m_BlockIO->open(true)) {
+            delete m_BlockIO;
+            m_BlockIO = nullptr;
+        }
+    }
+
     return rval;
 }
 
@@ -64,13 +79,21 @@ bool LibPartedDevice::close()
 {
     Q_ASSERT(pedDevice());
 
+    bool rval = true;
+
+    if (m_BlockIO) {
+        rval = m_BlockIO->close();
+        delete m_BlockIO;
+        m_BlockIO = nullptr;
+    }
+
     if (pedDevice() && isExclusive()) {
         ped_device_close(pedDevice());
         setExclusive(false);
     }
 
     m_PedDevice = nullptr;
-    return true;
+    return rval;
 }
 
 CoreBackendPartitionTable* LibPartedDevice::openPartitionTable()
@@ -116,6 +139,12 @@ bool LibPartedDevice::readSectors(void* buffer, qint64 offset, qint64 numSectors
     if (!isExclusive())
         return false;
 
+    if (m_BlockIO)
+        return m_BlockIO->readSectors(buffer, offset, numSectors);
+
+    // libparted hands out one PedDevice per device node and ped_device_read() and ped_device_write()
+    // seek on it, so they must not interleave with other threads using the same device
+    QMutexLocker locker(&LibPartedBackend::pedMutex());
     return ped_device_read(pedDevice(), buffer, offset, numSectors);
 }
 
@@ -124,5 +153,23 @@ bool LibPartedDevice::writeSectors(void* buffer, qint64 offset, qint64 numSector
     if (!isExclusive())
         return false;
 
+    if (m_BlockIO)
+        return m_BlockIO->writeSectors(buffer, offset, numSectors);
+
+    QMutexLocker locker(&LibPartedBackend::pedMutex());
     return ped_device_write(pedDevice(), buffer, offset, numSectors);
 }
+
+bool LibPartedDevice::zeroSectors(qint64 offset, qint64 numSectors)
+{
+    return isExclusive() && m_BlockIO && m_BlockIO->zeroSectors(offset, numSectors);
+}
+
+bool LibPartedDevice::setDirectIO(bool b)
+{
+    // ped_device_read/write always go through the page cache
+    if (m_BlockIO == nullptr)
+        return false;
+
+    return m_BlockIO->setDirectIO(b);
+}
@@ -25,6 +25,7 @@
 
 #include <parted/parted.h>
 
+class BlockDeviceIO;
 class Partition;
 class PartitionTable;
 class Report;
@@ -49,6 +50,8 @@ public:
 
     bool readSectors(void* buffer, qint64 offset, qint64 numSectors) override;
     bool writeSectors(void* buffer, qint64 offset, qint64 numSectors) override;
+    bool setDirectIO(bool b) override;
+    bool zeroSectors(qint64 offset, qint64 numSectors) override;
 
 protected:
     PedDevice* pedDevice() {
@@ -57,6 +60,7 @@ protected:
 
 private:
     PedDevice* m_PedDevice;
+    BlockDeviceIO* m_BlockIO;
 };
 
 #endif
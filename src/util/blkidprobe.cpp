@@ -0,0 +1,102 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "util/blkidprobe.h"
+
+#include <blkid/blkid.h>
+
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+
+static QMutex s_ScanMutex;
+static qint32 s_ScanDepth = 0;
+static QHash<QString, BlkidProbe::Result> s_Results;
+
+BlkidProbe::Scan::Scan()
+{
+    QMutexLocker locker(&s_ScanMutex);
+    ++s_ScanDepth;
+}
+
+BlkidProbe::Scan::~Scan()
+{
+    QMutexLocker locker(&s_ScanMutex);
+
+    if (--s_ScanDepth == 0)
+        s_Results.clear();
+}
+
+/** Returns the values libblkid finds on a device node.
+
+    During a Scan each device node is only probed the first time it is asked for. Probing itself
+    happens without holding any lock, so several devices can be probed at the same time.
+
+    @param deviceNode the device node to probe, e.g. "/dev/sda1"
+    @return the values found
+*/
+BlkidProbe::Result BlkidProbe::probe(const QString& deviceNode)
+{
+    {
+        QMutexLocker locker(&s_ScanMutex);
+
+        if (s_ScanDepth > 0 && s_Results.contains(deviceNode))
+            return s_Results.value(deviceNode);
+    }
+
+    const Result rval = probeDevice(deviceNode);
+
+    QMutexLocker locker(&s_ScanMutex);
+
+    if (s_ScanDepth > 0)
+        s_Results.insert(deviceNode, rval);
+
+    return rval;
+}
+
+BlkidProbe::Result BlkidProbe::probeDevice(const QString& deviceNode)
+{
+    Result rval;
+
+    blkid_probe pr = blkid_new_probe_from_filename(deviceNode.toLocal8Bit().constData());
+
+    if (pr == nullptr)
+        return rval;
+
+    blkid_probe_enable_superblocks(pr, 1);
+    blkid_probe_set_superblocks_flags(pr, BLKID_SUBLKS_TYPE | BLKID_SUBLKS_SECTYPE | BLKID_SUBLKS_LABEL | BLKID_SUBLKS_UUID);
+    blkid_probe_enable_partitions(pr, 1);
+    blkid_probe_set_partitions_flags(pr, BLKID_PARTS_ENTRY_DETAILS);
+
+    if (blkid_do_safeprobe(pr) == 0) {
+        const auto value = [pr](const char* name) {
+            const char* data = nullptr;
+            return blkid_probe_lookup_value(pr, name, &data, nullptr) == 0 ? QString::fromUtf8(data) : QString();
+        };
+
+        rval.type = value("TYPE");
+        rval.secType = value("SEC_TYPE");
+        rval.label = value("LABEL");
+        rval.uuid = value("UUID");
+        rval.partUuid = value("PART_ENTRY_UUID");
+        rval.partLabel = value("PART_ENTRY_NAME");
+    }
+
+    blkid_free_probe(pr);
+
+    return rval;
+}
@@ -0,0 +1,71 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(BLKIDPROBE__H)
+
+#define BLKIDPROBE__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QString>
+#include <QtGlobal>
+
+/** Probes a device node with libblkid's low-level probing API.
+
+    All values scanning needs are read in one go: the file system type and secondary type, the
+    label and UUID of the file system and the UUID and name of the partition table entry. libblkid's
+    cache based API (blkid_get_cache(), blkid_get_tag_value() and so on) instead probes the device
+    again for each value asked for and reads and writes the cache file each time.
+
+    While a BlkidProbe::Scan object exists, the results are kept, so a device node is only probed
+    once however many times its values are asked for while scanning. Outside of a scan, every call
+    to probe() reads the device again.
+*/
+class LIBKPMCORE_EXPORT BlkidProbe
+{
+public:
+    /** The values read from a device node. All are empty if nothing was found. */
+    struct Result {
+        QString type;       /**< TYPE, e.g. "ext4" or "vfat" */
+        QString secType;    /**< SEC_TYPE, e.g. "msdos" for FAT12 and FAT16 */
+        QString label;      /**< LABEL of the file system */
+        QString uuid;       /**< UUID of the file system */
+        QString partUuid;   /**< PARTUUID, the UUID of the partition table entry */
+        QString partLabel;  /**< PARTLABEL, the name of the partition table entry */
+    };
+
+    /** Keeps probe results for as long as it exists.
+
+        Scans may be nested; the results are dropped when the outermost Scan ends.
+    */
+    class LIBKPMCORE_EXPORT Scan
+    {
+        Q_DISABLE_COPY(Scan)
+
+    public:
+        Scan();
+        ~Scan();
+    };
+
+public:
+    static Result probe(const QString& deviceNode);
+
+private:
+    static Result probeDevice(const QString& deviceNode);
+};
+
+#endif
@@ -0,0 +1,437 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "util/blockdeviceio.h"
+
+#include <QAtomicInt>
+#include <QDebug>
+#include <QMutexLocker>
+#include <QRunnable>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/fs.h>
+
+#if defined(WITH_LIBURING)
+#include <liburing.h>
+#endif
+
+/** Size in bytes of a single request submitted to the device */
+static const qint64 chunkSize = 1024 * 1024;
+
+/** Reads or writes all of @p length bytes at @p offset, retrying on short transfers and EINTR.
+    @return true on success
+*/
+static bool transferFully(int fd, bool write, char* buffer, qint64 offset, qint64 length)
+{
+    while (length > 0) {
+        const ssize_t n = write ? pwrite(fd, buffer, length, offset) : pread(fd, buffer, length, offset);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0) {
+            // an early end of the device is no reason to try another way
+            if (n == 0)
+                errno = EIO;
+            return false;
+        }
+
+        buffer += n;
+        offset += n;
+        length -= n;
+    }
+
+    return true;
+}
+
+/** One chunk of a transfer handed to the thread pool */
+class BlockDeviceIOTask : public QRunnable
+{
+public:
+    BlockDeviceIOTask(int fd, bool write, char* buffer, qint64 offset, qint64 length, QAtomicInt& failed) :
+        QRunnable(),
+        m_Fd(fd),
+        m_Write(write),
+        m_Buffer(buffer),
+        m_Offset(offset),
+        m_Length(length),
+        m_Failed(failed)
+    {
+    }
+
+    void run() override {
+        if (m_Failed.loadAcquire())
+            return;
+
+        if (!transferFully(m_Fd, m_Write, m_Buffer, m_Offset, m_Length))
+            m_Failed.storeRelease(1);
+    }
+
+private:
+    const int m_Fd;
+    const bool m_Write;
+    char* const m_Buffer;
+    const qint64 m_Offset;
+    const qint64 m_Length;
+    QAtomicInt& m_Failed;
+};
+
+/** Creates a new BlockDeviceIO. The device is not opened yet.
+    @param path path of the block device (or file) to read from and write to
+    @param sectorSize the sector size used to convert sector offsets to bytes
+    @param queueDepth the maximum number of requests to keep in flight
+*/
+BlockDeviceIO::BlockDeviceIO(const QString& path, qint32 sectorSize, qint32 queueDepth) :
+    m_Path(path),
+    m_SectorSize(sectorSize),
+    m_QueueDepth(qMax(queueDepth, 1)),
+    m_Fd(-1),
+    m_Writable(false),
+    m_DirectIO(false),
+    m_Engine(ThreadPool),
+    m_Ring(nullptr),
+    m_Pool(),
+    m_Mutex()
+{
+    m_Pool.setMaxThreadCount(m_QueueDepth);
+}
+
+/** Destroys a BlockDeviceIO, closing the device if it is still open. */
+BlockDeviceIO::~BlockDeviceIO()
+{
+    if (isOpen())
+        close();
+}
+
+/** Opens the device and sets up the Engine to use.
+    @param writable true if the device is going to be written to
+    @return true on success
+*/
+bool BlockDeviceIO::open(bool writable)
+{
+    Q_ASSERT(!isOpen());
+
+    if (isOpen())
+        return false;
+
+    m_Fd = ::open(path().toLocal8Bit().constData(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+
+    if (m_Fd == -1) {
+        qDebug() << "opening " << path() << " failed: " << strerror(errno);
+        return false;
+    }
+
+    m_Writable = writable;
+    m_DirectIO = false;
+    m_Engine = ThreadPool;
+
+#if defined(WITH_LIBURING)
+    m_Ring = new io_uring;
+
+    // io_uring is not available on kernels older than 5.1 or may be disabled, use threads then
+    if (io_uring_queue_init(queueDepth(), m_Ring, 0) == 0)
+        m_Engine = IoUring;
+    else {
+        delete m_Ring;
+        m_Ring = nullptr;
+    }
+#endif
+
+    return true;
+}
+
+/** Closes the device, flushing everything written to it.
+    @return true if all data written could be flushed to the device
+*/
+bool BlockDeviceIO::close()
+{
+    if (!isOpen())
+        return false;
+
+    m_Pool.waitForDone();
+
+#if defined(WITH_LIBURING)
+    if (m_Ring) {
+        io_uring_queue_exit(m_Ring);
+        delete m_Ring;
+        m_Ring = nullptr;
+    }
+#endif
+
+    bool rval = true;
+
+    if (m_Writable)
+        rval = fsync(m_Fd) == 0;
+
+    ::close(m_Fd);
+    m_Fd = -1;
+
+    return rval;
+}
+
+/** Reads sectors from the device into a buffer.
+    @param buffer the buffer to read into
+    @param offset the sector to start reading at
+    @param numSectors number of sectors to read
+    @return true on success
+*/
+bool BlockDeviceIO::readSectors(void* buffer, qint64 offset, qint64 numSectors)
+{
+    return transfer(false, static_cast<char*>(buffer), offset * sectorSize(), numSectors * sectorSize());
+}
+
+/** Writes sectors from a buffer to the device.
+    @param buffer the buffer with the data
+    @param offset the sector to start writing at
+    @param numSectors number of sectors to write
+    @return true on success
+*/
+bool BlockDeviceIO::writeSectors(void* buffer, qint64 offset, qint64 numSectors)
+{
+    if (!m_Writable)
+        return false;
+
+    return transfer(true, static_cast<char*>(buffer), offset * sectorSize(), numSectors * sectorSize());
+}
+
+/** Zeroes sectors without writing them from memory.
+
+    Uses the BLKZEROOUT ioctl, which lets the device zero the range itself where it supports
+    that (e.g. with WRITE ZEROES or WRITE SAME) and has the kernel write zeros otherwise.
+
+    @param offset the first sector to zero
+    @param numSectors the number of sectors to zero
+    @return true on success; false if the device is not a block device or does not support it
+*/
+bool BlockDeviceIO::zeroSectors(qint64 offset, qint64 numSectors)
+{
+    if (!m_Writable || !isOpen() || offset < 0 || numSectors < 0)
+        return false;
+
+    QMutexLocker locker(&m_Mutex);
+
+    quint64 range[2] = { static_cast<quint64>(offset * sectorSize()), static_cast<quint64>(numSectors * sectorSize()) };
+
+    int rval;
+    do {
+        rval = ioctl(m_Fd, BLKZEROOUT, range);
+    } while (rval < 0 && errno == EINTR);
+
+    return rval == 0;
+}
+
+/** Turns bypassing the page cache (O_DIRECT) on or off for an open file descriptor.
+    @param fd the file descriptor
+    @param b true to bypass the page cache
+    @return true on success; fails if the file system does not support direct I/O
+*/
+bool BlockDeviceIO::setDirectIOFlag(int fd, bool b)
+{
+    const int flags = fcntl(fd, F_GETFL);
+
+    if (flags == -1)
+        return false;
+
+    return fcntl(fd, F_SETFL, b ? flags | O_DIRECT : flags & ~O_DIRECT) == 0;
+}
+
+/** Turns bypassing the page cache on or off for the open device.
+
+    With direct I/O, buffers, offsets and lengths must be multiples of the sector size.
+    Transfers that are not are done through the page cache instead.
+
+    @param b true to bypass the page cache
+    @return true if the page cache is bypassed now
+*/
+bool BlockDeviceIO::setDirectIO(bool b)
+{
+    QMutexLocker locker(&m_Mutex);
+
+    if (!isOpen() || !setDirectIOFlag(m_Fd, b))
+        return false;
+
+    m_DirectIO = b;
+    return true;
+}
+
+bool BlockDeviceIO::transfer(bool write, char* buffer, qint64 offset, qint64 length)
+{
+    if (!isOpen() || offset < 0 || length < 0)
+        return false;
+
+    QMutexLocker locker(&m_Mutex);
+
+    if (!directIO())
+        return transferQueued(write, buffer, offset, length);
+
+    const bool aligned = reinterpret_cast<quintptr>(buffer) % sectorSize() == 0 &&
+                         offset % sectorSize() == 0 &&
+                         length % sectorSize() == 0;
+
+    if (!aligned)
+        return transferBuffered(write, buffer, offset, length);
+
+    // Some devices need a larger alignment than the logical sector size and refuse direct I/O
+    // with EINVAL. That shows on the first request, before anything else was issued, so only
+    // then is the transfer done through the page cache instead. Any other error, e.g. EIO or
+    // ENOSPC, is a real one and goes to the caller.
+    const qint64 first = qMin(length, chunkSize);
+
+    if (!transferFully(m_Fd, write, buffer, offset, first))
+        return errno == EINVAL && transferBuffered(write, buffer, offset, length);
+
+    return first == length || transferQueued(write, buffer + first, offset + first, length - first);
+}
+
+bool BlockDeviceIO::transferQueued(bool write, char* buffer, qint64 offset, qint64 length)
+{
+    // not worth the overhead of queueing if it fits in a single request
+    if (length <= chunkSize)
+        return transferFully(m_Fd, write, buffer, offset, length);
+
+    if (engine() == IoUring)
+        return transferIoUring(write, buffer, offset, length);
+
+    return transferThreadPool(write, buffer, offset, length);
+}
+
+/** Transfers data through the page cache while direct I/O is on, e.g. for an unaligned tail. */
+bool BlockDeviceIO::transferBuffered(bool write, char* buffer, qint64 offset, qint64 length)
+{
+    if (!setDirectIOFlag(m_Fd, false))
+        return false;
+
+    bool rval = transferFully(m_Fd, write, buffer, offset, length);
+
+    // make sure later direct reads see what was just written through the cache
+    if (rval && write)
+        rval = fdatasync(m_Fd) == 0;
+
+    setDirectIOFlag(m_Fd, true);
+
+    return rval;
+}
+
+bool BlockDeviceIO::transferIoUring(bool write, char* buffer, qint64 offset, qint64 length)
+{
+#if defined(WITH_LIBURING)
+    qint64 next = 0;
+    qint32 inFlight = 0;
+    bool failed = false;
+    bool ringBroken = false;
+
+    while (inFlight > 0 || (next < length && !failed)) {
+        qint32 queued = 0;
+
+        // keep the queue full as long as there are chunks left
+        while (!failed && next < length && inFlight + queued < queueDepth()) {
+            io_uring_sqe* sqe = io_uring_get_sqe(m_Ring);
+
+            if (sqe == nullptr)
+                break;
+
+            const qint64 n = qMin(chunkSize, length - next);
+
+            if (write)
+                io_uring_prep_write(sqe, m_Fd, buffer + next, n, offset + next);
+            else
+                io_uring_prep_read(sqe, m_Fd, buffer + next, n, offset + next);
+
+            // remember where the chunk starts so short transfers can be completed
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(static_cast<quintptr>(next)));
+
+            next += n;
+            queued++;
+        }
+
+        if (queued > 0) {
+            const int submitted = io_uring_submit(m_Ring);
+
+            // entries left in the submission queue would be picked up by the next transfer, so
+            // stop using the ring once everything submitted so far has completed
+            if (submitted < queued) {
+                failed = true;
+                ringBroken = true;
+            }
+
+            inFlight += qMax(submitted, 0);
+        }
+
+        if (inFlight == 0)
+            break;
+
+        io_uring_cqe* cqe = nullptr;
+        int rc;
+
+        while ((rc = io_uring_wait_cqe(m_Ring, &cqe)) == -EINTR)
+            ;
+
+        if (rc < 0) {
+            qWarning() << "waiting for io_uring completion failed on " << path() << ": " << strerror(-rc);
+            failed = true;
+            ringBroken = true;
+            break;
+        }
+
+        const qint64 chunkStart = static_cast<qint64>(reinterpret_cast<quintptr>(io_uring_cqe_get_data(cqe)));
+        const qint64 expected = qMin(chunkSize, length - chunkStart);
+        const qint64 done = cqe->res;
+
+        io_uring_cqe_seen(m_Ring, cqe);
+        inFlight--;
+
+        if (done < 0)
+            failed = true;
+        else if (done < expected && !failed)
+            failed = !transferFully(m_Fd, write, buffer + chunkStart + done, offset + chunkStart + done, expected - done);
+    }
+
+    if (ringBroken) {
+        // tearing down the ring waits for or cancels whatever the kernel still holds
+        io_uring_queue_exit(m_Ring);
+        delete m_Ring;
+        m_Ring = nullptr;
+        m_Engine = ThreadPool;
+    }
+
+    return !failed;
+#else
+    Q_UNUSED(write)
+    Q_UNUSED(buffer)
+    Q_UNUSED(offset)
+    Q_UNUSED(length)
+
+    return false;
+#endif
+}
+
+bool BlockDeviceIO::transferThreadPool(bool write, char* buffer, qint64 offset, qint64 length)
+{
+    QAtomicInt failed(0);
+
+    for (qint64 next = 0; next < length; next += chunkSize)
+        m_Pool.start(new BlockDeviceIOTask(m_Fd, write, buffer + next, offset + next, qMin(chunkSize, length - next), failed));
+
+    m_Pool.waitForDone();
+
+    return !failed.loadAcquire();
+}
@@ -0,0 +1,107 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(BLOCKDEVICEIO__H)
+
+#define BLOCKDEVICEIO__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QMutex>
+#include <QString>
+#include <QThreadPool>
+#include <QtGlobal>
+
+struct io_uring;
+
+/** Reads and writes sectors on a block device with several requests in flight.
+
+    Large reads and writes are split into chunks and up to queueDepth() of them are kept
+    in flight at the same time. Fast devices like NVMe drives only reach their rated
+    throughput at a queue depth greater than one, which a single blocking read() or
+    write() never gets them to.
+
+    If kpmcore was built with liburing and the kernel supports it, the chunks are submitted
+    through io_uring. Otherwise they are handed to a small pool of threads doing
+    pread()/pwrite().
+*/
+class LIBKPMCORE_EXPORT BlockDeviceIO
+{
+    Q_DISABLE_COPY(BlockDeviceIO)
+
+public:
+    /** The mechanism used to keep several requests in flight */
+    enum Engine {
+        IoUring,        /**< asynchronous I/O through io_uring */
+        ThreadPool      /**< blocking I/O on a pool of threads */
+    };
+
+public:
+    BlockDeviceIO(const QString& path, qint32 sectorSize, qint32 queueDepth = 8);
+    ~BlockDeviceIO();
+
+public:
+    bool open(bool writable);
+    bool close();
+
+    bool readSectors(void* buffer, qint64 offset, qint64 numSectors);
+    bool writeSectors(void* buffer, qint64 offset, qint64 numSectors);
+    bool zeroSectors(qint64 offset, qint64 numSectors);
+
+    bool setDirectIO(bool b);
+    static bool setDirectIOFlag(int fd, bool b);
+
+    bool isOpen() const {
+        return m_Fd != -1;    /**< @return true if the device is open */
+    }
+    const QString& path() const {
+        return m_Path;    /**< @return the path of the device or file */
+    }
+    qint32 sectorSize() const {
+        return m_SectorSize;    /**< @return the sector size used to compute offsets */
+    }
+    qint32 queueDepth() const {
+        return m_QueueDepth;    /**< @return the maximum number of requests in flight */
+    }
+    Engine engine() const {
+        return m_Engine;    /**< @return the Engine in use */
+    }
+    bool directIO() const {
+        return m_DirectIO;    /**< @return true if the page cache is bypassed */
+    }
+
+protected:
+    bool transfer(bool write, char* buffer, qint64 offset, qint64 length);
+    bool transferQueued(bool write, char* buffer, qint64 offset, qint64 length);
+    bool transferBuffered(bool write, char* buffer, qint64 offset, qint64 length);
+    bool transferIoUring(bool write, char* buffer, qint64 offset, qint64 length);
+    bool transferThreadPool(bool write, char* buffer, qint64 offset, qint64 length);
+
+private:
+    const QString m_Path;
+    const qint32 m_SectorSize;
+    const qint32 m_QueueDepth;
+    int m_Fd;
+    bool m_Writable;
+    bool m_DirectIO;
+    Engine m_Engine;
+    io_uring* m_Ring;
+    QThreadPool m_Pool;
+    QMutex m_Mutex;
+};
+
+#endif
@@ -0,0 +1,46 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "util/crc32.h"
+
+/** Computes a CRC-32 as used by zlib, gzip, PNG and GPT.
+    @param data the data
+    @param size number of bytes of data
+    @param crc the result for the data before this, to compute a CRC-32 piece by piece
+    @return the CRC-32
+*/
+quint32 checksumCrc32(const char* data, qint64 size, quint32 crc)
+{
+    static quint32 table[256];
+    static const bool tableReady = [] {
+        for (quint32 i = 0; i < 256; i++) {
+            quint32 c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    Q_UNUSED(tableReady)
+
+    crc = ~crc;
+
+    for (qint64 i = 0; i < size; i++)
+        crc = table[(crc ^ static_cast<uchar>(data[i])) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
@@ -17,14 +17,178 @@
  *************************************************************************/
 
 #include "util/externalcommand.h"
+#include "util/helpers.h"
 
+#include "util/progressparser.h"
 #include "util/report.h"
 
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFutureInterface>
+#include <QRunnable>
 #include <QString>
 #include <QStringList>
+#include <QThreadPool>
 
 #include <KLocalizedString>
 
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/** @return the environment external commands run with; built only once */
+static const QStringList& commandEnvironment()
+{
+    static const QStringList environment = QStringList() << QStringLiteral("LC_ALL=C") << QStringLiteral("PATH=") + QString::fromUtf8(getenv("PATH")) << QStringLiteral("LVM_SUPPRESS_FD_WARNINGS=1");
+    return environment;
+}
+
+/** @return the thread pool runAsync() runs commands in */
+static QThreadPool* spawnPool()
+{
+    static QThreadPool* pool = createThreadPool(2, 8);
+
+    return pool;
+}
+
+/** Runs a command with posix_spawn and collects its standard output.
+
+    glibc implements posix_spawn with a vfork-like clone, so unlike fork() it does not need to
+    copy the page tables of the (possibly large) calling process. Standard input and standard
+    error are connected to /dev/null.
+*/
+static ExternalCommand::Result spawnCommand(const QString& cmd, const QStringList& args, int timeout)
+{
+    ExternalCommand::Result result = { false, false, -1, QString() };
+
+    // the encoded strings must stay alive until posix_spawnp() returns
+    QList<QByteArray> encoded;
+    encoded.append(QFile::encodeName(cmd));
+    for (const QString& arg : args)
+        encoded.append(QFile::encodeName(arg));
+
+    std::vector<char*> argv;
+    for (QByteArray& arg : encoded)
+        argv.push_back(arg.data());
+    argv.push_back(nullptr);
+
+    static QList<QByteArray> environmentStrings;
+    static std::vector<char*> environment = [] {
+        std::vector<char*> env;
+        for (const QString& variable : commandEnvironment())
+            environmentStrings.append(variable.toLocal8Bit());
+        for (QByteArray& variable : environmentStrings)
+            env.push_back(variable.data());
+        env.push_back(nullptr);
+        return env;
+    }();
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0)
+        return result;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    pid_t pid;
+    const int error = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environment.data());
+
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+
+    if (error != 0) {
+        close(fds[0]);
+        return result;
+    }
+
+    result.started = true;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QByteArray output;
+    char buffer[4096];
+
+    while (true) {
+        pollfd pfd = { fds[0], POLLIN, 0 };
+        const int wait = timeout < 0 ? -1 : static_cast<int>(qMax(Q_INT64_C(0), timeout - timer.elapsed()));
+        const int ready = poll(&pfd, 1, wait);
+
+        if (ready < 0 && errno == EINTR)
+            continue;
+
+        if (ready <= 0)
+            break;
+
+        const ssize_t n = read(fds[0], buffer, sizeof(buffer));
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0) {
+            result.finished = true;
+            break;
+        }
+
+        output.append(buffer, n);
+    }
+
+    close(fds[0]);
+
+    if (!result.finished)
+        kill(pid, SIGKILL);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+
+    if (result.finished && WIFEXITED(status))
+        result.exitCode = WEXITSTATUS(status);
+
+    result.output = QString::fromUtf8(output);
+
+    return result;
+}
+
+class SpawnTask : public QRunnable
+{
+public:
+    SpawnTask(const QString& cmd, const QStringList& args, int timeout) :
+        m_Command(cmd),
+        m_Args(args),
+        m_Timeout(timeout)
+    {
+        // the future must be running before anybody waits for it
+        m_Interface.reportStarted();
+    }
+
+    QFuture<ExternalCommand::Result> future() {
+        return m_Interface.future();
+    }
+
+    void run() override
+    {
+        const ExternalCommand::Result result = spawnCommand(m_Command, m_Args, m_Timeout);
+        m_Interface.reportResult(result);
+        m_Interface.reportFinished();
+    }
+
+private:
+    QString m_Command;
+    QStringList m_Args;
+    int m_Timeout;
+    QFutureInterface<ExternalCommand::Result> m_Interface;
+};
+
 /** Creates a new ExternalCommand instance without Report.
     @param cmd the command to run
     @param args the arguments to pass to the command
@@ -35,7 +199,14 @@ ExternalCommand::ExternalCommand(const QString& cmd, const QStringList& args) :
     m_Command(cmd),
     m_Args(args),
     m_ExitCode(-1),
-    m_Output()
+    m_Output(),
+    m_ErrorOutput(),
+    m_LineHandler(),
+    m_PartialLine(),
+    m_OutputLimit(-1),
+    m_OutputDropped(0),
+    m_LastLineTaken(false),
+    m_ProgressParser(nullptr)
 {
     setup();
 }
@@ -51,18 +222,26 @@ ExternalCommand::ExternalCommand(Report& report, const QString& cmd, const QStri
     m_Command(cmd),
     m_Args(args),
     m_ExitCode(-1),
-    m_Output()
+    m_Output(),
+    m_ErrorOutput(),
+    m_LineHandler(),
+    m_PartialLine(),
+    m_OutputLimit(-1),
+    m_OutputDropped(0),
+    m_LastLineTaken(false),
+    m_ProgressParser(nullptr)
 {
     setup();
 }
 
 void ExternalCommand::setup()
 {
-    setEnvironment(QStringList() << QStringLiteral("LC_ALL=C") << QStringLiteral("PATH=") + QString::fromUtf8(getenv("PATH")) << QStringLiteral("LVM_SUPPRESS_FD_WARNINGS=1"));
+    setEnvironment(commandEnvironment());
     setProcessChannelMode(SeparateChannels);
 
     connect(this, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, &ExternalCommand::onFinished);
     connect(this, &ExternalCommand::readyReadStandardOutput, this, &ExternalCommand::onReadOutput);
+    connect(this, &ExternalCommand::readyReadStandardError, this, &ExternalCommand::onReadError);
 }
 
 /** Starts the external command.
@@ -96,12 +275,17 @@ bool ExternalCommand::waitFor(int timeout)
     closeWriteChannel();
 
     if (!waitForFinished(timeout)) {
+        reportOutput();
         if (report())
             report()->line() << xi18nc("@info:status", "(Command timeout while running)");
         return false;
     }
 
     onReadOutput();
+    onReadError();
+    handleLines(QByteArray(), true);
+    reportOutput();
+
     return true;
 }
 
@@ -114,14 +298,141 @@ bool ExternalCommand::run(int timeout)
     return start(timeout) && waitFor(timeout) && exitStatus() == 0;
 }
 
+/** Runs a command asynchronously.
+
+    The command runs in a thread pool that runs at most maxConcurrent() commands at a time. Its
+    standard input and standard error are connected to /dev/null, so this is meant for commands
+    that only need to be read from. The output is not written to any Report.
+
+    @param cmd the command to run
+    @param args the arguments to pass to the command
+    @param timeout timeout in milliseconds after which the command is killed, -1 for none
+    @return a future for the Result of the command
+*/
+QFuture<ExternalCommand::Result> ExternalCommand::runAsync(const QString& cmd, const QStringList& args, int timeout)
+{
+    SpawnTask* task = new SpawnTask(cmd, args, timeout);
+    const QFuture<Result> future = task->future();
+
+    spawnPool()->start(task);
+
+    return future;
+}
+
+/** @return the maximum number of commands runAsync() runs at the same time */
+int ExternalCommand::maxConcurrent()
+{
+    return spawnPool()->maxThreadCount();
+}
+
+/** @param n the maximum number of commands runAsync() may run at the same time */
+void ExternalCommand::setMaxConcurrent(int n)
+{
+    spawnPool()->setMaxThreadCount(qMax(1, n));
+}
+
 void ExternalCommand::onReadOutput()
 {
-    const QString s = QString::fromUtf8(readAllStandardOutput());
+    const QByteArray data = readAllStandardOutput();
+
+    if (data.isEmpty())
+        return;
 
+    if (m_ProgressParser)
+        m_ProgressParser->feed(QString::fromUtf8(data));
+
+    if (m_LineHandler)
+        handleLines(data, false);
+    else
+        appendOutput(QString::fromUtf8(data));
+}
+
+/** Keeps output no LineHandler took.
+
+    Without an output limit, it goes straight to the Report too. With one, only the end of it is
+    kept and reportOutput() writes that to the Report when the command is done.
+
+    @param s the output to keep
+*/
+void ExternalCommand::appendOutput(const QString& s)
+{
     m_Output += s;
 
-    if (report())
-        *report() << s;
+    if (m_OutputLimit < 0) {
+        if (report())
+            *report() << s;
+        return;
+    }
+
+    if (m_Output.size() > m_OutputLimit) {
+        m_OutputDropped += m_Output.size() - m_OutputLimit;
+        m_Output.remove(0, m_Output.size() - m_OutputLimit);
+    }
+}
+
+/** Writes what was kept of the output to the Report if there is an output limit. */
+void ExternalCommand::reportOutput()
+{
+    if (m_OutputLimit < 0 || report() == nullptr)
+        return;
+
+    if (m_OutputDropped > 0)
+        *report() << xi18nc("@info:status", "(%1 characters of output left out)", m_OutputDropped) + QStringLiteral("\n");
+
+    *report() << m_Output;
+}
+
+void ExternalCommand::onReadError()
+{
+    const qint32 errorLimit = 64 * 1024;
+
+    m_ErrorOutput += QString::fromUtf8(readAllStandardError());
+
+    if (m_ErrorOutput.size() > errorLimit)
+        m_ErrorOutput.remove(0, m_ErrorOutput.size() - errorLimit);
+}
+
+/** Passes complete lines of output to the LineHandler and keeps those it does not take.
+
+    The part after the last line end is kept until more output arrives, so lines split over
+    several reads and multi byte characters at the end of a read come out whole.
+
+    @param data the output read
+    @param flush true if the command finished and the rest is a line even without a line end
+*/
+void ExternalCommand::handleLines(const QByteArray& data, bool flush)
+{
+    m_PartialLine += data;
+
+    if (!m_LineHandler) {
+        m_PartialLine.clear();
+        return;
+    }
+
+    qint32 start = 0;
+
+    for (qint32 i = 0; i < m_PartialLine.size(); i++) {
+        if (m_PartialLine[i] != '\n' && m_PartialLine[i] != '\r')
+            continue;
+
+        // an empty line is the rest of a "\r\n" or a blank line and goes wherever the line before it went
+        if (i > start)
+            m_LastLineTaken = m_LineHandler(QString::fromUtf8(m_PartialLine.constData() + start, i - start));
+
+        if (!m_LastLineTaken)
+            appendOutput(QString::fromUtf8(m_PartialLine.constData() + start, i + 1 - start));
+
+        start = i + 1;
+    }
+
+    m_PartialLine.remove(0, start);
+
+    if (flush) {
+        if (!m_PartialLine.isEmpty() && !m_LineHandler(QString::fromUtf8(m_PartialLine)))
+            appendOutput(QString::fromUtf8(m_PartialLine));
+
+        m_PartialLine.clear();
+    }
 }
 
 void ExternalCommand::onFinished(int exitCode, QProcess::ExitStatus exitStatus)
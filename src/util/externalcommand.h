@@ -21,19 +21,34 @@
 
 #include "util/libpartitionmanagerexport.h"
 
+#include <functional>
 #include <vector>
 
+#include <QFuture>
 #include <QProcess>
 #include <QStringList>
 #include <QString>
 #include <QtGlobal>
 
+class ProgressParser;
 class Report;
 
 /** An external command.
 
     Runs an external command as a child process.
 
+    Besides the blocking run(), short lived commands that only need their output, like the
+    probe tools used while scanning, can be run with runAsync(). It spawns the command
+    directly with posix_spawn instead of going through QProcess, runs at most maxConcurrent()
+    commands at a time and returns a QFuture, so independent commands can run in parallel.
+
+    Tools like e2fsck -v or ntfsclone can write megabytes of output. Callers that only need some
+    of it can set a LineHandler, which gets the output line by line as it arrives and can take
+    lines so they are neither kept nor written to the Report, and limit how much of the rest is
+    kept with setOutputLimit(). With a limit, the Report only gets what output() kept, once the
+    command has finished. Standard error is kept separately, up to the last 64 KiB, in
+    errorOutput().
+
     @author Volker Lanz <vl@fidra.de>
     @author Andrius Štikonas <andrius@stikonas.eu>
 */
@@ -41,6 +56,23 @@ class LIBKPMCORE_EXPORT ExternalCommand : public QProcess
 {
     Q_DISABLE_COPY(ExternalCommand)
 
+public:
+    /** The outcome of a command run with runAsync() */
+    struct Result {
+        bool started;       /**< true if the command could be started */
+        bool finished;      /**< true if the command finished before the timeout */
+        int exitCode;       /**< the exit code, -1 if the command did not exit normally */
+        QString output;     /**< what the command wrote to standard output */
+
+        bool success() const {
+            return started && finished && exitCode == 0;    /**< @return true if the command ran and exited with 0 */
+        }
+    };
+
+    /** Called with each non-empty line of standard output; lines may end with a newline or a carriage return.
+        @return true if the line was taken and is to be left out of output() and the Report */
+    typedef std::function<bool(const QString&)> LineHandler;
+
 public:
     explicit ExternalCommand(const QString& cmd = QString(), const QStringList& args = QStringList());
     explicit ExternalCommand(Report& report, const QString& cmd = QString(), const QStringList& args = QStringList());
@@ -57,6 +89,10 @@ public:
     bool waitFor(int timeout = 30000);
     bool run(int timeout = 30000);
 
+    static QFuture<Result> runAsync(const QString& cmd, const QStringList& args = QStringList(), int timeout = 30000);
+    static int maxConcurrent();
+    static void setMaxConcurrent(int n);
+
     int exitCode() const {
         return m_ExitCode;    /**< @return the exit code */
     }
@@ -65,6 +101,25 @@ public:
         return m_Output;    /**< @return the command output */
     }
 
+    const QString& errorOutput() const {
+        return m_ErrorOutput;    /**< @return the end of what the command wrote to standard error */
+    }
+
+    void setLineHandler(const LineHandler& handler) {
+        m_LineHandler = handler;    /**< @param handler the function to call for each line of output */
+    }
+
+    void setProgressParser(ProgressParser* parser) {
+        m_ProgressParser = parser;    /**< @param parser the ProgressParser to feed the output to or nullptr */
+    }
+
+    qint32 outputLimit() const {
+        return m_OutputLimit;    /**< @return the number of characters of output kept, -1 if all of it is kept */
+    }
+    void setOutputLimit(qint32 limit) {
+        m_OutputLimit = limit;    /**< @param limit the number of characters at the end of the output to keep and write to the Report, -1 for all of it */
+    }
+
     Report* report() {
         return m_Report;    /**< @return pointer to the Report or nullptr */
     }
@@ -77,6 +132,12 @@ protected:
 
     void onFinished(int exitCode, QProcess::ExitStatus exitStatus);
     void onReadOutput();
+    void onReadError();
+
+private:
+    void handleLines(const QByteArray& data, bool flush);
+    void appendOutput(const QString& s);
+    void reportOutput();
 
 private:
     Report *m_Report;
@@ -84,6 +145,13 @@ private:
     QStringList m_Args;
     int m_ExitCode;
     QString m_Output;
+    QString m_ErrorOutput;
+    LineHandler m_LineHandler;
+    QByteArray m_PartialLine;
+    qint32 m_OutputLimit;
+    qint64 m_OutputDropped;
+    bool m_LastLineTaken;
+    ProgressParser* m_ProgressParser;
 };
 
 #endif
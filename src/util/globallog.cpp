@@ -19,18 +19,15 @@
 
 GlobalLog* GlobalLog::instance()
 {
-    static GlobalLog* p = nullptr;
-
-    if (p == nullptr)
-        p = new GlobalLog();
+    static GlobalLog* p = new GlobalLog();
 
     return p;
 }
 
 void GlobalLog::flush(Log::Level lev)
 {
-    emit newMessage(lev, msg);
-    msg.clear();
+    emit newMessage(lev, msg.localData());
+    msg.localData().clear();
 }
 
 // --------------------------------------------------------------------------
@@ -23,6 +23,7 @@
 
 #include <QString>
 #include <QObject>
+#include <QThreadStorage>
 #include <QtGlobal>
 
 class LIBKPMCORE_EXPORT Log
@@ -46,6 +47,10 @@ private:
 };
 
 /** Global logging.
+
+    Messages are put together per thread, so threads logging at the same time do not mix up
+    each other's lines.
+
     @author Volker Lanz <vl@fidra.de>
 */
 class LIBKPMCORE_EXPORT GlobalLog : public QObject
@@ -68,12 +73,12 @@ public:
 
 private:
     void append(const QString& s) {
-        msg += s;
+        msg.localData() += s;
     }
     void flush(Log::Level level);
 
 private:
-    QString msg;
+    QThreadStorage<QString> msg;
 };
 
 inline Log operator<<(Log l, const QString& s)
@@ -20,6 +20,8 @@
 #include "util/externalcommand.h"
 #include "util/globallog.h"
 
+#include "core/mounttable.h"
+
 #include "ops/operation.h"
 
 #include <KAboutData>
@@ -29,6 +31,8 @@
 #include <QMenu>
 #include <QHeaderView>
 #include <QRect>
+#include <QThread>
+#include <QThreadPool>
 #include <QTreeWidget>
 
 void registerMetaTypes()
@@ -71,6 +75,9 @@ void showColumnsContextMenu(const QPoint& p, QTreeWidget& tree)
 
 bool isMounted(const QString& deviceNode)
 {
+    if (const MountTable* mountTable = MountTable::current())
+        return mountTable->isMounted(deviceNode);
+
     ExternalCommand cmd(QStringLiteral("lsblk"),
                         { QStringLiteral("--noheadings"),
                           QStringLiteral("--nodeps"),
@@ -101,3 +108,18 @@ KAboutData aboutKPMcore()
 
     return aboutData;
 }
+
+/** Creates a thread pool for work that mostly waits for the disks or for external tools.
+
+    Such work gains from more threads than there are cores, but only up to a point.
+
+    @param minThreads the number of threads to allow even with fewer cores
+    @param maxThreads the number of threads to allow at most, however many cores there are
+    @return the new thread pool, owned by the caller
+*/
+QThreadPool* createThreadPool(int minThreads, int maxThreads)
+{
+    QThreadPool* pool = new QThreadPool();
+    pool->setMaxThreadCount(qBound(minThreads, QThread::idealThreadCount(), maxThreads));
+    return pool;
+}
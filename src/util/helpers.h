@@ -30,6 +30,7 @@ class KAboutData;
 class Partition;
 class QString;
 class QPoint;
+class QThreadPool;
 class QTreeWidget;
 
 LIBKPMCORE_EXPORT void registerMetaTypes();
@@ -44,6 +45,8 @@ LIBKPMCORE_EXPORT bool isMounted(const QString& deviceNode);
 
 LIBKPMCORE_EXPORT KAboutData aboutKPMcore();
 
+LIBKPMCORE_EXPORT QThreadPool* createThreadPool(int minThreads, int maxThreads);
+
 /** Pointer to the file system (which might be inside LUKS container) contained in the partition
  * @param p Partition where we look for file system
  * @return pointer to the FileSystem
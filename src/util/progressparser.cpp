@@ -0,0 +1,195 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "util/progressparser.h"
+
+#include "util/report.h"
+
+#include <QRegularExpression>
+#include <QTime>
+
+#include <KLocalizedString>
+
+/** Creates a new ProgressParser.
+    @param report the Report to pass the progress on to
+    @param parse the function that extracts the percentage done from the tool's output
+    @param bytes the number of bytes the tool works on, -1 if unknown
+*/
+ProgressParser::ProgressParser(Report& report, const ParseFunction& parse, qint64 bytes) :
+    m_Report(report),
+    m_Parse(parse),
+    m_Bytes(bytes),
+    m_Line(),
+    m_Percent(0),
+    m_ReportedPercent(0),
+    m_Started(),
+    m_LastUpdate()
+{
+    m_Started.start();
+}
+
+/** Feeds output of the tool to the parser.
+    @param output the output as it arrived
+*/
+void ProgressParser::feed(const QString& output)
+{
+    m_Line += output;
+
+    qint32 start = 0;
+
+    for (qint32 i = 0; i < m_Line.size(); i++) {
+        if (m_Line[i] != QLatin1Char('\n') && m_Line[i] != QLatin1Char('\r'))
+            continue;
+
+        if (i > start)
+            update(m_Parse(m_Line.mid(start, i - start)));
+
+        start = i + 1;
+    }
+
+    m_Line.remove(0, start);
+
+    if (!m_Line.isEmpty())
+        update(m_Parse(m_Line));
+}
+
+void ProgressParser::update(qint32 percent)
+{
+    if (percent <= m_Percent)
+        return;
+
+    m_Percent = qMin(percent, 100);
+
+    if (m_LastUpdate.isValid() && m_LastUpdate.elapsed() < 250 && m_Percent < 100)
+        return;
+
+    m_LastUpdate.start();
+    m_Report.setProgress(m_Percent);
+
+    if (m_Percent / 5 == m_ReportedPercent / 5 || m_Percent == 100 || m_Started.elapsed() < 1000)
+        return;
+
+    m_ReportedPercent = m_Percent;
+
+    const qint64 elapsed = m_Started.elapsed();
+    const qint64 estSecsLeft = (100 - m_Percent) * elapsed / m_Percent / 1000;
+
+    if (m_Bytes > 0) {
+        const qint64 mibsPerSec = m_Bytes * m_Percent / 100 / 1024 / 1024 * 1000 / elapsed;
+        m_Report.line() << xi18nc("@info:progress", "%1% done, %2 MiB/second, estimated time left: %3", m_Percent, mibsPerSec, QTime(0, 0).addSecs(estSecsLeft).toString());
+    } else
+        m_Report.line() << xi18nc("@info:progress", "%1% done, estimated time left: %2", m_Percent, QTime(0, 0).addSecs(estSecsLeft).toString());
+}
+
+/** Parses the completion information of e2fsck -C 1.
+
+    Each line is "pass current max device". The passes take very different amounts of time, so
+    they are weighted the same way e2fsck weights them for its own progress bar.
+*/
+ProgressParser::ParseFunction ProgressParser::e2fsck()
+{
+    return [] (const QString& line) {
+        static const QRegularExpression re(QStringLiteral("^([1-5]) (\\d+) (\\d+) \\S+$"));
+        static const qint32 passStart[] = { 0, 70, 90, 92, 95, 100 };
+
+        const QRegularExpressionMatch match = re.match(line);
+        if (!match.hasMatch())
+            return -1;
+
+        const qint32 pass = match.captured(1).toInt();
+        const qint64 current = match.captured(2).toLongLong();
+        const qint64 max = match.captured(3).toLongLong();
+
+        if (max <= 0)
+            return passStart[pass - 1];
+
+        return static_cast<qint32>(passStart[pass - 1] + (passStart[pass] - passStart[pass - 1]) * qMin(current, max) / max);
+    };
+}
+
+/** Parses the progress bars of resize2fs -p.
+
+    Each pass starts with "Begin pass N (max = M)" and then draws a bar of 40 "X" on one line.
+    Which passes run depends on the resize, so all four count the same.
+*/
+ProgressParser::ParseFunction ProgressParser::resize2fs()
+{
+    qint32 pass = 0;
+
+    return [pass] (const QString& line) mutable {
+        static const QRegularExpression re(QStringLiteral("^Begin pass (\\d+)"));
+
+        const QRegularExpressionMatch match = re.match(line);
+        if (match.hasMatch()) {
+            pass = qBound(1, match.captured(1).toInt(), 4);
+            return (pass - 1) * 25;
+        }
+
+        if (pass == 0)
+            return -1;
+
+        const qint32 bar = qMin(line.count(QLatin1Char('X')), 40);
+        return bar > 0 ? (pass - 1) * 25 + bar * 25 / 40 : -1;
+    };
+}
+
+/** Parses the "12.34 percent completed" lines of ntfsclone.
+
+    ntfsclone first scans the volume and then copies it, each from 0 to 100 percent; only
+    copying is counted.
+*/
+ProgressParser::ParseFunction ProgressParser::ntfsclone()
+{
+    bool copying = false;
+
+    return [copying] (const QString& line) mutable {
+        static const QRegularExpression re(QStringLiteral("(\\d+)(?:\\.\\d+)? percent completed"));
+
+        if (line.contains(QStringLiteral("Cloning NTFS")))
+            copying = true;
+
+        const QRegularExpressionMatch match = re.match(line);
+        return copying && match.hasMatch() ? match.captured(1).toInt() : -1;
+    };
+}
+
+/** Parses the " 0% ... 10% ... 20%" line of xfs_copy. */
+ProgressParser::ParseFunction ProgressParser::xfsCopy()
+{
+    return [] (const QString& line) {
+        static const QRegularExpression re(QStringLiteral("(\\d+)%"));
+
+        qint32 rval = -1;
+        QRegularExpressionMatchIterator it = re.globalMatch(line);
+
+        while (it.hasNext())
+            rval = it.next().captured(1).toInt();
+
+        return rval;
+    };
+}
+
+/** Parses the "/dev/sda1: Moved: 12.34%" lines of pvmove --interval. */
+ProgressParser::ParseFunction ProgressParser::pvmove()
+{
+    return [] (const QString& line) {
+        static const QRegularExpression re(QStringLiteral("Moved: (\\d+)(?:\\.\\d+)?%"));
+
+        const QRegularExpressionMatch match = re.match(line);
+        return match.hasMatch() ? match.captured(1).toInt() : -1;
+    };
+}
@@ -0,0 +1,83 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#if !defined(PROGRESSPARSER__H)
+
+#define PROGRESSPARSER__H
+
+#include "util/libpartitionmanagerexport.h"
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QtGlobal>
+
+#include <functional>
+
+class Report;
+
+/** Extracts the progress of a long running tool from its output.
+
+    Tools like e2fsck, ntfsclone, xfs_copy or pvmove can run for hours. An ExternalCommand given a
+    ProgressParser feeds it the tool's output as it arrives; the ParseFunction picks the percentage
+    done out of it and the parser passes it on with Report::setProgress(), which the running Job
+    turns into its progress. Progress only ever goes up and is passed on at most four times a
+    second. Every 5% the parser also adds a line with the throughput, if the number of bytes the
+    tool works on is known, and the estimated time left to the Report.
+
+    The ParseFunction is called with each complete line of output and again with the incomplete
+    last line each time more of it arrives, because some tools draw their progress bars without
+    ever ending the line.
+*/
+class LIBKPMCORE_EXPORT ProgressParser
+{
+    Q_DISABLE_COPY(ProgressParser)
+
+public:
+    /** @return the percentage done from a line of output, or -1 if the line has none */
+    typedef std::function<qint32(const QString& line)> ParseFunction;
+
+public:
+    ProgressParser(Report& report, const ParseFunction& parse, qint64 bytes = -1);
+
+public:
+    void feed(const QString& output);
+
+    qint32 percent() const {
+        return m_Percent;    /**< @return the percentage done so far */
+    }
+
+    static ParseFunction e2fsck();
+    static ParseFunction resize2fs();
+    static ParseFunction ntfsclone();
+    static ParseFunction xfsCopy();
+    static ParseFunction pvmove();
+
+private:
+    void update(qint32 percent);
+
+private:
+    Report& m_Report;
+    ParseFunction m_Parse;
+    qint64 m_Bytes;
+    QString m_Line;
+    qint32 m_Percent;
+    qint32 m_ReportedPercent;
+    QElapsedTimer m_Started;
+    QElapsedTimer m_LastUpdate;
+};
+
+#endif
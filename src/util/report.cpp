@@ -133,6 +133,24 @@ void Report::emitOutputChanged()
     emit outputChanged();
 }
 
+/** Passes on the progress of whatever this Report is about.
+
+    The progress goes to this Report and all its parents, so the Job this Report is part of gets
+    it no matter how deep down the Report is.
+
+    @param percent the percentage done
+*/
+void Report::setProgress(int percent)
+{
+    for (Report* r = this; r != nullptr; r = r->parent())
+        r->emitProgressChanged(percent);
+}
+
+void Report::emitProgressChanged(int percent)
+{
+    emit progressChanged(percent);
+}
+
 /** @return the root Report */
 Report* Report::root()
 {
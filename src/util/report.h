@@ -49,6 +49,7 @@ public:
 
 Q_SIGNALS:
     void outputChanged();
+    void progressChanged(int percent);
 
 public:
     Report* newChild(const QString& cmd = QString());
@@ -84,6 +85,7 @@ public:
         m_Status = s;    /**< @param s the new status */
     }
     void addOutput(const QString& s);
+    void setProgress(int percent);
 
     QString toHtml() const;
     QString toText() const;
@@ -95,6 +97,7 @@ public:
 
 protected:
     void emitOutputChanged();
+    void emitProgressChanged(int percent);
 
 private:
     Report* m_Parent;
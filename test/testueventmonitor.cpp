@@ -0,0 +1,105 @@
+/*************************************************************************
+ *  Copyright (C) 2017 by Andrius Štikonas <andrius@stikonas.eu>         *
+ *                                                                       *
+ *  This program is free software; you can redistribute it and/or        *
+ *  modify it under the terms of the GNU General Public License as       *
+ *  published by the Free Software Foundation; either version 3 of       *
+ *  the License, or (at your option) any later version.                  *
+ *                                                                       *
+ *  This program is distributed in the hope that it will be useful,      *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ *  GNU General Public License for more details.                         *
+ *                                                                       *
+ *  You should have received a copy of the GNU General Public License    *
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ *************************************************************************/
+
+#include "core/devicescanner.h"
+#include "core/ueventmonitor.h"
+
+#include <QList>
+#include <QObject>
+#include <QtTest>
+
+#include <initializer_list>
+
+/** @return a uevent message as the kernel sends it: the fields, each terminated by a null byte */
+static QByteArray message(std::initializer_list<const char*> fields)
+{
+    QByteArray rval;
+
+    for (const char* field : fields) {
+        rval.append(field);
+        rval.append('\0');
+    }
+
+    return rval;
+}
+
+class TestUEventMonitor : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void parse();
+    void replay();
+};
+
+void TestUEventMonitor::parse()
+{
+    UEvent event;
+
+    QVERIFY(UEvent::parse(message({ "change@/devices/virtual/block/loop0", "ACTION=change", "SUBSYSTEM=block", "DEVNAME=loop0", "DEVTYPE=disk" }), event));
+    QCOMPARE(event.action, QStringLiteral("change"));
+    QCOMPARE(event.devPath, QStringLiteral("/devices/virtual/block/loop0"));
+    QCOMPARE(event.subsystem(), QStringLiteral("block"));
+    QCOMPARE(event.devName(), QStringLiteral("loop0"));
+    QCOMPARE(event.devType(), QStringLiteral("disk"));
+
+    // udev's own messages have a binary header
+    QVERIFY(!UEvent::parse(QByteArray("libudev\0\xfe\xed\xca\xfe", 12), event));
+}
+
+/** Replays a hot plug of a disk with one partition, followed by the "change" of the whole disk
+    that udev makes the kernel send after the disk was scanned, and the removal of the partition. */
+void TestUEventMonitor::replay()
+{
+    UEventMonitor monitor;
+    QList<UEvent> events;
+
+    connect(&monitor, &UEventMonitor::blockDeviceEvent, [&events] (const UEvent& event) { events.append(event); });
+
+    monitor.feed(message({ "add@/devices/pci0000:00/0000:00:14.0/usb2/2-1/2-1:1.0/host6/target6:0:0/6:0:0:0/block/sdb",
+                           "ACTION=add", "SUBSYSTEM=block", "DEVNAME=sdb", "DEVTYPE=disk", "MAJOR=8", "MINOR=16" }));
+    monitor.feed(message({ "add@/devices/pci0000:00/0000:00:14.0/usb2/2-1/2-1:1.0/host6/target6:0:0/6:0:0:0/block/sdb/sdb1",
+                           "ACTION=add", "SUBSYSTEM=block", "DEVNAME=sdb1", "DEVTYPE=partition", "MAJOR=8", "MINOR=17" }));
+    monitor.feed(message({ "add@/devices/pci0000:00/0000:00:14.0/usb2/2-1", "ACTION=add", "SUBSYSTEM=usb", "DEVTYPE=usb_device" }));
+    monitor.feed(QByteArray("libudev\0\xfe\xed\xca\xfe", 12));
+    monitor.feed(message({ "change@/devices/pci0000:00/0000:00:14.0/usb2/2-1/2-1:1.0/host6/target6:0:0/6:0:0:0/block/sdb",
+                           "ACTION=change", "SUBSYSTEM=block", "DEVNAME=sdb", "DEVTYPE=disk", "MAJOR=8", "MINOR=16" }));
+    monitor.feed(message({ "change@/devices/virtual/block/loop0", "ACTION=change", "SUBSYSTEM=block", "DEVNAME=loop0", "DEVTYPE=disk" }));
+    monitor.feed(message({ "change@/devices/virtual/block/dm-0", "ACTION=change", "SUBSYSTEM=block", "DEVNAME=dm-0", "DEVTYPE=disk" }));
+    monitor.feed(message({ "remove@/devices/pci0000:00/0000:00:14.0/usb2/2-1/2-1:1.0/host6/target6:0:0/6:0:0:0/block/sdb/sdb1",
+                           "ACTION=remove", "SUBSYSTEM=block", "DEVNAME=sdb1", "DEVTYPE=partition", "MAJOR=8", "MINOR=17" }));
+
+    // the usb device and the udev message are not block device events
+    QCOMPARE(events.size(), 6);
+
+    QStringList actions;
+    QStringList disks;
+
+    for (const UEvent& event : events) {
+        actions.append(event.action);
+        disks.append(DeviceScanner::diskForEvent(event));
+    }
+
+    QCOMPARE(actions, QStringList({ QStringLiteral("add"), QStringLiteral("add"), QStringLiteral("change"), QStringLiteral("change"), QStringLiteral("change"), QStringLiteral("remove") }));
+
+    // loop devices are not scanned by default, device mapper devices never
+    QCOMPARE(disks, QStringList({ QStringLiteral("sdb"), QStringLiteral("sdb"), QStringLiteral("sdb"), QString(), QString(), QStringLiteral("sdb") }));
+}
+
+QTEST_GUILESS_MAIN(TestUEventMonitor)
+
+#include "testueventmonitor.moc"